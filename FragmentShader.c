@@ -1,9 +1,12 @@
 
-uniform sampler2D field;
+// LAYERS is defined by the loader: one field per render target, all
+// convolved in the same draw
+uniform sampler2D field[LAYERS];
 uniform float kernels[25];
 uniform float gain;
+uniform vec2 size;
 
-void main()
+vec4 convolve(sampler2D f)
 {
     int i,j;
     float pos[2];
@@ -13,9 +16,9 @@ void main()
         for (j=0; j<5; j++) {
             pos[0] = float(i)-2.0;
             pos[1] = float(j)-2.0;
-            t = texture2D(field,
-                          vec2((gl_FragCoord.x+pos[0])/500.0,
-                               (gl_FragCoord.y+pos[1])/500.0)).rgb;
+            t = texture2D(f,
+                          vec2((gl_FragCoord.x+pos[0])/size.x,
+                               (gl_FragCoord.y+pos[1])/size.y)).rgb;
             t *= vec3(kernels[i+j*5]);
             t.r += t.b * pos[0] * -0.5;
             t.g += t.b * pos[1] * -0.5;
@@ -23,9 +26,23 @@ void main()
         }
     }
     a.rgb *= vec3(gain);
-    b = texture2D(field,vec2(gl_FragCoord/500.0));
+    b = texture2D(f,gl_FragCoord.xy/size);
     b *= vec4(b.a);
     a += b;
 
-    gl_FragColor = a;
+    return a;
+}
+
+void main()
+{
+    gl_FragData[0] = convolve(field[0]);
+#if LAYERS > 1
+    gl_FragData[1] = convolve(field[1]);
+#endif
+#if LAYERS > 2
+    gl_FragData[2] = convolve(field[2]);
+#endif
+#if LAYERS > 3
+    gl_FragData[3] = convolve(field[3]);
+#endif
 }
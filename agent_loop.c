@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "agent_loop.h"
+#include "influence_time.h"
+
+double aloop_now(mapper_device dev)
+{
+    mapper_timetag_t now;
+    mdev_now(dev, &now);
+    return now.sec + now.frac / 4294967296.0;
+}
+
+#ifdef __linux__
+static void set_timer(int fd, double value, double interval)
+{
+    struct itimerspec its;
+    its.it_value.tv_sec = (time_t)value;
+    its.it_value.tv_nsec = (long)((value - its.it_value.tv_sec) * 1e9);
+    its.it_interval.tv_sec = (time_t)interval;
+    its.it_interval.tv_nsec =
+        (long)((interval - its.it_interval.tv_sec) * 1e9);
+
+    // a zero it_value would disarm the timer
+    if (value > 0 && !its.it_value.tv_sec && !its.it_value.tv_nsec)
+        its.it_value.tv_nsec = 1;
+    timerfd_settime(fd, 0, &its, 0);
+}
+
+static void watch_fd(struct _agentLoop *loop, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void sync_dev_fds(struct _agentLoop *loop)
+{
+    // devices open new sockets as they come up, keep the set current
+    if (mdev_num_fds(loop->dev) == loop->num_dev_fds)
+        return;
+
+    int i;
+    for (i = 0; i < loop->num_dev_fds; i++)
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->dev_fds[i], 0);
+
+    loop->num_dev_fds = mdev_get_fds(loop->dev, loop->dev_fds,
+                                     ALOOP_MAX_FDS);
+    for (i = 0; i < loop->num_dev_fds; i++)
+        watch_fd(loop, loop->dev_fds[i]);
+}
+#endif
+
+void aloop_init(struct _agentLoop *loop, mapper_device dev,
+                mapper_monitor mon, double rate, int substeps)
+{
+    memset(loop, 0, sizeof(struct _agentLoop));
+
+    if (rate <= 0)
+        rate = 1.0 / REFERENCE_STEP;
+    if (substeps < 1)
+        substeps = 1;
+
+    loop->dev = dev;
+    loop->mon = mon;
+    loop->period = 1.0 / rate;
+    loop->substeps = substeps;
+    loop->step = loop->period / substeps;
+
+    // Never try to catch up more than a quarter second of motion at once
+    loop->max_steps = (int)(0.25 / loop->step);
+    if (loop->max_steps < substeps)
+        loop->max_steps = substeps;
+
+    loop->integrated = aloop_now(dev);
+    loop->next_tick = loop->integrated + loop->period;
+
+#ifdef __linux__
+    loop->epoll_fd = epoll_create1(0);
+    loop->tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    loop->step_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (loop->epoll_fd < 0 || loop->tick_fd < 0 || loop->step_fd < 0) {
+        printf("Couldn't create epoll loop, falling back to polling\n");
+        aloop_free(loop);
+        return;
+    }
+    watch_fd(loop, loop->tick_fd);
+    watch_fd(loop, loop->step_fd);
+    sync_dev_fds(loop);
+    set_timer(loop->tick_fd, loop->period, loop->period);
+#endif
+}
+
+void aloop_free(struct _agentLoop *loop)
+{
+#ifdef __linux__
+    if (loop->epoll_fd > 0)
+        close(loop->epoll_fd);
+    if (loop->tick_fd > 0)
+        close(loop->tick_fd);
+    if (loop->step_fd > 0)
+        close(loop->step_fd);
+    loop->epoll_fd = loop->tick_fd = loop->step_fd = 0;
+#endif
+}
+
+static int step_due(struct _agentLoop *loop, double now)
+{
+    return loop->num_pending && now - loop->integrated >= loop->step;
+}
+
+static int steps_due(struct _agentLoop *loop, double now)
+{
+    int steps = (int)((now - loop->integrated) / loop->step);
+    if (steps > loop->max_steps) {
+        // Drop the backlog instead of jumping agents across the field
+        steps = loop->max_steps;
+        loop->integrated = now - steps * loop->step;
+    }
+    loop->integrated += steps * loop->step;
+    return steps;
+}
+
+#ifdef __linux__
+static int epoll_wait_tick(struct _agentLoop *loop)
+{
+    struct epoll_event events[ALOOP_MAX_FDS + 2];
+    uint64_t expirations;
+    int i, n, tick = 0, armed = 0;
+    double now;
+
+    while (1) {
+        n = epoll_wait(loop->epoll_fd, events, ALOOP_MAX_FDS + 2, -1);
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == loop->tick_fd) {
+                if (read(fd, &expirations, sizeof(expirations)) > 0)
+                    tick = 1;
+            }
+            else if (fd == loop->step_fd) {
+                if (read(fd, &expirations, sizeof(expirations)) > 0)
+                    armed = 0;
+            }
+            else
+                mdev_service_fd(loop->dev, fd);
+        }
+        if (loop->mon)
+            mapper_monitor_poll(loop->mon, 0);
+        sync_dev_fds(loop);
+
+        now = aloop_now(loop->dev);
+        if (tick || step_due(loop, now))
+            break;
+
+        // Wake again once the pending observation can be integrated
+        if (loop->num_pending && !armed) {
+            set_timer(loop->step_fd, loop->integrated + loop->step - now, 0);
+            armed = 1;
+        }
+    }
+    if (armed)
+        set_timer(loop->step_fd, 0, 0);
+
+    return steps_due(loop, now);
+}
+#endif
+
+int aloop_wait(struct _agentLoop *loop)
+{
+#ifdef __linux__
+    if (loop->epoll_fd > 0)
+        return epoll_wait_tick(loop);
+#endif
+
+    double now = aloop_now(loop->dev);
+    double remaining = loop->next_tick - now;
+
+    // Handle incoming messages until the tick is less than 1 ms away
+    while (remaining >= 0.001 && !step_due(loop, now)) {
+        if (loop->mon)
+            mapper_monitor_poll(loop->mon, 0);
+        mdev_poll(loop->dev, (int)(remaining * 1000));
+        now = aloop_now(loop->dev);
+        remaining = loop->next_tick - now;
+    }
+
+    // mdev_poll() only has millisecond resolution, sleep off the rest
+    if (remaining > 0 && !step_due(loop, now)) {
+        usleep((useconds_t)(remaining * 1000000));
+        now = aloop_now(loop->dev);
+    }
+
+    if (now >= loop->next_tick) {
+        loop->next_tick += loop->period;
+        if (loop->next_tick <= now)
+            loop->next_tick = now + loop->period;
+    }
+
+    return steps_due(loop, now);
+}
+
+void aloop_observed(struct _agentLoop *loop)
+{
+    if (!loop->dev || loop->num_pending >= ALOOP_MAX_PENDING)
+        return;
+    loop->pending[loop->num_pending++] = aloop_now(loop->dev);
+}
+
+void aloop_published(struct _agentLoop *loop)
+{
+    if (!loop->num_pending)
+        return;
+
+    int i;
+    double now = aloop_now(loop->dev), latency;
+    for (i = 0; i < loop->num_pending; i++) {
+        latency = now - loop->pending[i];
+        if (latency > loop->max_latency)
+            loop->max_latency = latency;
+        loop->latency[itime_bin(latency, ALOOP_LATENCY_BINS)]++;
+        loop->num_latency++;
+    }
+    loop->num_pending = 0;
+}
+
+static double latency_percentile(struct _agentLoop *loop, double p)
+{
+    unsigned int i, count = 0, target = (unsigned int)(p * loop->num_latency);
+    for (i = 0; i < ALOOP_LATENCY_BINS; i++) {
+        count += loop->latency[i];
+        if (count > target)
+            return itime_bin_ms(i);
+    }
+    return loop->max_latency * 1000;
+}
+
+void aloop_report(struct _agentLoop *loop)
+{
+    int i;
+    if (!loop->num_latency)
+        return;
+
+    printf("Observation -> output latency over %u observations:\n",
+           loop->num_latency);
+    printf("  p50 < %.3f ms, p90 < %.3f ms, p99 < %.3f ms, max %.3f ms\n",
+           latency_percentile(loop, 0.5), latency_percentile(loop, 0.9),
+           latency_percentile(loop, 0.99), loop->max_latency * 1000);
+    for (i = 0; i < ALOOP_LATENCY_BINS; i++) {
+        if (loop->latency[i])
+            // the last bin's upper edge is 2^32, so widen the shifts
+            printf("  %8llu - %8llu us: %u\n", i ? 1ULL << i : 0,
+                   1ULL << (i + 1), loop->latency[i]);
+    }
+}
@@ -0,0 +1,74 @@
+
+#ifndef _AGENT_LOOP_H_
+#define _AGENT_LOOP_H_
+
+#include <mapper/mapper.h>
+
+// The agent integrators were tuned for one step per 20 ms poll timeout,
+// so velocities are expressed per reference step.
+#define REFERENCE_STEP 0.02
+
+#define ALOOP_MAX_FDS      16
+#define ALOOP_MAX_PENDING  64
+#define ALOOP_LATENCY_BINS 32
+
+/* Fixed-step pacing for the agent main loops.  Time is read from the
+ * device clock (mdev_now), so the motion rate does not depend on how
+ * much traffic arrives between ticks.
+ *
+ * On Linux the loop sleeps in epoll on the device sockets and a timerfd
+ * instead of polling, so an observation is integrated and answered as
+ * soon as one integration step has elapsed rather than at the next
+ * poll timeout. */
+struct _agentLoop
+{
+    mapper_device dev;
+    mapper_monitor mon;
+
+    double period;      // seconds between output ticks
+    int substeps;       // integration steps per tick
+    double step;        // length of one integration step
+    int max_steps;      // catch-up limit after a stall
+
+    double next_tick;   // device time of the next output tick
+    double integrated;  // device time the agents are integrated up to
+
+    // arrival times of observations not yet answered by an output
+    double pending[ALOOP_MAX_PENDING];
+    int num_pending;
+
+    // observation -> output latency, bin i counts [2^i, 2^(i+1)) us
+    unsigned int latency[ALOOP_LATENCY_BINS];
+    unsigned int num_latency;
+    double max_latency;
+
+#ifdef __linux__
+    int epoll_fd;
+    int tick_fd;        // periodic timerfd, one expiry per tick
+    int step_fd;        // one-shot timerfd for an early answer
+    int dev_fds[ALOOP_MAX_FDS];
+    int num_dev_fds;
+#endif
+};
+
+double aloop_now(mapper_device dev);
+
+void aloop_init(struct _agentLoop *loop, mapper_device dev,
+                mapper_monitor mon, double rate, int substeps);
+void aloop_free(struct _agentLoop *loop);
+
+/* Service the device and monitor until the next tick is due, or until
+ * an observation is waiting and an integration step has elapsed, then
+ * return the number of integration steps to run. */
+int aloop_wait(struct _agentLoop *loop);
+
+// Call from signal handlers when an observation arrives.
+void aloop_observed(struct _agentLoop *loop);
+
+// Call after the outputs for the current steps have been sent.
+void aloop_published(struct _agentLoop *loop);
+
+// Print the observation -> output latency distribution.
+void aloop_report(struct _agentLoop *loop);
+
+#endif // _AGENT_LOOP_H_
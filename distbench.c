@@ -0,0 +1,337 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "influence_dist.h"
+#include "influence_time.h"
+
+/* Scaling benchmark for the distributed field.  Each configuration forks
+ * one process per strip, connected over the chosen transport, and steps
+ * them flat out for a number of ticks with agents sweeping across the
+ * strip boundaries.  The strips are then checked against the same run
+ * on one whole field.
+ *
+ * Strong scaling keeps the field size and adds ranks; weak scaling keeps
+ * the rows per rank, so the field grows with the ranks. */
+
+#define MAX_SWEEP 16
+
+// Options
+int rank_counts[MAX_SWEEP] = {1, 2, 4};
+int num_rank_counts = 3;
+const char *transports[MAX_SWEEP] = {"shm", "udp"};
+int num_transports = 2;
+int width = 256;
+int weak_rows = 64;
+int passes = 2;
+int num_agents = 20;
+int ticks = 300;
+int strong = 1, weak = 1;
+int check = 1;
+FILE *out = 0;
+
+struct _rankResult
+{
+    int     ok;
+    double  elapsed;
+    double  exchange;
+    double  compute;
+    int     migrations;
+    long    bytes;
+};
+
+// Shared with the ranks: their results, the field and the observations
+struct _rankResult *results;
+float *field;
+float *observations;
+
+/* Agent i at tick t, the same in every process.  The vertical sweep is
+ * faster than the horizontal one, so agents keep crossing strips. */
+void agent_position(int i, int t, int height, float *pos)
+{
+    double phase = 2 * M_PI * i / num_agents;
+    pos[0] = width * (0.5 + 0.4 * sin(0.013 * t + phase));
+    pos[1] = height * (0.5 + 0.45 * sin(0.031 * t * (1 + i % 3) + phase));
+}
+
+int run_rank(const char *transport, int rank, int ranks, int height)
+{
+    struct _distNode *n = dist_new(rank, ranks, width, height, passes);
+    struct _rankResult *r = &results[rank];
+    char spec[256];
+    float pos[2];
+    int i, t;
+
+    if (!n)
+        return 1;
+    // keep concurrent or back-to-back runs apart
+    if (!strcmp(transport, "shm"))
+        snprintf(spec, sizeof(spec), "shm:/influence.bench.%d", getppid());
+    else
+        snprintf(spec, sizeof(spec), "udp:%d", 9400 + (getppid() % 500) * 16);
+    n->transport = dist_transport_open(spec, rank, ranks,
+                                       dist_message_size(width, passes));
+    if (!n->transport)
+        return 1;
+
+    double start = 0;
+    for (t=0; t < ticks; t++) {
+        // time from the first exchange, once every rank is up
+        if (t == 1)
+            start = itime_now();
+        for (i=0; i < num_agents; i++) {
+            agent_position(i, t, height, pos);
+            if (t)
+                dist_move_agent(n, i, pos[0], pos[1], 1, 0);
+            else
+                dist_add_agent(n, i, pos[0], pos[1], 1, 0);
+        }
+        if (dist_step(n))
+            return 1;
+        if (!t) {
+            n->exchange_time = n->compute_time = 0;
+            n->bytes_sent = 0;
+        }
+    }
+    r->elapsed = itime_now() - start;
+    r->exchange = n->exchange_time;
+    r->compute = n->compute_time;
+    r->migrations = n->migrations;
+    r->bytes = n->bytes_sent;
+
+    for (i=0; i < n->rows; i++)
+        memcpy(&field[(n->row0 + i) * width * 4],
+               dist_cell(n, 0, n->row0 + i), width * 4 * sizeof(float));
+    for (i=0; i < num_agents; i++)
+        if (n->agents[i].state == DIST_OWNED)
+            memcpy(&observations[i * 3], n->agents[i].obs,
+                   3 * sizeof(float));
+    r->ok = 1;
+
+    n->transport->close(n->transport);
+    dist_free(n);
+    return 0;
+}
+
+// Largest difference from the same run on one field.
+double compare(int height)
+{
+    struct _vfcpu_field *f = vfcpu_new(width, height);
+    float pos[2], obs[DIST_AGENTS][3];
+    int i, t, pass;
+    double error = 0;
+
+    for (t=0; t < ticks; t++) {
+        for (pass=0; pass < passes; pass++) {
+            vfcpu_begin_pass(f);
+            for (i=0; i < num_agents; i++) {
+                agent_position(i, t, height, pos);
+                vfcpu_draw_agent(f, pos[0], pos[1], 1, 0, obs[i]);
+            }
+            vfcpu_convolve(f);
+        }
+    }
+    for (i=0; i < width * height * 4; i++)
+        error = fmax(error, fabs(f->cells[f->dest][i] - field[i]));
+    for (i=0; i < num_agents * 3; i++)
+        error = fmax(error, fabs(obs[i / 3][i % 3] - observations[i]));
+    vfcpu_free(f);
+    return error;
+}
+
+void run(const char *scaling, const char *transport, int ranks, int height)
+{
+    int i, failed = 0;
+
+    memset(results, 0, sizeof(struct _rankResult) * ranks);
+    memset(field, 0, sizeof(float) * width * height * 4);
+    memset(observations, 0, sizeof(float) * num_agents * 3);
+    fflush(out);
+    for (i=0; i < ranks; i++) {
+        if (fork() == 0)
+            _exit(run_rank(transport, i, ranks, height));
+    }
+    while (wait(0) > 0) {}
+
+    struct _rankResult sum;
+    memset(&sum, 0, sizeof(sum));
+    for (i=0; i < ranks; i++) {
+        struct _rankResult *r = &results[i];
+        if (!r->ok)
+            failed = 1;
+        sum.elapsed = fmax(sum.elapsed, r->elapsed);
+        sum.exchange = fmax(sum.exchange, r->exchange);
+        sum.compute = fmax(sum.compute, r->compute);
+        sum.migrations += r->migrations;
+        sum.bytes += r->bytes;
+    }
+    if (failed) {
+        fprintf(stderr, "distbench: %s %s with %d ranks failed\n", scaling,
+                transport, ranks);
+        return;
+    }
+
+    int measured = ticks - 1;
+    fprintf(out, "%s,%s,%d,%d,%d,%d,%d,%d,%.3f,%.1f,%.3f,%.3f,%d,%.1f,",
+            scaling, transport, ranks, width, height, passes, num_agents,
+            measured, sum.elapsed, measured / sum.elapsed,
+            sum.exchange / measured * 1000, sum.compute / measured * 1000,
+            sum.migrations, sum.bytes / 1024.0 / measured);
+    if (check)
+        fprintf(out, "%g\n", compare(height));
+    else
+        fprintf(out, "-1\n");
+    fflush(out);
+}
+
+int parse_list(char *arg, int *list)
+{
+    int n = 0;
+    while (arg && n < MAX_SWEEP) {
+        list[n++] = atoi(arg);
+        arg = strchr(arg, ',');
+        if (arg)
+            arg++;
+    }
+    return n;
+}
+
+void CmdLine(int argc, char **argv)
+{
+    int c;
+    char *next;
+    while ((c = getopt(argc, argv, "hn:t:s:r:p:a:T:SWxo:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: distbench [-h] [-n <ranks>] [-t <transports>] "
+                   "[-s <size>] [-r <rows>]\n"
+                   "                 [-p <passes>] [-a <agents>] "
+                   "[-T <ticks>] [-S | -W] [-x] [-o <file>]\n");
+            printf("  -h  Help\n");
+            printf("  -n  Rank counts to sweep, default=1,2,4\n");
+            printf("  -t  Transports to sweep, default=shm,udp\n");
+            printf("  -s  Field width, and height for strong scaling, "
+                   "default=%d\n", width);
+            printf("  -r  Rows per rank for weak scaling, default=%d\n",
+                   weak_rows);
+            printf("  -p  Passes per tick, default=%d\n", passes);
+            printf("  -a  Agents, up to %d, default=%d\n", DIST_AGENTS,
+                   num_agents);
+            printf("  -T  Ticks per run, default=%d\n", ticks);
+            printf("  -S  Strong scaling only\n");
+            printf("  -W  Weak scaling only\n");
+            printf("  -x  Skip checking against a single field\n");
+            printf("  -o  Append CSV rows to <file> instead of stdout\n");
+            exit(0);
+        case 'n':
+            num_rank_counts = parse_list(optarg, rank_counts);
+            break;
+        case 't':
+            num_transports = 0;
+            for (next = optarg; next && num_transports < MAX_SWEEP; ) {
+                transports[num_transports++] = next;
+                next = strchr(next, ',');
+                if (next)
+                    *next++ = 0;
+            }
+            break;
+        case 's':
+            width = atoi(optarg);
+            break;
+        case 'r':
+            weak_rows = atoi(optarg);
+            break;
+        case 'p':
+            passes = atoi(optarg);
+            break;
+        case 'a':
+            num_agents = atoi(optarg);
+            break;
+        case 'T':
+            ticks = atoi(optarg);
+            break;
+        case 'S':
+            weak = 0;
+            break;
+        case 'W':
+            strong = 0;
+            break;
+        case 'x':
+            check = 0;
+            break;
+        case 'o':
+            out = fopen(optarg, "a");
+            if (!out) {
+                printf("distbench: Could not open `%s'.\n", optarg);
+                exit(1);
+            }
+            break;
+        case '?': // Unknown
+            printf("distbench: Bad options, use -h for help.\n");
+            exit(1);
+            break;
+        default:
+            abort();
+        }
+    }
+    if (num_agents < 0 || num_agents > DIST_AGENTS)
+        num_agents = DIST_AGENTS;
+    if (ticks < 2)
+        ticks = 2;
+}
+
+int main(int argc, char **argv)
+{
+    int i, j, max_ranks = 1;
+    CmdLine(argc, argv);
+
+    if (!out)
+        out = stdout;
+    if (out == stdout || !ftell(out))
+        fprintf(out, "scaling,transport,ranks,width,height,passes,agents,"
+                "ticks,seconds,tick_rate,exchange_ms,compute_ms,migrations,"
+                "kbytes_per_tick,max_error\n");
+
+    for (i=0; i < num_rank_counts; i++)
+        if (rank_counts[i] > max_ranks)
+            max_ranks = rank_counts[i];
+    int max_height = width > weak_rows * max_ranks ? width
+                                                  : weak_rows * max_ranks;
+    size_t size = sizeof(struct _rankResult) * max_ranks
+                  + sizeof(float) * (width * max_height * 4
+                                     + DIST_AGENTS * 3);
+    char *shared = (char*)mmap(0, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    results = (struct _rankResult*)shared;
+    field = (float*)(results + max_ranks);
+    observations = field + width * max_height * 4;
+
+    for (j=0; j < num_transports; j++) {
+        for (i=0; i < num_rank_counts; i++) {
+            if (rank_counts[i] < 1)
+                continue;
+            if (strong)
+                run("strong", transports[j], rank_counts[i], width);
+            if (weak)
+                run("weak", transports[j], rank_counts[i],
+                    weak_rows * rank_counts[i]);
+        }
+    }
+
+    munmap(shared, size);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,339 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <mapper/mapper.h>
+
+#include "influence_tenant.h"
+#include "influence_time.h"
+
+/* Hosts several independent influence fields in one process.  Each
+ * tenant named with -F gets its own field on the CPU engine and its own
+ * libmapper device, so /<name>.1/node/position and the observations
+ * behave as they do on a separate influence server.  All tenants tick
+ * together from one timer, stepped one after another.
+ *
+ * The fields run on the CPU engine.  Sharing one GL context between
+ * tenants is not supported: influence_opengl.c keeps a single field's
+ * textures, framebuffers and size in globals.  Hence the small default
+ * size: a 200x200 field steps in about 1.5 ms, so four hold 100 Hz on
+ * one core, where a single 500x500 field needs about 8 ms. */
+
+#define MAX_TENANTS 16
+
+struct _hostTenant
+{
+    mapper_device   dev;
+    mapper_signal   sigpos;
+    mapper_signal   sigobs_1d;
+    mapper_signal   sigobs_2d;
+    mapper_signal   sigobs_tick;
+} hosts[MAX_TENANTS];
+
+struct _tenant *tenants[MAX_TENANTS];
+int num_tenants = 0;
+
+// -F specs, added once every option has been read
+const char *tenant_specs[MAX_TENANTS];
+int num_specs = 0;
+
+int default_size = 200;
+int default_passes = 1;
+float update_rate = 100;
+int done = 0;
+
+void release_agent(struct _tenant *t, int instance_id)
+{
+    struct _hostTenant *h = (struct _hostTenant*)t->user;
+    t->agents[instance_id].active = 0;
+    msig_release_instance(h->sigpos, instance_id, MAPPER_NOW);
+    msig_release_instance(h->sigobs_1d, instance_id, MAPPER_NOW);
+    msig_release_instance(h->sigobs_2d, instance_id, MAPPER_NOW);
+    msig_release_instance(h->sigobs_tick, instance_id, MAPPER_NOW);
+}
+
+void on_signal_pos(mapper_signal msig,
+                   mapper_db_signal props,
+                   int instance_id,
+                   void *value,
+                   int count,
+                   mapper_timetag_t *timetag)
+{
+    struct _tenant *t = (struct _tenant*)props->user_data;
+    if (instance_id < 0 || instance_id >= TENANT_AGENTS)
+        return;
+    if (value) {
+        float *pos = (float*)value;
+        if (!t->agents[instance_id].active) {
+            struct _hostTenant *h = (struct _hostTenant*)t->user;
+            msig_match_instances(msig, h->sigobs_1d, instance_id);
+            msig_match_instances(msig, h->sigobs_2d, instance_id);
+            msig_match_instances(msig, h->sigobs_tick, instance_id);
+        }
+        t->agents[instance_id].active = 1;
+        t->agents[instance_id].pos[0] = pos[0];
+        t->agents[instance_id].pos[1] = pos[1];
+    }
+    else
+        release_agent(t, instance_id);
+}
+
+void on_signal_gain(mapper_signal msig,
+                    mapper_db_signal props,
+                    int instance_id,
+                    void *value,
+                    int count,
+                    mapper_timetag_t *timetag)
+{
+    struct _tenant *t = (struct _tenant*)props->user_data;
+    if (value && instance_id >= 0 && instance_id < TENANT_AGENTS)
+        t->agents[instance_id].gain = *(float*)value;
+}
+
+void on_signal_fade(mapper_signal msig,
+                    mapper_db_signal props,
+                    int instance_id,
+                    void *value,
+                    int count,
+                    mapper_timetag_t *timetag)
+{
+    struct _tenant *t = (struct _tenant*)props->user_data;
+    if (value && instance_id >= 0 && instance_id < TENANT_AGENTS)
+        t->agents[instance_id].fade = *(float*)value;
+}
+
+void on_signal_border_gain(mapper_signal msig,
+                           mapper_db_signal props,
+                           int instance_id,
+                           void *value,
+                           int count,
+                           mapper_timetag_t *timetag)
+{
+    struct _tenant *t = (struct _tenant*)props->user_data;
+    if (value)
+        t->field->border_gain = *(float*)value;
+}
+
+void on_signal_passes(mapper_signal msig,
+                      mapper_db_signal props,
+                      int instance_id,
+                      void *value,
+                      int count,
+                      mapper_timetag_t *timetag)
+{
+    struct _tenant *t = (struct _tenant*)props->user_data;
+    if (value && *(int*)value > 0)
+        t->passes = *(int*)value;
+}
+
+void on_instance_event(mapper_signal msig,
+                       mapper_db_signal props,
+                       int instance_id,
+                       msig_instance_event_t event,
+                       mapper_timetag_t *timetag)
+{
+    struct _tenant *t = (struct _tenant*)props->user_data;
+    if (event == IN_DOWNSTREAM_RELEASE && instance_id >= 0
+        && instance_id < TENANT_AGENTS)
+        release_agent(t, instance_id);
+}
+
+mapper_signal add_instanced_input(mapper_device dev, const char *name,
+                                  int length, float mn, float mx,
+                                  mapper_signal_handler *handler,
+                                  struct _tenant *t)
+{
+    mapper_signal sig = mdev_add_input(dev, name, length, 'f', 0, &mn, &mx,
+                                       handler, t);
+    msig_release_instance(sig, 0, MAPPER_NOW);
+    msig_reserve_instances(sig, TENANT_AGENTS-1, 0, 0);
+    return sig;
+}
+
+mapper_signal add_instanced_output(mapper_device dev, const char *name,
+                                   int length, char type, struct _tenant *t)
+{
+    float mn = -1, mx = 1;
+    mapper_signal sig = mdev_add_output(dev, name, length, type, 0,
+                                        type == 'f' ? &mn : 0,
+                                        type == 'f' ? &mx : 0);
+    msig_release_instance(sig, 0, MAPPER_NOW);
+    msig_reserve_instances(sig, TENANT_AGENTS-1, 0, 0);
+    msig_set_instance_event_callback(sig, on_instance_event,
+                                     IN_DOWNSTREAM_RELEASE, t);
+    return sig;
+}
+
+void add_tenant(const char *spec)
+{
+    char name[TENANT_NAME];
+    int size = default_size, passes = default_passes;
+
+    if (!tenant_parse(spec, name, &size, &passes) || size < 16
+        || passes < 1) {
+        printf("fieldhost: Bad field `%s', use name[:size[:passes]].\n",
+               spec);
+        exit(1);
+    }
+
+    struct _tenant *t = tenant_new(name, size, size, passes);
+    struct _hostTenant *h = &hosts[num_tenants];
+    t->user = h;
+    tenants[num_tenants++] = t;
+
+    h->dev = mdev_new(name, 0, 0);
+    float fmn = 0, fmx = 1;
+    mdev_add_input(h->dev, "/border_gain", 1, 'f', 0, &fmn, &fmx,
+                   on_signal_border_gain, t);
+    int imn = 1, imx = 16;
+    mdev_add_input(h->dev, "/passes", 1, 'i', 0, &imn, &imx,
+                   on_signal_passes, t);
+
+    h->sigpos = add_instanced_input(h->dev, "/node/position", 2, 0, size,
+                                    on_signal_pos, t);
+    add_instanced_input(h->dev, "/node/gain", 1, 0, 1, on_signal_gain, t);
+    add_instanced_input(h->dev, "/node/fade", 1, 0, 1, on_signal_fade, t);
+
+    h->sigobs_1d = add_instanced_output(h->dev, "/node/observation/1d", 1,
+                                        'f', t);
+    h->sigobs_2d = add_instanced_output(h->dev, "/node/observation", 2,
+                                        'f', t);
+    h->sigobs_tick = add_instanced_output(h->dev, "/node/observation/tick",
+                                          1, 'i', t);
+}
+
+void send_observations(struct _tenant *t)
+{
+    struct _hostTenant *h = (struct _hostTenant*)t->user;
+    mapper_timetag_t tt;
+    int i;
+
+    mdev_now(h->dev, &tt);
+    mdev_start_queue(h->dev, tt);
+    for (i=0; i < TENANT_AGENTS; i++) {
+        if (!t->agents[i].active)
+            continue;
+        msig_update_instance(h->sigobs_2d, i, t->agents[i].obs, 1, tt);
+        msig_update_instance(h->sigobs_1d, i, &t->agents[i].obs[2], 1, tt);
+        msig_update_instance(h->sigobs_tick, i, &t->tick, 1, tt);
+    }
+    mdev_send_queue(h->dev, tt);
+}
+
+void ctrlc(int sig)
+{
+    done = 1;
+}
+
+void CmdLine(int argc, char **argv)
+{
+    int c, i;
+    while ((c = getopt(argc, argv, "hF:r:s:p:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: fieldhost [-h] [-r <rate>] [-s <size>] "
+                   "[-p <passes>] -F <name>[:<size>[:<passes>]] ...\n");
+            printf("  -h  Help\n");
+            printf("  -F  Host a field as libmapper device <name>, "
+                   "up to %d\n", MAX_TENANTS);
+            printf("  -r  Update rate of every field, default=%g\n",
+                   update_rate);
+            printf("  -s  Default field size, default=%d\n", default_size);
+            printf("  -p  Default passes per frame, default=%d\n",
+                   default_passes);
+            printf("Fields run on the CPU, one after another each tick, "
+                   "not on the GPU.\n");
+            exit(0);
+        case 'F': // Field
+            if (num_specs >= MAX_TENANTS) {
+                printf("fieldhost: At most %d fields.\n", MAX_TENANTS);
+                exit(1);
+            }
+            tenant_specs[num_specs++] = optarg;
+            break;
+        case 'r': // Rate
+            update_rate = atof(optarg);
+            break;
+        case 's': // Default size
+            default_size = atoi(optarg);
+            break;
+        case 'p': // Default passes
+            default_passes = atoi(optarg);
+            break;
+        case '?': // Unknown
+            printf("fieldhost: Bad options, use -h for help.\n");
+            exit(1);
+            break;
+        default:
+            abort();
+        }
+    }
+    if (!num_specs) {
+        printf("fieldhost: No fields, use -F <name>.\n");
+        exit(1);
+    }
+    // -s and -p apply wherever they appear
+    for (i=0; i < num_specs; i++)
+        add_tenant(tenant_specs[i]);
+}
+
+int main(int argc, char **argv)
+{
+    int i, ticks = 0;
+    double step = 0, next_tick, next_report;
+
+    CmdLine(argc, argv);
+    signal(SIGINT, ctrlc);
+    signal(SIGTERM, ctrlc);
+
+    for (i=0; i < num_tenants; i++) {
+        while (!mdev_ready(hosts[i].dev))
+            mdev_poll(hosts[i].dev, 10);
+        printf("Hosting %s as %s, %dx%d, %d passes\n", tenants[i]->name,
+               mdev_name(hosts[i].dev), tenants[i]->field->width,
+               tenants[i]->field->height, tenants[i]->passes);
+    }
+
+    next_tick = next_report = itime_now();
+    next_report += 10;
+    while (!done) {
+        for (i=0; i < num_tenants; i++)
+            while (mdev_poll(hosts[i].dev, 0)) {}
+
+        double t = itime_now();
+        tenant_step_all(tenants, num_tenants);
+        step += itime_now() - t;
+        ticks++;
+
+        for (i=0; i < num_tenants; i++)
+            send_observations(tenants[i]);
+
+        if (t >= next_report) {
+            printf("%d fields, %.1f ticks/s, %.3f ms per tick\n",
+                   num_tenants, ticks / 10.0, step / ticks * 1000);
+            ticks = 0;
+            step = 0;
+            next_report += 10;
+        }
+
+        // poll the first device while waiting, the rest at the next tick
+        next_tick += 1.0 / update_rate;
+        double wait = next_tick - itime_now();
+        if (wait > 0)
+            mdev_poll(hosts[0].dev, (int)(wait * 1000));
+        else if (wait < -0.25)
+            next_tick = itime_now();
+    }
+
+    printf("Cleaning up...\n");
+    for (i=0; i < num_tenants; i++) {
+        mdev_free(hosts[i].dev);
+        tenant_free(tenants[i]);
+    }
+    return 0;
+}
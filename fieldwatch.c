@@ -0,0 +1,84 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "influence_export.h"
+#include "influence_time.h"
+
+// Example reader for the field export: follows the newest frame and
+// prints the frame rate and mean field magnitude once a second.  When
+// the server resizes the field it reattaches to the new export.
+
+int main(int argc, char **argv)
+{
+    const char *name = argc > 1 ? argv[1] : EXPORT_DEFAULT_NAME;
+    struct _exportReader r;
+    struct _exportSlot *slot;
+    unsigned int seq;
+    int i, last_tick = -1, frames = 0, retries = 0;
+    double sum = 0, latency = 0, next_report = itime_now() + 1;
+    double next_check = 0;
+
+    if (argc > 2 || (argc > 1 && argv[1][0] != '/')) {
+        printf("Usage: fieldwatch [shared memory name, default=%s]\n",
+               EXPORT_DEFAULT_NAME);
+        return 1;
+    }
+    r.header = 0;
+
+    while (1) {
+        if (!r.header) {
+            while (fexp_open_reader(&r, name)) {
+                printf("Waiting for %s...\n", name);
+                sleep(1);
+            }
+            printf("Watching %s, %dx%d\n", name, r.header->width,
+                   r.header->height);
+            last_tick = -1;
+        }
+
+        const float *cells = fexp_read_begin(&r, &slot, &seq);
+        if (!cells || slot->tick == last_tick) {
+            // a crashed server never retires its export, so look for a
+            // new one under the name once a second
+            int replaced = 0;
+            if (itime_now() > next_check) {
+                replaced = fexp_replaced(&r);
+                next_check = itime_now() + 1;
+            }
+            if (fexp_retired(&r) || replaced)
+                fexp_close_reader(&r);
+            else
+                usleep(1000);
+            continue;
+        }
+
+        int tick = slot->tick;
+        double mag = 0, time = slot->time;
+        int n = r.header->width * r.header->height;
+        for (i = 0; i < n; i++)
+            mag += sqrt(cells[i*4] * cells[i*4]
+                        + cells[i*4+1] * cells[i*4+1]);
+
+        if (!fexp_read_end(slot, seq)) {
+            retries++;
+            continue;
+        }
+        last_tick = tick;
+        frames++;
+        sum += mag / n;
+        latency += itime_now() - time;
+
+        if (itime_now() > next_report) {
+            printf("tick %d: %d frames/s, mean magnitude %f, "
+                   "latency %.3f ms, %d retries\n", tick, frames,
+                   sum / frames, latency / frames * 1000, retries);
+            frames = retries = 0;
+            sum = latency = 0;
+            next_report += 1;
+        }
+    }
+    return 0;
+}
@@ -5,32 +5,742 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 
 #include <mapper/mapper.h>
 
 #include "influence_opengl.h"
+#include "influence_cpu.h"
+#include "influence_log.h"
+#include "influence_export.h"
+#include "influence_shm.h"
+#include "influence_checkpoint.h"
+#include "influence_profile.h"
+#include "influence_dist.h"
+#include "influence_time.h"
 
 mapper_device dev = 0;
 mapper_timetag_t tt;
 mapper_signal sigpos;
 mapper_signal sigobs_1d;
 mapper_signal sigobs_2d;
+mapper_signal sigobs_tick;
+
+// Field tick counter, sent with each observation
+int field_tick = 0;
+
+// Lockstep: advance once every agent has sent a position, or after
+// lockstep_deadline ms
+int lockstep = 0;
+int lockstep_deadline = 100;
+double tick_start = 0;
+
+// Input log to record to, or to replay headless
+const char *record_file = 0;
+const char *replay_file = 0;
+int replay_paced = 0;
+
+// Shared memory to export each field tick to
+const char *export_name = 0;
+
+// Shared-memory table for local agents; slot i drives agents[SHM_AGENT(i)],
+// counting down from the top so libmapper instances keep the low ids.
+// With a table, libmapper only reserves the ids below the slots.
+#define SHM_AGENT(i) (maxAgents - 1 - (i))
+#define SHM_OWNED(i) (shm_table && (i) >= SHM_AGENT(SHM_SLOTS - 1))
+#define MAPPER_AGENTS (shm_table ? maxAgents - SHM_SLOTS : maxAgents)
+const char *shm_name = 0;
+struct _shmTable *shm_table = 0;
+unsigned int shm_seen[SHM_SLOTS];
+int shm_owner[SHM_SLOTS];
+
+// Latency tracing: each agent's newest input is stamped with its arrival
+// time and timetag, then with the tick that consumed it.  When that tick's
+// observation is sent, the time since arrival (server) and since the
+// timetag (end to end) go into log2 histograms, bin i counting
+// [2^i, 2^(i+1)) us.
+#define LATENCY_BINS 24
+struct _latencyTrace
+{
+    double          arrival;    // newest unanswered input, or 0
+    double          input_time; // its timetag, or arrival if it had none
+    int             tick;       // tick that consumed it, -1 until drawn
+    unsigned int    server[LATENCY_BINS];
+    unsigned int    total[LATENCY_BINS];
+    double          max_total;
+} latency[maxAgents];
+unsigned int latency_server[LATENCY_BINS];
+unsigned int latency_total[LATENCY_BINS];
+int latency_requested = 0;
+mapper_signal siglat_server;
+mapper_signal siglat_total;
+mapper_signal siglat_node;
+double next_latency_stats = 0;
+
+/* Adaptive load: with a frame budget, each frame's cost is smoothed and
+ * compared against it.  Under sustained overload load is shed one step at
+ * a time, first passes, then observation sends (every 2, 4, 8 ticks),
+ * then window redraws; with headroom the steps are undone in reverse
+ * order and passes are raised up to adapt_max_passes. */
+#define ADAPT_HOLD 30           // frames between decisions
+#define ADAPT_SMOOTHING 0.1
+#define ADAPT_HIGH 0.95         // shed above this fraction of the budget
+#define ADAPT_LOW 0.6           // undo shedding below this fraction
+#define ADAPT_MAX_DECIMATION 8
+#define ADAPT_MAX_SKIP 8
+double adapt_budget = 0;        // seconds per frame, 0 when off
+int adapt_max_passes = 8;
+double adapt_cost = 0;
+int adapt_hold = ADAPT_HOLD;
+int obs_decimation = 1;
+mapper_signal sigadapt_cost;
+mapper_signal sigadapt_passes;
+mapper_signal sigadapt_decimation;
+mapper_signal sigadapt_skip;
+
+// Field size requested on /field/size, applied after the current frame
+int resize_width = 0;
+int resize_height = 0;
+
+// Distributed: this process owns strip dist_rank of dist_ranks, headless
+int dist_rank = 0;
+int dist_ranks = 0;
+const char *dist_transport = "udp";
+int dist_done = 0;
+
+double now_seconds()
+{
+    mapper_timetag_t now;
+    mdev_now(dev, &now);
+    return now.sec + now.frac / 4294967296.0;
+}
+
+void latency_input(int id, double input_time)
+{
+    struct _latencyTrace *l = &latency[id];
+    l->arrival = now_seconds();
+    l->input_time = input_time ? input_time : l->arrival;
+    l->tick = -1;
+}
+
+// Everything that arrived before on_draw() was drawn in this tick.
+void latency_consumed()
+{
+    int i;
+    for (i=0; i < maxAgents; i++) {
+        if (latency[i].arrival && latency[i].tick < 0)
+            latency[i].tick = field_tick;
+    }
+}
+
+void latency_bin(unsigned int *bins, double seconds)
+{
+    bins[itime_bin(seconds, LATENCY_BINS)]++;
+}
+
+void latency_sent(double now)
+{
+    int i;
+    for (i=0; i < maxAgents; i++) {
+        struct _latencyTrace *l = &latency[i];
+        // inputs drawn in earlier ticks wait for the next observation sent
+        if (!l->arrival || l->tick < 0 || l->tick > field_tick)
+            continue;
+        double total = now - l->input_time;
+        latency_bin(l->server, now - l->arrival);
+        latency_bin(l->total, total);
+        latency_bin(latency_server, now - l->arrival);
+        latency_bin(latency_total, total);
+        if (total > l->max_total)
+            l->max_total = total;
+        l->arrival = 0;
+    }
+}
+
+// Upper bound in ms of the bin holding percentile p.
+double latency_percentile(unsigned int *bins, double p)
+{
+    unsigned int i, count = 0, n = 0;
+    for (i=0; i < LATENCY_BINS; i++)
+        n += bins[i];
+    for (i=0; i < LATENCY_BINS; i++) {
+        count += bins[i];
+        if (count > p * n)
+            return itime_bin_ms(i);
+    }
+    return 0;
+}
+
+void latency_print_bins(unsigned int *bins)
+{
+    int i;
+    for (i=0; i < LATENCY_BINS; i++) {
+        if (bins[i])
+            printf("    %8u - %8u us: %u\n", i ? 1 << i : 0, 1 << (i + 1),
+                   bins[i]);
+    }
+}
+
+void latency_dump()
+{
+    int i, j;
+    unsigned int n;
+    printf("Input -> observation latency, %dx%d, %d passes:\n",
+           field_width, field_height, number_of_passes);
+    printf("  server: p50 < %.3f ms, p99 < %.3f ms\n",
+           latency_percentile(latency_server, 0.5),
+           latency_percentile(latency_server, 0.99));
+    latency_print_bins(latency_server);
+    printf("  end to end: p50 < %.3f ms, p99 < %.3f ms\n",
+           latency_percentile(latency_total, 0.5),
+           latency_percentile(latency_total, 0.99));
+    latency_print_bins(latency_total);
+
+    for (i=0; i < maxAgents; i++) {
+        for (j=0, n=0; j < LATENCY_BINS; j++)
+            n += latency[i].total[j];
+        if (!n)
+            continue;
+        printf("  agent %d: %u observations, server p50 < %.3f ms, "
+               "end to end p50 < %.3f ms, p99 < %.3f ms, max %.3f ms\n", i, n,
+               latency_percentile(latency[i].server, 0.5),
+               latency_percentile(latency[i].total, 0.5),
+               latency_percentile(latency[i].total, 0.99),
+               latency[i].max_total * 1000);
+    }
+}
+
+void send_latency_stats(mapper_timetag_t tt)
+{
+    int i;
+    msig_update(siglat_server, latency_server, 1, tt);
+    msig_update(siglat_total, latency_total, 1, tt);
+    for (i=0; i < maxAgents; i++) {
+        // only agents with a libmapper instance
+        if (!agents[i].active || agents[i].restored || SHM_OWNED(i))
+            continue;
+        msig_update_instance(siglat_node, i, latency[i].total, 1, tt);
+    }
+}
+
+// Layer routing is not logged, so a released slot goes back to the
+// defaults rather than passing its layers on to the next agent.
+void reset_layers(struct _agent *a)
+{
+    int l;
+    a->layers = 1;
+    a->observe = 1;
+    for (l=0; l < maxLayers; l++)
+        a->layer_gain[l] = 1;
+}
+
+// Picks up positions written by local agents, and notices agents that
+// released their slot or died holding it.
+void shm_collect()
+{
+    int i;
+    float pos[2];
+    for (i=0; i < SHM_SLOTS; i++) {
+        struct _shmSlot *s = &shm_table->slots[i];
+        struct _agent *a = &agents[SHM_AGENT(i)];
+        int pid = __atomic_load_n(&s->claimed, __ATOMIC_ACQUIRE);
+
+        if (pid && field_tick % 100 == 0 && kill(pid, 0) && errno == ESRCH)
+            __atomic_compare_exchange_n(&s->claimed, &pid, 0, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        if (pid != shm_owner[i]) {
+            if (shm_owner[i] && a->active) {
+                a->active = 0;
+                reset_layers(a);
+                ilog_record(LOG_RELEASE, SHM_AGENT(i), 0, 0);
+            }
+            shm_owner[i] = pid;
+        }
+        if (!pid || !shmt_read_position(s, &shm_seen[i], pos))
+            continue;
+
+        if (!a->active) {
+            a->active = 1;
+            a->pos_time = 0;
+        }
+        a->restored = 0;
+        a->pos[0] = pos[0];
+        a->pos[1] = pos[1];
+        a->submitted = 1;
+        latency_input(SHM_AGENT(i), s->pos_time);
+        ilog_record(LOG_POS, SHM_AGENT(i), pos[0], pos[1]);
+    }
+}
+
+// Writes this tick's observations and wakes every waiting agent at once.
+void shm_publish()
+{
+    int i;
+    for (i=0; i < SHM_SLOTS; i++) {
+        if (shm_owner[i] && agents[SHM_AGENT(i)].active)
+            shmt_write_observation(&shm_table->slots[i], field_tick,
+                                   agents[SHM_AGENT(i)].obs);
+    }
+    shmt_wake(shm_table);
+}
+
+// Checkpoints: written every checkpoint_period seconds, on the 'c' key,
+// SIGUSR1 or /checkpoint, and restored at startup with -w.
+const char *checkpoint_file = 0;
+double checkpoint_period = 0;
+double next_checkpoint = 0;
+int checkpoint_requested = 0;
+int warm_restart = 0;
+
+// Restored agents keep drawing at their last position for this long
+// while waiting for their instance to come back.
+#define RESTORE_HOLD 10
+double restore_deadline = 0;
+
+// Time-to-steady-state (-W): the field's energy is sampled on the first
+// tick and every SETTLE_INTERVAL ticks after, until it changes by less
+// than SETTLE_TOLERANCE between samples.
+#define SETTLE_INTERVAL 10
+#define SETTLE_TOLERANCE 0.001
+#define SETTLE_TIMEOUT 120
+int settle_enabled = 0;
+float *settle_cells = 0;
+double settle_energy = 0;
+double settle_start = 0;
+int settle_ticks = 0;
+
+// Profiler: trace written on 'p' or /profile/dump, statistics published
+// once a second on /profile/cpu/<phase> and /profile/gpu/<phase>
+const char *profile_file = 0;
+int profile_requested = 0;
+mapper_signal sigprof[PROF_PHASES][2];
+double next_profile_stats = 0;
+
+double field_energy(const float *cells)
+{
+    double energy = 0;
+    int i, n = field_width * field_height * 4;
+    for (i=0; i < n; i += 4)
+        energy += fabs(cells[i]) + fabs(cells[i+1]);
+    return energy;
+}
+
+void check_settled()
+{
+    settle_ticks++;
+    if (settle_ticks > 1 && settle_ticks % SETTLE_INTERVAL)
+        return;
+
+    vfgl_ReadField(settle_cells);
+    double energy = field_energy(settle_cells);
+    double elapsed = itime_now() - settle_start;
+    // the first sample has nothing to compare with unless restored, and an
+    // empty field that stays empty is steady too
+    if ((settle_ticks > 1 || warm_restart)
+        && fabs(energy - settle_energy) <= energy * SETTLE_TOLERANCE)
+        printf("Field steady after %d ticks (%f s)\n", settle_ticks, elapsed);
+    else if (elapsed > SETTLE_TIMEOUT)
+        printf("Field not steady after %d ticks (%f s)\n", settle_ticks,
+               elapsed);
+    else {
+        settle_energy = energy;
+        return;
+    }
+    free(settle_cells);
+    settle_cells = 0;
+}
+
+void resize_field()
+{
+    double start = itime_now();
+    int width = resize_width, height = resize_height;
+    resize_width = resize_height = 0;
+    if (width == field_width && height == field_height)
+        return;
+
+    vfgl_ResizeField(width, height);
+
+    float fmx[2] = {field_width, field_height};
+    msig_set_maximum(sigpos, fmx);
+    if (settle_cells)
+        settle_cells = (float*)realloc(settle_cells, sizeof(float)
+                                       * field_width * field_height * 4);
+    if (export_name) {
+        // readers see the new size once they reopen the export
+        fexp_close();
+        fexp_open(export_name, field_width, field_height);
+    }
+    ilog_record(LOG_RESIZE, 0, field_width, field_height);
+
+    printf("Field resized to %dx%d in %f ms\n", field_width, field_height,
+           (itime_now() - start) * 1000);
+}
+
+void save_checkpoint()
+{
+    double start = itime_now();
+    struct _checkpointHeader *h = ckpt_create(checkpoint_file, field_width,
+                                              field_height, maxAgents,
+                                              sizeof(struct _agent));
+    if (!h)
+        return;
+
+    h->tick = field_tick;
+    h->passes = number_of_passes;
+    h->border_gain = borderGain;
+    h->convolution_gain = convolutionGain;
+    h->time = start;
+    memcpy(ckpt_agents(h), agents, sizeof(struct _agent) * maxAgents);
+    vfgl_ReadField(ckpt_field(h));
+
+    if (!ckpt_commit(h, checkpoint_file))
+        printf("Checkpoint of tick %d written in %f ms\n", field_tick,
+               (itime_now() - start) * 1000);
+}
+
+/* Loads the field, agent table and parameters saved by save_checkpoint().
+ * Agents that were active keep drawing at their last position until their
+ * instance comes back; libmapper instance state itself cannot be saved,
+ * so agents still reconnect to the new device as usual. */
+int restore_checkpoint()
+{
+    int i;
+    double start = itime_now();
+    struct _checkpointHeader *h = ckpt_open(checkpoint_file);
+    if (!h)
+        return 1;
+
+    if (h->width != field_width || h->height != field_height) {
+        // the field may have been resized since startup
+        resize_width = h->width;
+        resize_height = h->height;
+        resize_field();
+    }
+    vfgl_WriteField(ckpt_field(h));
+    if (settle_enabled)
+        settle_energy = field_energy(ckpt_field(h));
+    borderGain = h->border_gain;
+    convolutionGain = h->convolution_gain;
+    if (h->passes > 0)
+        number_of_passes = h->passes;
+    field_tick = h->tick + 1;
+
+    if (h->num_agents == maxAgents && h->agent_size == sizeof(struct _agent)) {
+        memcpy(agents, ckpt_agents(h), sizeof(struct _agent) * maxAgents);
+        for (i=0; i < maxAgents; i++) {
+            agents[i].submitted = 0;
+            agents[i].pos_time = 0;
+            agents[i].restored = agents[i].active;
+        }
+        restore_deadline = itime_now() + RESTORE_HOLD;
+    }
+    else
+        printf("Agent table in %s does not match, not restoring agents\n",
+               checkpoint_file);
+
+    printf("Restored tick %d from %s in %f ms\n", h->tick, checkpoint_file,
+           (itime_now() - start) * 1000);
+    ckpt_close(h);
+    return 0;
+}
+
+// Drops restored agents whose instance did not come back in time.
+void expire_restored()
+{
+    int i;
+    for (i=0; i < maxAgents; i++) {
+        if (agents[i].restored) {
+            agents[i].restored = 0;
+            agents[i].active = 0;
+            reset_layers(&agents[i]);
+            ilog_record(LOG_RELEASE, i, 0, 0);
+        }
+    }
+    restore_deadline = 0;
+}
+
+void on_signal_checkpoint(mapper_signal msig,
+                          mapper_db_signal props,
+                          int instance_id,
+                          void *value,
+                          int count,
+                          mapper_timetag_t *timetag)
+{
+    if (value && *(int*)value)
+        checkpoint_requested = 1;
+}
+
+void on_signal_profile_dump(mapper_signal msig,
+                            mapper_db_signal props,
+                            int instance_id,
+                            void *value,
+                            int count,
+                            mapper_timetag_t *timetag)
+{
+    if (value && *(int*)value)
+        profile_requested = 1;
+}
+
+// Queues each phase's [mean, p50, p99] in ms.
+void send_profile_stats(mapper_timetag_t tt)
+{
+    int i, gpu;
+    float stats[3];
+    for (i=0; i < PROF_PHASES; i++) {
+        for (gpu=0; gpu < 2; gpu++) {
+            if (sigprof[i][gpu] && prof_stats(i, gpu, stats))
+                msig_update(sigprof[i][gpu], stats, 1, tt);
+        }
+    }
+}
+
+void on_signal_latency_dump(mapper_signal msig,
+                            mapper_db_signal props,
+                            int instance_id,
+                            void *value,
+                            int count,
+                            mapper_timetag_t *timetag)
+{
+    if (value && *(int*)value)
+        latency_requested = 1;
+}
+
+void send_adapt_stats(mapper_timetag_t tt)
+{
+    float cost = adapt_cost * 1000;
+    msig_update(sigadapt_cost, &cost, 1, tt);
+    msig_update(sigadapt_passes, &number_of_passes, 1, tt);
+    msig_update(sigadapt_decimation, &obs_decimation, 1, tt);
+    msig_update(sigadapt_skip, &display_skip, 1, tt);
+}
+
+void adapt_shed()
+{
+    if (number_of_passes > 1)
+        number_of_passes--;
+    // lockstep agents wait for every observation
+    else if (!lockstep && obs_decimation < ADAPT_MAX_DECIMATION)
+        obs_decimation *= 2;
+    else if (display_skip < ADAPT_MAX_SKIP)
+        display_skip *= 2;
+    else
+        return;
+    printf("Frame %.3f ms over budget: %d passes, observations every %d, "
+           "display every %d\n", adapt_cost * 1000, number_of_passes,
+           obs_decimation, display_skip);
+    adapt_hold = ADAPT_HOLD;
+}
+
+void adapt_grow()
+{
+    if (display_skip > 1)
+        display_skip /= 2;
+    else if (obs_decimation > 1)
+        obs_decimation /= 2;
+    // only add a pass if the frame would still fit
+    else if (number_of_passes < adapt_max_passes
+             && adapt_cost * (number_of_passes + 1) / number_of_passes
+                < adapt_budget * ADAPT_HIGH * 0.9)
+        number_of_passes++;
+    else
+        return;
+    printf("Frame %.3f ms under budget: %d passes, observations every %d, "
+           "display every %d\n", adapt_cost * 1000, number_of_passes,
+           obs_decimation, display_skip);
+    adapt_hold = ADAPT_HOLD;
+}
+
+void adapt(mapper_timetag_t tt)
+{
+    // With vsync the swap blocks until the next refresh, which would read
+    // as overload however little the frame did
+    double cost = prof_now() - vfgl_frame_start - vfgl_swap_time;
+    adapt_cost = adapt_cost ? adapt_cost + (cost - adapt_cost) * ADAPT_SMOOTHING
+                            : cost;
+    if (adapt_hold && --adapt_hold)
+        return;
+
+    int passes = number_of_passes, skip = display_skip;
+    int decimation = obs_decimation;
+    if (adapt_cost > adapt_budget * ADAPT_HIGH)
+        adapt_shed();
+    else if (adapt_cost < adapt_budget * ADAPT_LOW
+             || (display_skip == 1 && obs_decimation == 1))
+        adapt_grow();
+
+    if (passes != number_of_passes)
+        ilog_record(LOG_PASSES, 0, number_of_passes, 0);
+    if (passes != number_of_passes || skip != display_skip
+        || decimation != obs_decimation) {
+        // restart smoothing from the new cost level
+        adapt_cost = 0;
+        send_adapt_stats(tt);
+    }
+}
+
+void on_signal_field_size(mapper_signal msig,
+                          mapper_db_signal props,
+                          int instance_id,
+                          void *value,
+                          int count,
+                          mapper_timetag_t *timetag)
+{
+    if (!value)
+        return;
+    int *size = (int*)value;
+    if (size[0] < 16 || size[1] < 16 || size[0] > 4096 || size[1] > 4096) {
+        printf("Ignoring field size %dx%d\n", size[0], size[1]);
+        return;
+    }
+    resize_width = size[0];
+    resize_height = size[1];
+}
+
+void on_signal_field_passes(mapper_signal msig,
+                            mapper_db_signal props,
+                            int instance_id,
+                            void *value,
+                            int count,
+                            mapper_timetag_t *timetag)
+{
+    if (!value)
+        return;
+    int passes = *(int*)value;
+    if (passes < 1 || passes > 64) {
+        printf("Ignoring %d passes per frame\n", passes);
+        return;
+    }
+    if (adapt_budget)
+        printf("Passes set to %d, adapting from there\n", passes);
+    number_of_passes = passes;
+    ilog_record(LOG_PASSES, 0, number_of_passes, 0);
+}
+
+void on_sigusr1(int sig)
+{
+    checkpoint_requested = 1;
+}
 
 void on_draw()
 {
+    // everything logged before this was drawn in the tick just rendered
+    ilog_tick();
+
+    latency_consumed();
+
+    prof_begin(PROF_POLL);
     while (mdev_poll(dev, 0)) {}
+    prof_end(PROF_POLL);
 
     int i;
+    prof_begin(PROF_SEND);
     mdev_now(dev, &tt);
     mdev_start_queue(dev, tt);
     for (i=0; i < maxAgents; i++)
     {
-        if (agents[i].active) {
+        // shared-memory agents get theirs from shm_publish()
+        if (agents[i].active && !SHM_OWNED(i)
+            && field_tick % obs_decimation == 0) {
             msig_update_instance(sigobs_2d, i, agents[i].obs, 1, tt);
             msig_update_instance(sigobs_1d, i, &agents[i].obs[2], 1, tt);
+            msig_update_instance(sigobs_tick, i, &field_tick, 1, tt);
         }
     }
+    if (prof_enabled && itime_now() >= next_profile_stats) {
+        send_profile_stats(tt);
+        next_profile_stats = itime_now() + 1;
+    }
+    if (itime_now() >= next_latency_stats) {
+        send_latency_stats(tt);
+        if (adapt_budget)
+            send_adapt_stats(tt);
+        next_latency_stats = itime_now() + 1;
+    }
     mdev_send_queue(dev, tt);
+
+    if (shm_table)
+        shm_publish();
+    if (field_tick % obs_decimation == 0)
+        latency_sent(now_seconds());
+    if (shm_table)
+        shm_collect();
+    prof_end(PROF_SEND);
+
+    if (latency_requested) {
+        latency_dump();
+        latency_requested = 0;
+    }
+
+    if (profile_requested) {
+        prof_print();
+        prof_write_trace(profile_file);
+        profile_requested = 0;
+    }
+
+    if (settle_cells)
+        check_settled();
+
+    if (adapt_budget) {
+        mdev_now(dev, &tt);
+        mdev_start_queue(dev, tt);
+        adapt(tt);
+        mdev_send_queue(dev, tt);
+    }
+
+    if (checkpoint_file) {
+        double now = itime_now();
+        if (checkpoint_period && now >= next_checkpoint) {
+            checkpoint_requested = 1;
+            next_checkpoint = now + checkpoint_period;
+        }
+        if (checkpoint_requested) {
+            save_checkpoint();
+            checkpoint_requested = 0;
+        }
+        if (restore_deadline && now > restore_deadline)
+            expire_restored();
+    }
+    field_tick++;
+
+    if (resize_width)
+        resize_field();
+}
+
+int on_ready()
+{
+    int i, active, waiting;
+    double now = now_seconds(), polled = now;
+    double deadline = tick_start + lockstep_deadline / 1000.0;
+
+    // Return to GLUT every few ms so the window stays responsive
+    while (1) {
+        if (shm_table)
+            shm_collect();
+        active = waiting = 0;
+        for (i=0; i < maxAgents; i++) {
+            if (!agents[i].active)
+                continue;
+            active++;
+            if (!agents[i].submitted)
+                waiting++;
+        }
+        if (now >= deadline)
+            break;
+        // with no agents, tick at the deadline rather than spinning
+        if (active && !waiting)
+            break;
+        if (now - polled > 0.005)
+            return 0;
+        mdev_poll(dev, 1);
+        now = now_seconds();
+    }
+
+    for (i=0; i < maxAgents; i++)
+        agents[i].submitted = 0;
+    tick_start = now;
+    return 1;
 }
 
 void on_signal_border_gain(mapper_signal msig,
@@ -45,6 +755,7 @@ void on_signal_border_gain(mapper_signal msig,
 
     float *gain = (float*)value;
     borderGain = *gain;
+    ilog_record(LOG_BORDER_GAIN, 0, *gain, 0);
 }
 
 void on_signal_pos(mapper_signal msig,
@@ -54,22 +765,47 @@ void on_signal_pos(mapper_signal msig,
                    int count,
                    mapper_timetag_t *timetag)
 {
+    // ids of shared-memory slots are never reserved for libmapper
+    if (SHM_OWNED(instance_id)) {
+        printf("Ignoring libmapper instance %d, owned by shared memory\n",
+               instance_id);
+        return;
+    }
     if (value) {
-        if (!agents[instance_id].active) {
+        if (!agents[instance_id].active || agents[instance_id].restored) {
             // need to init new instance
             msig_match_instances(msig, sigobs_1d, instance_id);
             msig_match_instances(msig, sigobs_2d, instance_id);
+            msig_match_instances(msig, sigobs_tick, instance_id);
+            msig_match_instances(msig, siglat_node, instance_id);
             agents[instance_id].active = 1;
+            agents[instance_id].restored = 0;
+            agents[instance_id].pos_time = 0;
         }
-        float *pos = (float*)value;
+        // x and y always travel together; keep only the newest vector so
+        // a reordered packet cannot move the agent back in time.
+        double t = timetag ? timetag->sec + timetag->frac / 4294967296.0 : 0;
+        if (t && t < agents[instance_id].pos_time)
+            return;
+        float *pos = (float*)value + (count > 1 ? (count - 1) * 2 : 0);
         agents[instance_id].pos[0] = pos[0];
         agents[instance_id].pos[1] = pos[1];
+        agents[instance_id].pos_time = t;
+        agents[instance_id].submitted = 1;
+        latency_input(instance_id, t);
+        ilog_record(LOG_POS, instance_id, pos[0], pos[1]);
     }
     else {
         agents[instance_id].active = 0;
+        agents[instance_id].restored = 0;
+        reset_layers(&agents[instance_id]);
+        ilog_record(LOG_RELEASE, instance_id, 0, 0);
         msig_release_instance(sigpos, instance_id, MAPPER_NOW);
         msig_release_instance(sigobs_1d, instance_id, MAPPER_NOW);
         msig_release_instance(sigobs_2d, instance_id, MAPPER_NOW);
+        msig_release_instance(sigobs_tick, instance_id, MAPPER_NOW);
+        msig_release_instance(siglat_node, instance_id, MAPPER_NOW);
+        latency[instance_id].arrival = 0;
     }
 }
 
@@ -80,10 +816,11 @@ void on_signal_gain(mapper_signal msig,
                     int count,
                     mapper_timetag_t *timetag)
 {
-    if (!value)
+    if (!value || SHM_OWNED(instance_id))
         return;
     float *gain = (float*)value;
     agents[instance_id].gain = *gain;
+    ilog_record(LOG_GAIN, instance_id, *gain, 0);
 }
 
 void on_signal_spin(mapper_signal msig,
@@ -93,10 +830,11 @@ void on_signal_spin(mapper_signal msig,
                     int count,
                     mapper_timetag_t *timetag)
 {
-    if (!value)
+    if (!value || SHM_OWNED(instance_id))
         return;
     float *spin = (float*)value;
     agents[instance_id].spin = *spin;
+    ilog_record(LOG_SPIN, instance_id, *spin, 0);
 }
 
 void on_signal_fade(mapper_signal msig,
@@ -106,10 +844,11 @@ void on_signal_fade(mapper_signal msig,
                     int count,
                     mapper_timetag_t *timetag)
 {
-    if (!value)
+    if (!value || SHM_OWNED(instance_id))
         return;
     float *fade = (float*)value;
     agents[instance_id].fade = *fade;
+    ilog_record(LOG_FADE, instance_id, *fade, 0);
 }
 
 void on_signal_dir(mapper_signal msig,
@@ -119,11 +858,12 @@ void on_signal_dir(mapper_signal msig,
                    int count,
                    mapper_timetag_t *timetag)
 {
-    if (!value)
+    if (!value || SHM_OWNED(instance_id))
         return;
     float *dir = (float*)value;
     agents[instance_id].dir[0] = cos(*dir);
     agents[instance_id].dir[1] = sin(*dir);
+    ilog_record(LOG_DIR, instance_id, *dir, 0);
 }
 
 void on_signal_flow(mapper_signal msig,
@@ -133,10 +873,52 @@ void on_signal_flow(mapper_signal msig,
                     int count,
                     mapper_timetag_t *timetag)
 {
-    if (!value)
+    if (!value || SHM_OWNED(instance_id))
         return;
     float *flow = (float*)value;
     agents[instance_id].flow = *flow;
+    ilog_record(LOG_FLOW, instance_id, *flow, 0);
+}
+
+void on_signal_layers(mapper_signal msig,
+                      mapper_db_signal props,
+                      int instance_id,
+                      void *value,
+                      int count,
+                      mapper_timetag_t *timetag)
+{
+    if (!value || SHM_OWNED(instance_id))
+        return;
+    int *layers = (int*)value;
+    agents[instance_id].layers = *layers & ((1 << num_layers) - 1);
+}
+
+void on_signal_observe(mapper_signal msig,
+                       mapper_db_signal props,
+                       int instance_id,
+                       void *value,
+                       int count,
+                       mapper_timetag_t *timetag)
+{
+    if (!value || SHM_OWNED(instance_id))
+        return;
+    int *observe = (int*)value;
+    agents[instance_id].observe = *observe & ((1 << num_layers) - 1);
+}
+
+void on_signal_layer_gain(mapper_signal msig,
+                          mapper_db_signal props,
+                          int instance_id,
+                          void *value,
+                          int count,
+                          mapper_timetag_t *timetag)
+{
+    if (!value || SHM_OWNED(instance_id))
+        return;
+    float *gain = (float*)value;
+    int i;
+    for (i=0; i < num_layers; i++)
+        agents[instance_id].layer_gain[i] = gain[i];
 }
 
 void on_instance_event(mapper_signal msig,
@@ -146,11 +928,16 @@ void on_instance_event(mapper_signal msig,
                        mapper_timetag_t *timetag)
 {
     printf("Downstream instance release!\n");
-    if (event == IN_DOWNSTREAM_RELEASE) {
+    if (event == IN_DOWNSTREAM_RELEASE && !SHM_OWNED(instance_id)) {
         agents[instance_id].active = 0;
+        reset_layers(&agents[instance_id]);
+        ilog_record(LOG_RELEASE, instance_id, 0, 0);
         msig_release_instance(sigpos, instance_id, MAPPER_NOW);
         msig_release_instance(sigobs_1d, instance_id, MAPPER_NOW);
         msig_release_instance(sigobs_2d, instance_id, MAPPER_NOW);
+        msig_release_instance(sigobs_tick, instance_id, MAPPER_NOW);
+        msig_release_instance(siglat_node, instance_id, MAPPER_NOW);
+        latency[instance_id].arrival = 0;
     }
 }
 
@@ -167,73 +954,191 @@ void initMapper()
     mdev_add_input(dev, "/border_gain", 1, 'f', 0, &fmn,
                    &fmx, on_signal_border_gain, 0);
 
+    int imn = 0, imx = 1;
+    mdev_add_input(dev, "/latency/dump", 1, 'i', 0, &imn, &imx,
+                   on_signal_latency_dump, 0);
+
+    // a strip can neither checkpoint nor change shape on its own
+    if (!dist_ranks) {
+        mdev_add_input(dev, "/checkpoint", 1, 'i', 0, &imn, &imx,
+                       on_signal_checkpoint, 0);
+
+        int size_mn[2] = {16, 16}, size_mx[2] = {4096, 4096};
+        mdev_add_input(dev, "/field/size", 2, 'i', 0, size_mn, size_mx,
+                       on_signal_field_size, 0);
+        int passes_mn = 1, passes_mx = 64;
+        mdev_add_input(dev, "/field/passes", 1, 'i', 0, &passes_mn,
+                       &passes_mx, on_signal_field_passes, 0);
+    }
+    siglat_server = mdev_add_output(dev, "/latency/server", LATENCY_BINS,
+                                    'i', 0, 0, 0);
+    siglat_total = mdev_add_output(dev, "/latency/total", LATENCY_BINS,
+                                   'i', 0, 0, 0);
+
+    if (adapt_budget) {
+        sigadapt_cost = mdev_add_output(dev, "/adapt/frame", 1, 'f', "ms",
+                                        0, 0);
+        sigadapt_passes = mdev_add_output(dev, "/adapt/passes", 1, 'i', 0,
+                                          0, 0);
+        sigadapt_decimation = mdev_add_output(dev, "/adapt/decimation", 1,
+                                              'i', 0, 0, 0);
+        sigadapt_skip = mdev_add_output(dev, "/adapt/display_skip", 1, 'i',
+                                        0, 0, 0);
+    }
+
+    if (prof_enabled) {
+        char name[256];
+        int i, gpu;
+        mdev_add_input(dev, "/profile/dump", 1, 'i', 0, &imn, &imx,
+                       on_signal_profile_dump, 0);
+        for (i=0; i < PROF_PHASES; i++) {
+            for (gpu=0; gpu < 2; gpu++) {
+                // on_draw() phases run on the CPU only
+                if (gpu && (i == PROF_FRAME || i >= PROF_SWAP))
+                    continue;
+                sprintf(name, "/profile/%s/%s", gpu ? "gpu" : "cpu",
+                        prof_phase_names[i]);
+                sigprof[i][gpu] = mdev_add_output(dev, name, 3, 'f', "ms",
+                                                  0, 0);
+            }
+        }
+    }
+
     fmn = -1.0;
     fmx = 1.0;
     sigobs_1d = mdev_add_output(dev, "/node/observation/1d",
                                 1 , 'f', 0, &fmn, &fmx);
     msig_release_instance(sigobs_1d, 0, MAPPER_NOW);
-    msig_reserve_instances(sigobs_1d, maxAgents-1, 0, 0);
+    msig_reserve_instances(sigobs_1d, MAPPER_AGENTS-1, 0, 0);
     msig_set_instance_event_callback(sigobs_1d, on_instance_event,
                                      IN_DOWNSTREAM_RELEASE, 0);
     sigobs_2d = mdev_add_output(dev, "/node/observation",
                                 2 , 'f', 0, &fmn, &fmx);
     msig_release_instance(sigobs_2d, 0, MAPPER_NOW);
-    msig_reserve_instances(sigobs_2d, maxAgents-1, 0, 0);
+    msig_reserve_instances(sigobs_2d, MAPPER_AGENTS-1, 0, 0);
     msig_set_instance_event_callback(sigobs_2d, on_instance_event,
                                      IN_DOWNSTREAM_RELEASE, 0);
+    sigobs_tick = mdev_add_output(dev, "/node/observation/tick",
+                                  1, 'i', 0, 0, 0);
+    msig_release_instance(sigobs_tick, 0, MAPPER_NOW);
+    msig_reserve_instances(sigobs_tick, MAPPER_AGENTS-1, 0, 0);
+    siglat_node = mdev_add_output(dev, "/node/latency", LATENCY_BINS,
+                                  'i', 0, 0, 0);
+    msig_release_instance(siglat_node, 0, MAPPER_NOW);
+    msig_reserve_instances(siglat_node, MAPPER_AGENTS-1, 0, 0);
 
     fmn = 0.0;
     fmx = (float)field_width;
     sigpos = mdev_add_input(dev, "/node/position", 2, 'f', 0, &fmn,
                             &fmx, on_signal_pos, 0);
     msig_release_instance(sigpos, 0, MAPPER_NOW);
-    msig_reserve_instances(sigpos, maxAgents-1, 0, 0);
+    msig_reserve_instances(sigpos, MAPPER_AGENTS-1, 0, 0);
 
     fmn = 0.0;
     fmx = 0.9;
     input = mdev_add_input(dev, "/node/fade", 1, 'f', 0, &fmn,
                            &fmx, on_signal_fade, 0);
     msig_release_instance(input, 0, MAPPER_NOW);
-    msig_reserve_instances(input, maxAgents-1, 0, 0);
+    msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
 
     fmn = -1.5;
     fmx = 1.5;
     input = mdev_add_input(dev, "/node/spin", 1, 'f', 0, &fmn,
                            &fmx, on_signal_spin, 0);
     msig_release_instance(input, 0, MAPPER_NOW);
-    msig_reserve_instances(input, maxAgents-1, 0, 0);
+    msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
 
     fmn = -3.1415926;
     fmx = 3.1415926;
     input = mdev_add_input(dev, "/node/direction", 1, 'f', 0, &fmn,
                            &fmx, on_signal_dir, 0);
     msig_release_instance(input, 0, MAPPER_NOW);
-    msig_reserve_instances(input, maxAgents-1, 0, 0);
+    msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
 
     fmn = -1.0;
     fmx = 1.0;
     input = mdev_add_input(dev, "/node/flow", 1, 'f', 0, &fmn,
                            &fmx, on_signal_flow, 0);
     msig_release_instance(input, 0, MAPPER_NOW);
-    msig_reserve_instances(input, maxAgents-1, 0, 0);
+    msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
+
+    if (num_layers > 1) {
+        // bit masks of the layers each agent draws into and observes
+        int lmn = 0, lmx = (1 << num_layers) - 1;
+        input = mdev_add_input(dev, "/node/layers", 1, 'i', 0, &lmn,
+                               &lmx, on_signal_layers, 0);
+        msig_release_instance(input, 0, MAPPER_NOW);
+        msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
+
+        input = mdev_add_input(dev, "/node/observe", 1, 'i', 0, &lmn,
+                               &lmx, on_signal_observe, 0);
+        msig_release_instance(input, 0, MAPPER_NOW);
+        msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
+
+        float gmn[maxLayers], gmx[maxLayers];
+        int i;
+        for (i=0; i < num_layers; i++) {
+            gmn[i] = -1.0;
+            gmx[i] = 1.0;
+        }
+        input = mdev_add_input(dev, "/node/layer_gain", num_layers, 'f', 0,
+                               gmn, gmx, on_signal_layer_gain, 0);
+        msig_release_instance(input, 0, MAPPER_NOW);
+        msig_reserve_instances(input, MAPPER_AGENTS-1, 0, 0);
+    }
 }
 
 void CmdLine(int argc, char **argv)
 {
     int c;
-    while ((c = getopt(argc, argv, "hfr:p:x:s:")) != -1)
+    while ((c = getopt(argc, argv, "hfr:p:x:s:l:R:P:oE:S:C:c:wWT:A:M:L:D:t:")) != -1)
     {
         switch (c)
         {
         case 'h': // Help
             printf("Usage: influence [-h] [-r <rate>] [-p <passes>] "
-                   "[-x <offset>] [-s <size>] [-f]\n");
+                   "[-x <offset>] [-s <size>] [-f] [-l <deadline>]\n"
+                   "                 [-R <log>] [-P <log> [-o]] [-E <name>]\n"
+                   "                 [-S <name>] [-C <file> [-c <period>] [-w]] [-W]\n"
+                   "                 [-T <trace>] [-A <budget> [-M <passes>]]\n"
+                   "                 [-L <layers>] "
+                   "[-D <rank>/<ranks> [-t <transport>]]\n");
             printf("  -h  Help\n");
             printf("  -r  Update rate, default=100\n");
             printf("  -p  Number of passes per frame, default=1\n");
             printf("  -x  \"X,Y\" offsets, glReadPixel work-around\n");
             printf("  -s  Field size in pixels, default = 500\n");
             printf("  -f  Begin in full-screen mode\n");
+            printf("  -l  Lockstep: tick once every agent has sent a "
+                   "position,\n      or after <deadline> ms\n");
+            printf("  -R  Record every input to <log>, single layer only\n");
+            printf("  -P  Replay <log> headless on the CPU engine, "
+                   "as fast as possible\n");
+            printf("  -o  Replay at the original pace\n");
+            printf("  -E  Export each field tick to shared memory <name>,"
+                   "\n      e.g. %s\n", EXPORT_DEFAULT_NAME);
+            printf("  -S  Serve local agents through shared memory <name>,"
+                   "\n      e.g. %s\n", SHM_DEFAULT_NAME);
+            printf("  -C  Checkpoint to <file> on 'c', SIGUSR1 or "
+                   "/checkpoint\n");
+            printf("  -c  Also checkpoint every <period> seconds\n");
+            printf("  -w  Warm restart from the checkpoint file\n");
+            printf("  -W  Report how long the field takes to become "
+                   "steady\n");
+            printf("  -T  Profile each frame phase, writing a Chrome trace "
+                   "to <trace>\n      on 'p' or /profile/dump\n");
+            printf("  -A  Adapt passes and shed load to hold <budget> ms "
+                   "per frame\n");
+            printf("  -M  Most passes per frame when adapting, default=%d\n",
+                   adapt_max_passes);
+            printf("  -L  Number of field layers, up to %d, default=1\n",
+                   maxLayers);
+            printf("  -D  Own strip <rank> of a field split across <ranks> "
+                   "processes,\n      headless on the CPU engine; not with "
+                   "-E, -S, -C, -w, -R, -L, -l,\n      -P, -A, -T or -W\n");
+            printf("  -t  Halo transport between processes on this machine:"
+                   "\n      udp[:<port>] over loopback or shm[:<name>], "
+                   "default=udp\n");
             exit(0);
         case 'r': // Rate
             update_rate = atoi(optarg);
@@ -253,6 +1158,67 @@ void CmdLine(int argc, char **argv)
         case 'f': // Full screen
             fullscreen = 1;
             break;
+        case 'l': // Lockstep
+            lockstep = 1;
+            lockstep_deadline = atoi(optarg);
+            break;
+        case 'R': // Record
+            record_file = optarg;
+            break;
+        case 'P': // Replay
+            replay_file = optarg;
+            break;
+        case 'o': // Original pace
+            replay_paced = 1;
+            break;
+        case 'E': // Export
+            export_name = optarg;
+            break;
+        case 'S': // Shared-memory agents
+            shm_name = optarg;
+            break;
+        case 'C': // Checkpoint file
+            checkpoint_file = optarg;
+            break;
+        case 'c': // Checkpoint period
+            checkpoint_period = atof(optarg);
+            break;
+        case 'w': // Warm restart
+            warm_restart = 1;
+            break;
+        case 'W': // Time to steady state
+            settle_enabled = 1;
+            break;
+        case 'T': // Profile
+            profile_file = optarg;
+            prof_enabled = 1;
+            break;
+        case 'A': // Adaptive budget
+            adapt_budget = atof(optarg) / 1000;
+            break;
+        case 'M': // Most passes
+            adapt_max_passes = atoi(optarg);
+            break;
+        case 'L': // Layers
+            num_layers = atoi(optarg);
+            if (num_layers < 1 || num_layers > maxLayers) {
+                printf("influence: -L takes 1 to %d layers.\n", maxLayers);
+                exit(1);
+            }
+            break;
+        case 'D': // Distributed
+            dist_rank = atoi(optarg);
+            dist_ranks = strchr(optarg, '/') ? atoi(strchr(optarg, '/') + 1)
+                                             : 0;
+            if (dist_ranks < 1 || dist_rank < 0 || dist_rank >= dist_ranks) {
+                printf("influence: -D takes <rank>/<ranks>, "
+                       "e.g. 0/4.\n");
+                exit(1);
+            }
+            break;
+        case 't': // Transport
+            dist_transport = optarg;
+            break;
         case '?': // Unknown
             printf("influence: Bad options, use -h for help.\n");
             exit(1);
@@ -261,6 +1227,23 @@ void CmdLine(int argc, char **argv)
             abort();
         }
     }
+    if (adapt_max_passes < number_of_passes)
+        adapt_max_passes = number_of_passes;
+    // the strip loop only runs the field and its agents
+    if (dist_ranks && (export_name || shm_name || checkpoint_file
+                       || warm_restart || record_file || num_layers > 1
+                       || lockstep || replay_file || adapt_budget
+                       || profile_file || settle_enabled)) {
+        printf("influence: -D cannot be combined with -E, -S, -C, -w, -R, "
+               "-L, -l, -P, -A, -T or -W.\n");
+        exit(1);
+    }
+    // the log has no events for layer routing, so a replay would differ
+    if (record_file && num_layers > 1) {
+        printf("influence: -R only records a single layer, not -L %d.\n",
+               num_layers);
+        exit(1);
+    }
 }
 
 void mapperLogout()
@@ -272,20 +1255,329 @@ void mapperLogout()
     for (i=0; i<maxAgents; i++) {
         msig_release_instance(sigobs_1d, i, tt);
         msig_release_instance(sigobs_2d, i, tt);
+        msig_release_instance(sigobs_tick, i, tt);
+        msig_release_instance(siglat_node, i, tt);
     }
     mdev_send_queue(dev, tt);
     mdev_poll(dev, 100);
     mdev_free(dev);
+    ilog_close();
+    fexp_close();
+    if (shm_table)
+        shmt_destroy(shm_table, shm_name);
+}
+
+// Mouse state as drawMouse() keeps it
+int replay_mouse[2] = {-1, -1};
+int replay_prev_mouse[2] = {-1, -1};
+float replay_delta_mouse[2] = {0, 0};
+
+void replay_event(struct _logEvent *e)
+{
+    struct _agent *a = &agents[e->instance % maxAgents];
+    switch (e->type) {
+    case LOG_POS:
+        a->active = 1;
+        a->pos[0] = e->value[0];
+        a->pos[1] = e->value[1];
+        break;
+    case LOG_RELEASE:
+        a->active = 0;
+        break;
+    case LOG_GAIN:
+        a->gain = e->value[0];
+        break;
+    case LOG_SPIN:
+        a->spin = e->value[0];
+        break;
+    case LOG_FADE:
+        a->fade = e->value[0];
+        break;
+    case LOG_DIR:
+        a->dir[0] = cos(e->value[0]);
+        a->dir[1] = sin(e->value[0]);
+        break;
+    case LOG_FLOW:
+        a->flow = e->value[0];
+        break;
+    case LOG_BORDER_GAIN:
+        borderGain = e->value[0];
+        break;
+    case LOG_MOUSE:
+        replay_mouse[0] = e->value[0];
+        replay_mouse[1] = e->value[1];
+        if (replay_mouse[0] < 0)
+            replay_delta_mouse[0] = replay_delta_mouse[1] = 0;
+        // button events restart the stroke
+        if (e->instance) {
+            replay_prev_mouse[0] = replay_mouse[0];
+            replay_prev_mouse[1] = replay_mouse[1];
+        }
+        break;
+    }
+}
+
+void replay_draw_mouse(struct _vfcpu_field *f)
+{
+    int *m = replay_mouse, *p = replay_prev_mouse;
+    if (p[0] < 0 || p[1] < 0)
+        return;
+
+    float c0[4] = {replay_delta_mouse[0], replay_delta_mouse[1], 0, 0.9};
+    if (p[0] == m[0] && p[1] == m[1])
+        vfcpu_draw_line(f, m[0], m[1], m[0], m[1], c0, c0);
+    else if (m[0] > -1 && m[1] > -1) {
+        float c1[4] = {m[0] - p[0], m[1] - p[1], 0, 0.9};
+        vfcpu_draw_line(f, p[0], p[1], m[0], m[1], c0, c1);
+    }
+    replay_delta_mouse[0] = m[0] - p[0];
+    replay_delta_mouse[1] = m[1] - p[1];
+    p[0] = m[0];
+    p[1] = m[1];
+}
+
+void replay_resize(struct _vfcpu_field *f, int width, int height)
+{
+    int i;
+    float sx = (float)width / f->width, sy = (float)height / f->height;
+    for (i=0; i < maxAgents; i++) {
+        agents[i].pos[0] *= sx;
+        agents[i].pos[1] *= sy;
+    }
+    replay_mouse[0] = replay_mouse[1] = -1;
+    replay_prev_mouse[0] = replay_prev_mouse[1] = -1;
+    vfcpu_resize(f, width, height);
+    if (export_name) {
+        fexp_close();
+        fexp_open(export_name, width, height);
+    }
+}
+
+/* Feeds a recorded log through the CPU engine.  Every run of the same
+ * log produces the same field, so the checksum printed at the end can be
+ * compared between builds. */
+int replay(const char *path)
+{
+    struct _logHeader h;
+    struct _logEvent e;
+    int i, pass, passes, ticks = 0;
+
+    if (ilog_open_read(path, &h))
+        return 1;
+    passes = h.passes;
+
+    vfgl_ResetAgents();
+    borderGain = 5;
+    replay_mouse[0] = replay_mouse[1] = -1;
+    replay_prev_mouse[0] = replay_prev_mouse[1] = -1;
+    replay_delta_mouse[0] = replay_delta_mouse[1] = 0;
+    struct _vfcpu_field *f = vfcpu_new(h.width, h.height);
+    if (export_name && fexp_open(export_name, h.width, h.height))
+        return 1;
+    double start = itime_now();
+
+    while (ilog_next(&e)) {
+        if (e.type == LOG_RESIZE) {
+            replay_resize(f, e.value[0], e.value[1]);
+            continue;
+        }
+        if (e.type == LOG_PASSES) {
+            passes = e.value[0];
+            continue;
+        }
+        if (e.type != LOG_TICK) {
+            replay_event(&e);
+            continue;
+        }
+
+        if (replay_paced) {
+            double wait = e.time - (itime_now() - start);
+            if (wait > 0)
+                usleep(wait * 1000000);
+        }
+
+        f->border_gain = borderGain;
+        for (pass = 0; pass < passes; pass++) {
+            vfcpu_begin_pass(f);
+            for (i = 0; i < maxAgents; i++) {
+                if (agents[i].active)
+                    vfcpu_draw_agent(f, agents[i].pos[0], agents[i].pos[1],
+                                     agents[i].gain, agents[i].fade,
+                                     agents[i].obs);
+            }
+            replay_draw_mouse(f);
+            vfcpu_convolve(f);
+        }
+        fexp_publish(ticks, f->cells[f->dest]);
+        ticks++;
+    }
+    ilog_close();
+    fexp_close();
+
+    // FNV-1a over the final field
+    unsigned int hash = 2166136261u;
+    unsigned char *bytes = (unsigned char*)f->cells[f->dest];
+    int n = f->width * f->height * 4 * sizeof(float);
+    for (i = 0; i < n; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+
+    double elapsed = itime_now() - start;
+    printf("Replayed %d ticks of %dx%d, %d passes in %f s (%f ticks/s)\n",
+           ticks, h.width, h.height, h.passes, elapsed, ticks / elapsed);
+    printf("Field checksum: %08x\n", hash);
+
+    vfcpu_free(f);
+    return 0;
+}
+
+void on_dist_signal(int sig)
+{
+    dist_done = 1;
+}
+
+/* Distributed mode: headless on the CPU engine, owning one strip of the
+ * field.  Agents are expected to send their positions to every rank;
+ * only the rank that owns an agent answers it, and when the agent
+ * crosses into another strip its instance is released here and taken up
+ * there. */
+int run_distributed()
+{
+    int i, owned[maxAgents], was_active[maxAgents], ticks = 0;
+    struct _distNode *node = dist_new(dist_rank, dist_ranks, field_width,
+                                      field_height, number_of_passes);
+    if (!node)
+        return 1;
+    node->transport = dist_transport_open(dist_transport, dist_rank,
+        dist_ranks, dist_message_size(field_width, number_of_passes));
+    if (!node->transport)
+        return 1;
+    printf("Rank %d of %d: rows %d to %d of %dx%d, %d passes over %s\n",
+           dist_rank, dist_ranks, node->row0, node->row0 + node->rows - 1,
+           field_width, field_height, number_of_passes, dist_transport);
+
+    signal(SIGINT, on_dist_signal);
+    signal(SIGTERM, on_dist_signal);
+    vfgl_ResetAgents();
+    borderGain = 5;
+    memset(owned, 0, sizeof(owned));
+    memset(was_active, 0, sizeof(was_active));
+    double next_tick = itime_now(), next_report = next_tick + 10;
+    double exchange = 0, compute = 0;
+    int migrations = 0;
+
+    while (!dist_done) {
+        while (mdev_poll(dev, 0)) {}
+        for (i=0; i < maxAgents; i++) {
+            struct _agent *a = &agents[i];
+            if (a->active && !was_active[i])
+                dist_add_agent(node, i, a->pos[0], a->pos[1], a->gain,
+                               a->fade);
+            else if (a->active)
+                dist_move_agent(node, i, a->pos[0], a->pos[1], a->gain,
+                                a->fade);
+            else if (was_active[i])
+                dist_release_agent(node, i);
+            was_active[i] = a->active;
+        }
+
+        node->field->border_gain = borderGain;
+        if (dist_step(node))
+            break;
+
+        mdev_now(dev, &tt);
+        mdev_start_queue(dev, tt);
+        for (i=0; i < maxAgents; i++) {
+            int own = node->agents[i].state == DIST_OWNED;
+            if (own && agents[i].active) {
+                memcpy(agents[i].obs, node->agents[i].obs,
+                       sizeof(agents[i].obs));
+                msig_update_instance(sigobs_2d, i, agents[i].obs, 1, tt);
+                msig_update_instance(sigobs_1d, i, &agents[i].obs[2], 1,
+                                     tt);
+                msig_update_instance(sigobs_tick, i, &field_tick, 1, tt);
+            }
+            else if (owned[i]) {
+                // handed off: the new owner answers from now on
+                msig_release_instance(sigobs_1d, i, tt);
+                msig_release_instance(sigobs_2d, i, tt);
+                msig_release_instance(sigobs_tick, i, tt);
+            }
+            owned[i] = own;
+        }
+        mdev_send_queue(dev, tt);
+        field_tick++;
+        ticks++;
+
+        double now = itime_now();
+        if (now >= next_report) {
+            printf("Rank %d: %.1f ticks/s, exchange %.3f ms, compute %.3f "
+                   "ms, %d agents in\n", dist_rank, ticks / 10.0,
+                   (node->exchange_time - exchange) / ticks * 1000,
+                   (node->compute_time - compute) / ticks * 1000,
+                   node->migrations - migrations);
+            exchange = node->exchange_time;
+            compute = node->compute_time;
+            migrations = node->migrations;
+            ticks = 0;
+            next_report += 10;
+        }
+
+        next_tick += 1.0 / update_rate;
+        double wait = next_tick - itime_now();
+        if (wait > 0)
+            mdev_poll(dev, (int)(wait * 1000));
+        else if (wait < -0.25)
+            next_tick = itime_now();
+    }
+
+    node->transport->close(node->transport);
+    dist_free(node);
+    return 0;
 }
 
 int main(int argc, char** argv)
 {
     CmdLine(argc, argv);
 
+    if (replay_file)
+        return replay(replay_file);
+
+    if (record_file && ilog_open_write(record_file, field_width,
+                                       field_height, number_of_passes))
+        return 1;
+
+    if (export_name && fexp_open(export_name, field_width, field_height))
+        return 1;
+
+    if (shm_name && !(shm_table = shmt_create(shm_name)))
+        return 1;
+
     initMapper();
 
+    if (dist_ranks)
+        return run_distributed();
+
+    if (warm_restart && !checkpoint_file) {
+        printf("influence: -w needs a checkpoint file, use -C.\n");
+        return 1;
+    }
+
     vfgl_Init(argc, argv);
+    settle_start = itime_now();
+    if (warm_restart && restore_checkpoint())
+        return 1;
+    if (settle_enabled)
+        settle_cells = (float*)malloc(sizeof(float) * field_width
+                                      * field_height * 4);
+    if (checkpoint_file) {
+        signal(SIGUSR1, on_sigusr1);
+        next_checkpoint = itime_now() + checkpoint_period;
+    }
     vfgl_DrawCallback = on_draw;
+    if (lockstep) {
+        tick_start = now_seconds();
+        vfgl_ReadyCallback = on_ready;
+    }
     vfgl_Run();
 
     return 0;
@@ -0,0 +1,124 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "influence_checkpoint.h"
+
+static char tmp_path[1024];
+
+struct _checkpointHeader *ckpt_create(const char *path, int width, int height,
+                                      int num_agents, int agent_size)
+{
+    unsigned int agents_offset = 4096;
+    unsigned int field_offset =
+        (agents_offset + num_agents * agent_size + 4095) & ~4095;
+    unsigned long size = field_offset
+                         + (unsigned long)width * height * 4 * sizeof(float);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Could not create checkpoint %s\n", tmp_path);
+        return 0;
+    }
+    if (ftruncate(fd, size)) {
+        printf("Could not size checkpoint %s\n", tmp_path);
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Could not map checkpoint %s\n", tmp_path);
+        return 0;
+    }
+
+    struct _checkpointHeader *h = (struct _checkpointHeader*)map;
+    memcpy(h->magic, CHECKPOINT_MAGIC, 8);
+    h->size = size;
+    h->width = width;
+    h->height = height;
+    h->num_agents = num_agents;
+    h->agent_size = agent_size;
+    h->agents_offset = agents_offset;
+    h->field_offset = field_offset;
+    return h;
+}
+
+int ckpt_commit(struct _checkpointHeader *h, const char *path)
+{
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    msync(h, h->size, MS_SYNC);
+    munmap(h, h->size);
+    if (rename(tmp_path, path)) {
+        printf("Could not move checkpoint into %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+struct _checkpointHeader *ckpt_open(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Could not open checkpoint %s\n", path);
+        return 0;
+    }
+    if (fstat(fd, &st) || st.st_size < sizeof(struct _checkpointHeader)) {
+        printf("Checkpoint %s is truncated\n", path);
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Could not map checkpoint %s\n", path);
+        return 0;
+    }
+
+    struct _checkpointHeader *h = (struct _checkpointHeader*)map;
+    if (memcmp(h->magic, CHECKPOINT_MAGIC, 8) || h->size != st.st_size) {
+        printf("%s is not a valid checkpoint\n", path);
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    // the agent table and the field must lie inside the file
+    unsigned long agents_size = 0, field_size = 0;
+    if (h->num_agents > 0 && h->agent_size > 0)
+        agents_size = (unsigned long)h->num_agents * h->agent_size;
+    if (h->width > 0 && h->height > 0)
+        field_size = (unsigned long)h->width * h->height * 4 * sizeof(float);
+    if (!field_size || h->num_agents < 0 || h->agent_size < 0
+        || h->agents_offset < sizeof(struct _checkpointHeader)
+        || h->field_offset < sizeof(struct _checkpointHeader)
+        || h->agents_offset > h->size || h->field_offset > h->size
+        || agents_size > h->size - h->agents_offset
+        || field_size > h->size - h->field_offset) {
+        printf("Checkpoint %s is truncated\n", path);
+        munmap(map, st.st_size);
+        return 0;
+    }
+    return h;
+}
+
+void ckpt_close(struct _checkpointHeader *h)
+{
+    if (h)
+        munmap(h, h->size);
+}
+
+void *ckpt_agents(struct _checkpointHeader *h)
+{
+    return (char*)h + h->agents_offset;
+}
+
+float *ckpt_field(struct _checkpointHeader *h)
+{
+    return (float*)((char*)h + h->field_offset);
+}
@@ -0,0 +1,41 @@
+
+#ifndef _INFLUENCE_CHECKPOINT_H_
+#define _INFLUENCE_CHECKPOINT_H_
+
+/* Checkpoint file: a header, the agent table and the field, laid out so
+ * the file can be mapped and the field handed straight to the engine.
+ * A checkpoint is written to a temporary file and renamed into place,
+ * so a crash while writing never leaves a torn checkpoint behind. */
+
+#define CHECKPOINT_MAGIC "INFLCKP1"
+
+struct _checkpointHeader
+{
+    char            magic[8];
+    unsigned long   size;           // of the whole file
+    int             width;
+    int             height;
+    int             tick;
+    int             passes;
+    float           border_gain;
+    float           convolution_gain;
+    double          time;
+    int             num_agents;
+    int             agent_size;     // sizeof(struct _agent) when written
+    unsigned int    agents_offset;
+    unsigned int    field_offset;   // RGBA floats, row 0 at the bottom
+};
+
+// Maps a new checkpoint for writing; fill it in, then ckpt_commit().
+struct _checkpointHeader *ckpt_create(const char *path, int width, int height,
+                                      int num_agents, int agent_size);
+int ckpt_commit(struct _checkpointHeader *h, const char *path);
+
+// Maps an existing checkpoint read-only.
+struct _checkpointHeader *ckpt_open(const char *path);
+void ckpt_close(struct _checkpointHeader *h);
+
+void *ckpt_agents(struct _checkpointHeader *h);
+float *ckpt_field(struct _checkpointHeader *h);
+
+#endif // _INFLUENCE_CHECKPOINT_H_
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "influence_cpu.h"
+
+// Shared with the GL engine, which uploads it as the "kernels" uniform
+const float vfcpu_kernel[] = {0.003,0.012,0.021,0.012,0.003,
+                              0.012,0.060,0.100,0.060,0.012,
+                              0.021,0.100,0.166,0.100,0.021,
+                              0.012,0.060,0.100,0.060,0.012,
+                              0.003,0.012,0.021,0.012,0.003};
+
+struct _vfcpu_field *vfcpu_new(int width, int height)
+{
+    struct _vfcpu_field *f =
+        (struct _vfcpu_field*)calloc(1, sizeof(struct _vfcpu_field));
+    f->width = width;
+    f->height = height;
+    f->cells[0] = (float*)calloc(width * height * 4, sizeof(float));
+    f->cells[1] = (float*)calloc(width * height * 4, sizeof(float));
+    f->src = 0;
+    f->dest = 1;
+    f->gain = 0.999;
+    f->border_gain = 5;
+    f->origin_y = 0;
+    f->full_height = height;
+    return f;
+}
+
+void vfcpu_free(struct _vfcpu_field *f)
+{
+    if (!f)
+        return;
+    free(f->cells[0]);
+    free(f->cells[1]);
+    free(f);
+}
+
+void vfcpu_clear(struct _vfcpu_field *f)
+{
+    memset(f->cells[0], 0, f->width * f->height * 4 * sizeof(float));
+    memset(f->cells[1], 0, f->width * f->height * 4 * sizeof(float));
+}
+
+float *vfcpu_cell(struct _vfcpu_field *f, int x, int y)
+{
+    return &f->cells[f->dest][(y * f->width + x) * 4];
+}
+
+static void set_cell(float *cells, int width, int x, int y,
+                     float r, float g, float b, float a)
+{
+    float *c = &cells[(y * width + x) * 4];
+    c[0] = r;
+    c[1] = g;
+    c[2] = b;
+    c[3] = a;
+}
+
+void vfcpu_begin_pass(struct _vfcpu_field *f)
+{
+    // Swap source and destination
+    f->src = 1 - f->src;
+    f->dest = 1 - f->dest;
+
+    // Border lines, as rasterized by drawBorder(), in rows of the full
+    // field clipped to this one
+    float bg = f->border_gain;
+    float *cells = f->cells[f->src];
+    int i, w = f->width, h = f->full_height, y0 = f->origin_y;
+    int lo = y0, hi = y0 + f->height;
+    if (!bg)
+        return;
+    for (i = 1 > lo ? 1 : lo; i < h - 1 && i < hi; i++)
+        set_cell(cells, w, 1, i - y0, bg, 0, 0, 0);
+    if (1 >= lo && 1 < hi)
+        for (i = 1; i < w - 1; i++)
+            set_cell(cells, w, i, 1 - y0, 0, bg, 0, 0);
+    for (i = 2 > lo ? 2 : lo; i < h && i < hi; i++)
+        set_cell(cells, w, w - 1, i - y0, -bg, 0, 0, 0);
+    if (h - 1 >= lo && h - 1 < hi)
+        for (i = 2; i < w; i++)
+            set_cell(cells, w, i, h - 1 - y0, 0, -bg, 0, 0);
+}
+
+void vfcpu_draw_agent(struct _vfcpu_field *f, float x, float y,
+                      float gain, float fade, float *obs)
+{
+    int ix = (int)x, iy = (int)y;
+    if (ix < 0 || iy < 0 || ix >= f->width || iy >= f->height)
+        return;
+
+    float *c = &f->cells[f->src][(iy * f->width + ix) * 4];
+    if (obs) {
+        obs[0] = c[0];
+        obs[1] = c[1];
+        obs[2] = sqrt(c[0] * c[0] + c[1] * c[1]);
+    }
+    c[2] += gain;
+    c[3] = fmax(c[3], fade);
+}
+
+// Gradient weight of each kernel column (or row), in float so the sums
+// stay in single precision like the shader's
+static const float gradient[5] = {1, 0.5, 0, -0.5, -1};
+
+/* Values this small are flushed to zero, as the GPU does with denormals.
+ * The front of the field spreading into empty cells would otherwise be
+ * all denormals, which are many times slower on the CPU. */
+#define TINY 1e-30f
+
+static float flush(float v)
+{
+    return fabsf(v) < TINY ? 0 : v;
+}
+
+static void convolve_edge_cell(const float *src, float *dest, int w, int h,
+                               int x, int y, float gain)
+{
+    float a[3] = {0, 0, 0};
+    int i, j, sx, sy;
+    for (j = 0; j < 5; j++) {
+        // texture lookups clamp to the edge
+        sy = y + j - 2;
+        sy = sy < 0 ? 0 : sy >= h ? h - 1 : sy;
+        for (i = 0; i < 5; i++) {
+            sx = x + i - 2;
+            sx = sx < 0 ? 0 : sx >= w ? w - 1 : sx;
+            const float *t = &src[(sy * w + sx) * 4];
+            float k = vfcpu_kernel[i + j * 5];
+            float tb = t[2] * k;
+            a[0] += t[0] * k + tb * gradient[i];
+            a[1] += t[1] * k + tb * gradient[j];
+            a[2] += tb;
+        }
+    }
+
+    // fade: the previous value is kept in proportion to its alpha
+    const float *b = &src[(y * w + x) * 4];
+    float *d = &dest[(y * w + x) * 4];
+    d[0] = flush(a[0] * gain + b[0] * b[3]);
+    d[1] = flush(a[1] * gain + b[1] * b[3]);
+    d[2] = flush(a[2] * gain + b[2] * b[3]);
+    d[3] = b[3] * b[3];
+}
+
+void vfcpu_convolve(struct _vfcpu_field *f)
+{
+    const float *src = f->cells[f->src];
+    float *dest = f->cells[f->dest];
+    int w = f->width, h = f->height;
+    float gain = f->gain;
+    int x, y, i, j;
+
+    for (y = 0; y < h; y++) {
+        if (y < 2 || y >= h - 2 || w < 5) {
+            for (x = 0; x < w; x++)
+                convolve_edge_cell(src, dest, w, h, x, y, gain);
+            continue;
+        }
+        convolve_edge_cell(src, dest, w, h, 0, y, gain);
+        convolve_edge_cell(src, dest, w, h, 1, y, gain);
+
+        /* The interior needs no clamping.  The kernel is symmetric and
+         * the gradient weights antisymmetric, so taps i and 4 - i of a
+         * row are summed together, and each pair is applied to the whole
+         * row at once so the loop over x vectorizes. */
+        int n = w - 4;
+        float a0[n], a1[n], a2[n];
+        for (x = 0; x < n; x++)
+            a0[x] = a1[x] = a2[x] = 0;
+        for (j = 0; j < 5; j++) {
+            const float *r = &src[(y + j - 2) * w * 4];
+            float gy = gradient[j];
+            for (i = 0; i < 2; i++) {
+                const float *tl = r + i * 4, *tr = r + (4 - i) * 4;
+                float k = vfcpu_kernel[i + j * 5], gx = gradient[i];
+                for (x = 0; x < n; x++) {
+                    float s2 = (tl[x * 4 + 2] + tr[x * 4 + 2]) * k;
+                    float d2 = (tl[x * 4 + 2] - tr[x * 4 + 2]) * k;
+                    a0[x] += (tl[x * 4] + tr[x * 4]) * k + d2 * gx;
+                    a1[x] += (tl[x * 4 + 1] + tr[x * 4 + 1]) * k + s2 * gy;
+                    a2[x] += s2;
+                }
+            }
+            const float *t = r + 2 * 4;
+            float k = vfcpu_kernel[2 + j * 5];
+            for (x = 0; x < n; x++) {
+                float tb = t[x * 4 + 2] * k;
+                a0[x] += t[x * 4] * k;
+                a1[x] += t[x * 4 + 1] * k + tb * gy;
+                a2[x] += tb;
+            }
+        }
+        const float *b = &src[(y * w + 2) * 4];
+        float *d = &dest[(y * w + 2) * 4];
+        for (x = 0; x < n; x++, b += 4, d += 4) {
+            d[0] = flush(a0[x] * gain + b[0] * b[3]);
+            d[1] = flush(a1[x] * gain + b[1] * b[3]);
+            d[2] = flush(a2[x] * gain + b[2] * b[3]);
+            d[3] = b[3] * b[3];
+        }
+
+        convolve_edge_cell(src, dest, w, h, w - 2, y, gain);
+        convolve_edge_cell(src, dest, w, h, w - 1, y, gain);
+    }
+}
+
+void vfcpu_draw_line(struct _vfcpu_field *f, int x0, int y0, int x1, int y1,
+                     const float *c0, const float *c1)
+{
+    int i, n = abs(x1 - x0) > abs(y1 - y0) ? abs(x1 - x0) : abs(y1 - y0);
+    for (i = 0; i <= n; i++) {
+        float t = n ? (float)i / n : 0;
+        int x = x0 + (int)floor((x1 - x0) * t + 0.5);
+        int y = y0 + (int)floor((y1 - y0) * t + 0.5);
+        if (x < 0 || y < 0 || x >= f->width || y >= f->height)
+            continue;
+        set_cell(f->cells[f->src], f->width, x, y,
+                 c0[0] + (c1[0] - c0[0]) * t, c0[1] + (c1[1] - c0[1]) * t,
+                 c0[2] + (c1[2] - c0[2]) * t, c0[3] + (c1[3] - c0[3]) * t);
+    }
+}
+
+void vfcpu_resample(const float *src, int src_width, int src_height,
+                    float *dest, int dest_width, int dest_height)
+{
+    int x, y, k;
+    float sx_scale = (float)src_width / dest_width;
+    float sy_scale = (float)src_height / dest_height;
+
+    for (y = 0; y < dest_height; y++) {
+        // sample at cell centres, clamped to the edge like the textures
+        float sy = (y + 0.5) * sy_scale - 0.5;
+        sy = sy < 0 ? 0 : sy > src_height - 1 ? src_height - 1 : sy;
+        int y0 = (int)sy, y1 = y0 < src_height - 1 ? y0 + 1 : y0;
+        float fy = sy - y0;
+        for (x = 0; x < dest_width; x++) {
+            float sx = (x + 0.5) * sx_scale - 0.5;
+            sx = sx < 0 ? 0 : sx > src_width - 1 ? src_width - 1 : sx;
+            int x0 = (int)sx, x1 = x0 < src_width - 1 ? x0 + 1 : x0;
+            float fx = sx - x0;
+
+            const float *c00 = &src[(y0 * src_width + x0) * 4];
+            const float *c10 = &src[(y0 * src_width + x1) * 4];
+            const float *c01 = &src[(y1 * src_width + x0) * 4];
+            const float *c11 = &src[(y1 * src_width + x1) * 4];
+            float *d = &dest[(y * dest_width + x) * 4];
+            for (k = 0; k < 4; k++)
+                d[k] = (c00[k] * (1 - fx) + c10[k] * fx) * (1 - fy)
+                       + (c01[k] * (1 - fx) + c11[k] * fx) * fy;
+        }
+    }
+}
+
+void vfcpu_resize(struct _vfcpu_field *f, int width, int height)
+{
+    float *cells = (float*)calloc(width * height * 4, sizeof(float));
+    vfcpu_resample(f->cells[f->dest], f->width, f->height,
+                   cells, width, height);
+
+    free(f->cells[0]);
+    free(f->cells[1]);
+    f->cells[f->dest] = cells;
+    f->cells[f->src] = (float*)calloc(width * height * 4, sizeof(float));
+    memcpy(f->cells[f->src], cells, width * height * 4 * sizeof(float));
+    f->width = width;
+    f->height = height;
+    f->full_height = height;
+}
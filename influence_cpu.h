@@ -0,0 +1,67 @@
+
+#ifndef _VFCPU_H_
+#define _VFCPU_H_
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* CPU implementation of the influence field.  It follows the GL engine
+ * in influence_opengl.c and FragmentShader.c: the same 5x5 kernel and
+ * gradient term, the same convolution gain, and agents written into the
+ * field as a point that adds their gain and holds their fade. */
+
+// Convolution kernel shared with the GL engine
+extern const float vfcpu_kernel[25];
+
+struct _vfcpu_field
+{
+    int     width;
+    int     height;
+    float  *cells[2];   // RGBA, row 0 at the bottom like the GL textures
+    int     src;
+    int     dest;
+    float   gain;       // convolution gain
+    float   border_gain;
+
+    // A strip of a larger field starts at row origin_y of a field
+    // full_height rows high, and only draws its part of the border.
+    int     origin_y;
+    int     full_height;
+};
+
+struct _vfcpu_field *vfcpu_new(int width, int height);
+void vfcpu_free(struct _vfcpu_field *f);
+void vfcpu_clear(struct _vfcpu_field *f);
+
+// RGBA cell of the current (most recently convolved) field
+float *vfcpu_cell(struct _vfcpu_field *f, int x, int y);
+
+/* One pass is vfcpu_begin_pass(), any number of vfcpu_draw_agent()
+ * calls, then vfcpu_convolve(), matching renderScene(). */
+void vfcpu_begin_pass(struct _vfcpu_field *f);
+
+// Reads the field under the agent into obs[3], then draws the agent.
+void vfcpu_draw_agent(struct _vfcpu_field *f, float x, float y,
+                      float gain, float fade, float *obs);
+
+void vfcpu_convolve(struct _vfcpu_field *f);
+
+/* Writes a line into the field, interpolating from colour c0 to c1 the
+ * way the GL engine draws the mouse. */
+void vfcpu_draw_line(struct _vfcpu_field *f, int x0, int y0, int x1, int y1,
+                     const float *c0, const float *c1);
+
+/* Bilinear resampling of an RGBA field to another resolution, keeping
+ * the shape of the field when it is resized at runtime. */
+void vfcpu_resample(const float *src, int src_width, int src_height,
+                    float *dest, int dest_width, int dest_height);
+
+// Resizes both buffers, resampling the current field into them.
+void vfcpu_resize(struct _vfcpu_field *f, int width, int height);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // _VFCPU_H_
@@ -0,0 +1,670 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "influence_dist.h"
+#include "influence_time.h"
+
+#define DIST_UDP_PORT 9400
+#define DIST_SHM_NAME "/influence.dist"
+#define DIST_DATAGRAM 16384
+#define DIST_STARTUP 30.0   // seconds to wait for the neighbours to start
+
+// Mailbox index of a neighbour: 0 below, 1 above.
+static int side(struct _distTransport *t, int peer)
+{
+    return peer > t->rank;
+}
+
+/* UDP */
+
+struct _udpHeader
+{
+    int     hello;      // 1 for the start-up handshake
+    int     from;
+    int     tick;
+    int     offset;
+    int     total;
+    int     heard;      // hello: the sender has heard from the receiver
+};
+
+struct _udpMessage
+{
+    int     tick;
+    int     received;
+    int     total;
+    char   *data;
+};
+
+struct _udpTransport
+{
+    struct _distTransport   t;
+    int                     sock;
+    struct sockaddr_in      peers[2];
+    int                     heard[2];
+    int                     acked[2];
+    struct _udpMessage      messages[2][2];    // by side and tick parity
+    char                    datagram[sizeof(struct _udpHeader)
+                                     + DIST_DATAGRAM];
+};
+
+static int udp_peer_exists(struct _udpTransport *u, int s)
+{
+    return s ? u->t.rank + 1 < u->t.ranks : u->t.rank > 0;
+}
+
+static void udp_hello(struct _udpTransport *u)
+{
+    struct _udpHeader h;
+    int s;
+    memset(&h, 0, sizeof(h));
+    h.hello = 1;
+    h.from = u->t.rank;
+    for (s=0; s < 2; s++) {
+        if (!udp_peer_exists(u, s))
+            continue;
+        h.heard = u->heard[s];
+        sendto(u->sock, &h, sizeof(h), 0,
+               (struct sockaddr*)&u->peers[s], sizeof(u->peers[s]));
+    }
+}
+
+// Receives one datagram, waiting up to timeout; returns 0 if none came.
+static int udp_receive(struct _udpTransport *u, double timeout)
+{
+    struct timeval tv;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(u->sock, &fds);
+    tv.tv_sec = (int)timeout;
+    tv.tv_usec = (timeout - tv.tv_sec) * 1000000;
+    if (select(u->sock + 1, &fds, 0, 0, &tv) <= 0)
+        return 0;
+
+    int length = recv(u->sock, u->datagram, sizeof(u->datagram), 0);
+    struct _udpHeader *h = (struct _udpHeader*)u->datagram;
+    if (length < (int)sizeof(*h) || h->from < 0 || h->from >= u->t.ranks
+        || abs(h->from - u->t.rank) != 1)
+        return 1;
+
+    int s = side(&u->t, h->from);
+    if (h->hello) {
+        u->heard[s] = 1;
+        u->acked[s] |= h->heard;
+        return 1;
+    }
+    // data means the neighbour is past its handshake
+    u->heard[s] = u->acked[s] = 1;
+
+    length -= sizeof(*h);
+    if (h->offset < 0 || h->total > u->t.max_message
+        || h->offset + length > h->total)
+        return 1;
+    struct _udpMessage *m = &u->messages[s][h->tick & 1];
+    if (m->tick != h->tick) {
+        m->tick = h->tick;
+        m->received = 0;
+        m->total = h->total;
+    }
+    memcpy(m->data + h->offset, h + 1, length);
+    m->received += length;
+    return 1;
+}
+
+static int udp_send(struct _distTransport *t, int peer, int tick,
+                    const void *data, int length)
+{
+    struct _udpTransport *u = (struct _udpTransport*)t;
+    struct _udpHeader *h = (struct _udpHeader*)u->datagram;
+    int offset = 0;
+
+    h->hello = 0;
+    h->from = t->rank;
+    h->tick = tick;
+    h->total = length;
+    h->heard = 1;
+    do {
+        int chunk = length - offset;
+        if (chunk > DIST_DATAGRAM)
+            chunk = DIST_DATAGRAM;
+        h->offset = offset;
+        memcpy(h + 1, (const char*)data + offset, chunk);
+        if (sendto(u->sock, u->datagram, sizeof(*h) + chunk, 0,
+                   (struct sockaddr*)&u->peers[side(t, peer)],
+                   sizeof(u->peers[0])) < 0) {
+            perror("sendto");
+            return 1;
+        }
+        offset += chunk;
+    } while (offset < length);
+    return 0;
+}
+
+static int udp_recv(struct _distTransport *t, int peer, int tick,
+                    void *data, double timeout)
+{
+    struct _udpTransport *u = (struct _udpTransport*)t;
+    struct _udpMessage *m = &u->messages[side(t, peer)][tick & 1];
+    double deadline = itime_now() + timeout;
+
+    while (m->tick != tick || m->received < m->total) {
+        double left = deadline - itime_now();
+        if (left <= 0)
+            return -1;
+        udp_receive(u, left);
+    }
+    memcpy(data, m->data, m->total);
+    m->tick = -1;
+    return m->total;
+}
+
+static void udp_close(struct _distTransport *t)
+{
+    struct _udpTransport *u = (struct _udpTransport*)t;
+    int i;
+    close(u->sock);
+    for (i=0; i < 4; i++)
+        free(u->messages[i / 2][i % 2].data);
+    free(u);
+}
+
+struct _distTransport *dist_udp_open(int rank, int ranks, int max_message,
+                                     int port)
+{
+    struct _udpTransport *u =
+        (struct _udpTransport*)calloc(1, sizeof(struct _udpTransport));
+    struct sockaddr_in addr;
+    int i, s, size = 4 << 20;
+
+    u->t.rank = rank;
+    u->t.ranks = ranks;
+    u->t.max_message = max_message;
+    u->t.send = udp_send;
+    u->t.recv = udp_recv;
+    u->t.close = udp_close;
+    for (i=0; i < 4; i++) {
+        u->messages[i / 2][i % 2].tick = -1;
+        u->messages[i / 2][i % 2].data = (char*)malloc(max_message);
+    }
+
+    u->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(u->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port + rank);
+    if (bind(u->sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        printf("Could not bind UDP port %d\n", port + rank);
+        udp_close(&u->t);
+        return 0;
+    }
+    for (s=0; s < 2; s++) {
+        int peer = rank + (s ? 1 : -1);
+        u->peers[s].sin_family = AF_INET;
+        u->peers[s].sin_port = htons(port + peer);
+        u->peers[s].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+
+    // hello until each neighbour has heard us, then once more so it
+    // knows we heard it
+    double deadline = itime_now() + DIST_STARTUP;
+    while (1) {
+        int ready = 1;
+        for (s=0; s < 2; s++)
+            if (udp_peer_exists(u, s) && !u->acked[s])
+                ready = 0;
+        if (ready)
+            break;
+        if (itime_now() > deadline) {
+            printf("Rank %d: neighbours did not start\n", rank);
+            udp_close(&u->t);
+            return 0;
+        }
+        udp_hello(u);
+        udp_receive(u, 0.05);
+    }
+    udp_hello(u);
+    return &u->t;
+}
+
+/* Shared memory */
+
+struct _shmSlot
+{
+    int     tick;       // written last, with release order
+    int     length;
+    char    pad[56];
+};
+
+struct _shmMailbox
+{
+    char    magic[8];
+    int     pid;
+    int     max_message;
+    char    pad[48];
+    // then slots by side and tick parity, each followed by max_message
+};
+
+#define SHM_DIST_MAGIC "INFLDST1"
+
+struct _shmTransport
+{
+    struct _distTransport   t;
+    char                    names[3][256];  // own, below, above
+    struct _shmMailbox     *boxes[3];
+    unsigned long           size;
+};
+
+static struct _shmSlot *shm_slot(struct _shmTransport *m,
+                                 struct _shmMailbox *box, int s, int tick)
+{
+    unsigned long stride = sizeof(struct _shmSlot) + m->t.max_message;
+    return (struct _shmSlot*)((char*)(box + 1)
+                              + (s * 2 + (tick & 1)) * stride);
+}
+
+static int shm_send(struct _distTransport *t, int peer, int tick,
+                    const void *data, int length)
+{
+    struct _shmTransport *m = (struct _shmTransport*)t;
+    // in the neighbour's mailbox we are on the other side
+    struct _shmSlot *slot = shm_slot(m, m->boxes[1 + side(t, peer)],
+                                     1 - side(t, peer), tick);
+    memcpy(slot + 1, data, length);
+    slot->length = length;
+    __atomic_store_n(&slot->tick, tick, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int shm_recv(struct _distTransport *t, int peer, int tick,
+                    void *data, double timeout)
+{
+    struct _shmTransport *m = (struct _shmTransport*)t;
+    struct _shmSlot *slot = shm_slot(m, m->boxes[0], side(t, peer), tick);
+    double deadline = 0;
+    int spins = 0;
+
+    while (__atomic_load_n(&slot->tick, __ATOMIC_ACQUIRE) != tick) {
+        if (++spins < 1000) {
+            sched_yield();
+            continue;
+        }
+        if (!deadline)
+            deadline = itime_now() + timeout;
+        else if (itime_now() > deadline)
+            return -1;
+        usleep(20);
+    }
+    memcpy(data, slot + 1, slot->length);
+    return slot->length;
+}
+
+static void shm_close(struct _distTransport *t)
+{
+    struct _shmTransport *m = (struct _shmTransport*)t;
+    int i;
+    for (i=0; i < 3; i++)
+        if (m->boxes[i])
+            munmap(m->boxes[i], m->size);
+    shm_unlink(m->names[0]);
+    free(m);
+}
+
+struct _distTransport *dist_shm_open(int rank, int ranks, int max_message,
+                                     const char *name)
+{
+    struct _shmTransport *m =
+        (struct _shmTransport*)calloc(1, sizeof(struct _shmTransport));
+    int i, s, fd;
+
+    m->t.rank = rank;
+    m->t.ranks = ranks;
+    m->t.max_message = max_message;
+    m->t.send = shm_send;
+    m->t.recv = shm_recv;
+    m->t.close = shm_close;
+    m->size = sizeof(struct _shmMailbox)
+              + 4 * (sizeof(struct _shmSlot) + max_message);
+    for (i=0; i < 3; i++)
+        snprintf(m->names[i], sizeof(m->names[i]), "%s.%d", name,
+                 rank + (i == 1 ? -1 : i == 2 ? 1 : 0));
+
+    // our own mailbox, replacing any left by an earlier run
+    shm_unlink(m->names[0]);
+    fd = shm_open(m->names[0], O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 || ftruncate(fd, m->size)) {
+        printf("Could not create shared memory %s\n", m->names[0]);
+        if (fd >= 0)
+            close(fd);
+        free(m);
+        return 0;
+    }
+    m->boxes[0] = (struct _shmMailbox*)mmap(0, m->size,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_SHARED, fd, 0);
+    close(fd);
+    for (i=0; i < 4; i++)
+        shm_slot(m, m->boxes[0], i / 2, i % 2)->tick = -1;
+    m->boxes[0]->max_message = max_message;
+    m->boxes[0]->pid = getpid();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(m->boxes[0]->magic, SHM_DIST_MAGIC, 8);
+
+    // the neighbours' mailboxes, once they are up
+    double deadline = itime_now() + DIST_STARTUP;
+    for (s=0; s < 2; s++) {
+        int peer = rank + (s ? 1 : -1);
+        if (peer < 0 || peer >= ranks)
+            continue;
+        while (1) {
+            struct _shmMailbox *box = 0;
+            fd = shm_open(m->names[1 + s], O_RDWR, 0666);
+            if (fd >= 0) {
+                struct stat st;
+                if (!fstat(fd, &st) && st.st_size == m->size)
+                    box = (struct _shmMailbox*)mmap(0, m->size,
+                                                    PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED, fd, 0);
+                close(fd);
+                if (box == MAP_FAILED)
+                    box = 0;
+            }
+            // skip a mailbox left behind by a process that has gone
+            if (box && !memcmp(box->magic, SHM_DIST_MAGIC, 8)
+                && box->max_message == max_message
+                && !kill(box->pid, 0)) {
+                m->boxes[1 + s] = box;
+                break;
+            }
+            if (box)
+                munmap(box, m->size);
+            if (itime_now() > deadline) {
+                printf("Rank %d: no mailbox %s\n", rank, m->names[1 + s]);
+                shm_close(&m->t);
+                return 0;
+            }
+            usleep(10000);
+        }
+    }
+    return &m->t;
+}
+
+struct _distTransport *dist_transport_open(const char *spec, int rank,
+                                           int ranks, int max_message)
+{
+    const char *arg = strchr(spec, ':');
+    arg = arg ? arg + 1 : 0;
+
+    if (!strncmp(spec, "shm", 3))
+        return dist_shm_open(rank, ranks, max_message,
+                             arg ? arg : DIST_SHM_NAME);
+    if (strncmp(spec, "udp", 3)) {
+        printf("Unknown transport `%s', use udp or shm\n", spec);
+        return 0;
+    }
+
+    int port = arg ? atoi(arg) : DIST_UDP_PORT;
+    return dist_udp_open(rank, ranks, max_message,
+                         port ? port : DIST_UDP_PORT);
+}
+
+/* Node */
+
+struct _distMessage
+{
+    int     tick;
+    int     num_agents;
+    int     rows;
+    int     first_row;
+};
+
+struct _distRecord
+{
+    int     id;
+    int     migrate;    // ownership passes to the receiver
+    float   pos[2];
+    float   gain;
+    float   fade;
+};
+
+int dist_message_size(int width, int passes)
+{
+    return sizeof(struct _distMessage)
+           + DIST_AGENTS * sizeof(struct _distRecord)
+           + 2 * passes * width * 4 * sizeof(float);
+}
+
+static int row_start(struct _distNode *n, int rank)
+{
+    return (int)((long)rank * n->height / n->ranks);
+}
+
+struct _distNode *dist_new(int rank, int ranks, int width, int height,
+                           int passes)
+{
+    struct _distNode *n =
+        (struct _distNode*)calloc(1, sizeof(struct _distNode));
+    n->rank = rank;
+    n->ranks = ranks;
+    n->width = width;
+    n->height = height;
+    n->passes = passes;
+    n->halo = 2 * passes;
+    n->row0 = row_start(n, rank);
+    n->rows = row_start(n, rank + 1) - n->row0;
+    if (ranks > 1 && height / ranks < n->halo) {
+        printf("%d strips of %d rows are thinner than the %d-row halo\n",
+               ranks, height / ranks, n->halo);
+        free(n);
+        return 0;
+    }
+
+    int ext0 = n->row0 - n->halo, ext1 = n->row0 + n->rows + n->halo;
+    ext0 = ext0 < 0 ? 0 : ext0;
+    ext1 = ext1 > height ? height : ext1;
+    n->field = vfcpu_new(width, ext1 - ext0);
+    n->field->origin_y = ext0;
+    n->field->full_height = height;
+    n->message = (char*)malloc(dist_message_size(width, passes));
+    return n;
+}
+
+void dist_free(struct _distNode *n)
+{
+    if (!n)
+        return;
+    vfcpu_free(n->field);
+    free(n->message);
+    free(n);
+}
+
+int dist_owner(struct _distNode *n, float y)
+{
+    int r, iy = (int)y;
+    for (r=0; r < n->ranks - 1; r++)
+        if (iy < row_start(n, r + 1))
+            break;
+    return r;
+}
+
+static void set_agent(struct _distAgent *a, float x, float y, float gain,
+                      float fade)
+{
+    a->pos[0] = x;
+    a->pos[1] = y;
+    a->gain = gain;
+    a->fade = fade;
+}
+
+void dist_add_agent(struct _distNode *n, int id, float x, float y,
+                    float gain, float fade)
+{
+    struct _distAgent *a = &n->agents[id];
+    if (a->state == DIST_NONE && dist_owner(n, y) == n->rank)
+        a->state = DIST_OWNED;
+    if (a->state == DIST_OWNED)
+        set_agent(a, x, y, gain, fade);
+}
+
+void dist_move_agent(struct _distNode *n, int id, float x, float y,
+                     float gain, float fade)
+{
+    if (n->agents[id].state == DIST_OWNED)
+        set_agent(&n->agents[id], x, y, gain, fade);
+}
+
+void dist_release_agent(struct _distNode *n, int id)
+{
+    if (n->agents[id].state == DIST_OWNED)
+        n->agents[id].state = DIST_NONE;
+}
+
+float *dist_cell(struct _distNode *n, int x, int y)
+{
+    return vfcpu_cell(n->field, x, y - n->field->origin_y);
+}
+
+// Rows y0..y0+count of the full field, in the current field.
+static float *rows_at(struct _distNode *n, int y0)
+{
+    return dist_cell(n, 0, y0);
+}
+
+static int build_message(struct _distNode *n, int peer, const int *to)
+{
+    struct _distMessage *m = (struct _distMessage*)n->message;
+    struct _distRecord *r = (struct _distRecord*)(m + 1);
+    int i, size = n->width * 4 * sizeof(float);
+    int lo = row_start(n, peer) - n->halo;
+    int hi = row_start(n, peer + 1) + n->halo;
+
+    m->tick = n->tick;
+    m->num_agents = 0;
+    for (i=0; i < DIST_AGENTS; i++) {
+        struct _distAgent *a = &n->agents[i];
+        int y = (int)a->pos[1];
+        if (to[i] == peer)
+            r->migrate = 1;
+        else if (a->state == DIST_OWNED && to[i] < 0 && y >= lo && y < hi)
+            r->migrate = 0;
+        else
+            continue;
+        r->id = i;
+        r->pos[0] = a->pos[0];
+        r->pos[1] = a->pos[1];
+        r->gain = a->gain;
+        r->fade = a->fade;
+        r++;
+        m->num_agents++;
+    }
+
+    // our edge rows become the neighbour's halo
+    m->rows = n->halo;
+    m->first_row = peer < n->rank ? n->row0 : n->row0 + n->rows - n->halo;
+    memcpy(r, rows_at(n, m->first_row), m->rows * size);
+    return (char*)r + m->rows * size - n->message;
+}
+
+static void apply_message(struct _distNode *n, int peer)
+{
+    struct _distMessage *m = (struct _distMessage*)n->message;
+    struct _distRecord *r = (struct _distRecord*)(m + 1);
+    int i;
+
+    for (i=0; i < m->num_agents; i++, r++) {
+        if (r->id < 0 || r->id >= DIST_AGENTS)
+            continue;
+        struct _distAgent *a = &n->agents[r->id];
+        if (r->migrate) {
+            a->state = DIST_OWNED;
+            n->migrations++;
+        }
+        else if (a->state == DIST_OWNED) {
+            // claimed on both sides of a boundary: the lower rank keeps it
+            if (n->rank < peer)
+                continue;
+            a->state = DIST_GHOST;
+        }
+        else
+            a->state = DIST_GHOST;
+        set_agent(a, r->pos[0], r->pos[1], r->gain, r->fade);
+    }
+    memcpy(rows_at(n, m->first_row), r,
+           m->rows * n->width * 4 * sizeof(float));
+}
+
+int dist_step(struct _distNode *n)
+{
+    int i, d, pass, to[DIST_AGENTS];
+    double t = itime_now();
+
+    // ghosts last only a tick; hand off agents that left the strip
+    for (i=0; i < DIST_AGENTS; i++) {
+        struct _distAgent *a = &n->agents[i];
+        to[i] = -1;
+        if (a->state == DIST_GHOST)
+            a->state = DIST_NONE;
+        if (a->state != DIST_OWNED)
+            continue;
+        int owner = dist_owner(n, a->pos[1]);
+        if (owner != n->rank) {
+            // a neighbour passes it on if it jumped further
+            to[i] = n->rank + (owner > n->rank ? 1 : -1);
+            a->state = DIST_GHOST;
+        }
+    }
+
+    for (d=-1; d <= 1; d += 2) {
+        int peer = n->rank + d;
+        if (peer < 0 || peer >= n->ranks)
+            continue;
+        int length = build_message(n, peer, to);
+        if (n->transport->send(n->transport, peer, n->tick, n->message,
+                               length))
+            return 1;
+        n->bytes_sent += length;
+    }
+    for (d=-1; d <= 1; d += 2) {
+        int peer = n->rank + d;
+        if (peer < 0 || peer >= n->ranks)
+            continue;
+        if (n->transport->recv(n->transport, peer, n->tick, n->message,
+                               n->tick ? DIST_TIMEOUT : DIST_STARTUP) < 0) {
+            printf("Rank %d: tick %d from rank %d timed out\n", n->rank,
+                   n->tick, peer);
+            return 1;
+        }
+        apply_message(n, peer);
+    }
+
+    double exchanged = itime_now();
+    n->exchange_time += exchanged - t;
+
+    int ext0 = n->field->origin_y, ext1 = ext0 + n->field->height;
+    for (pass=0; pass < n->passes; pass++) {
+        vfcpu_begin_pass(n->field);
+        for (i=0; i < DIST_AGENTS; i++) {
+            struct _distAgent *a = &n->agents[i];
+            int y = (int)a->pos[1];
+            if (a->state != DIST_NONE && y >= ext0 && y < ext1)
+                vfcpu_draw_agent(n->field, a->pos[0], a->pos[1] - ext0,
+                                 a->gain, a->fade, a->obs);
+        }
+        vfcpu_convolve(n->field);
+    }
+    n->compute_time += itime_now() - exchanged;
+    n->tick++;
+    return 0;
+}
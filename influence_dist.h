@@ -0,0 +1,123 @@
+
+#ifndef _INFLUENCE_DIST_H_
+#define _INFLUENCE_DIST_H_
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include "influence_cpu.h"
+
+/* A field split into horizontal strips, one per process.  Rank r owns a
+ * band of rows and keeps a copy of the halo rows above and below it,
+ * deep enough for every pass of a tick: the kernel reaches two rows,
+ * so halo = 2 * passes.  Once per tick each rank sends its edge rows to
+ * its neighbours, with the agents near the edge as ghosts; a halo row
+ * goes stale by two rows a pass, so after the tick's passes the owned
+ * rows are exactly what a single field would hold.
+ *
+ * Each agent is owned by the rank whose rows hold it, which draws it,
+ * observes it and passes it on when it crosses into another strip. */
+
+#define DIST_AGENTS 50
+#define DIST_TIMEOUT 1.0
+
+/* Moves one message per neighbour per tick.  The neighbour may already
+ * be sending tick+1 while this rank still waits for tick, so messages
+ * are kept apart by tick. */
+struct _distTransport
+{
+    int     rank;
+    int     ranks;
+    int     max_message;
+
+    int     (*send)(struct _distTransport *t, int peer, int tick,
+                    const void *data, int length);
+    // Returns the length received, or -1 after timeout seconds.
+    int     (*recv)(struct _distTransport *t, int peer, int tick,
+                    void *data, double timeout);
+    void    (*close)(struct _distTransport *t);
+};
+
+/* Loopback datagrams: rank r listens on 127.0.0.1, port + r.  Messages
+ * are split into datagrams and not retransmitted, so one lost datagram
+ * times the tick out and stops the run; that is only safe on loopback,
+ * and there is no LAN variant until it retransmits. */
+struct _distTransport *dist_udp_open(int rank, int ranks, int max_message,
+                                     int port);
+
+// Mailboxes in POSIX shared memory /<name>.<rank>, for one machine.
+struct _distTransport *dist_shm_open(int rank, int ranks, int max_message,
+                                     const char *name);
+
+// Opens a transport from "udp[:port]" or "shm[:name]".
+struct _distTransport *dist_transport_open(const char *spec, int rank,
+                                           int ranks, int max_message);
+
+struct _distAgent
+{
+    int     state;      // DIST_NONE, DIST_OWNED or DIST_GHOST
+    float   pos[2];     // in the full field
+    float   gain;
+    float   fade;
+    float   obs[3];
+};
+
+enum { DIST_NONE, DIST_OWNED, DIST_GHOST };
+
+struct _distNode
+{
+    int                 rank;
+    int                 ranks;
+    int                 width;
+    int                 height;     // of the full field
+    int                 passes;
+    int                 halo;
+    int                 row0;       // first row owned
+    int                 rows;       // rows owned
+    struct _vfcpu_field *field;     // owned rows plus halos
+    struct _distAgent   agents[DIST_AGENTS];
+    struct _distTransport *transport;
+    int                 tick;
+    char               *message;
+
+    // since the node started
+    int                 migrations;
+    double              exchange_time;
+    double              compute_time;
+    long                bytes_sent;
+};
+
+/* Rank r of ranks owning its strip of a width x height field.  Returns
+ * 0 if a strip would be thinner than the halo. */
+struct _distNode *dist_new(int rank, int ranks, int width, int height,
+                           int passes);
+void dist_free(struct _distNode *n);
+
+// Largest message dist_step() sends, for opening the transport.
+int dist_message_size(int width, int passes);
+
+// Rank owning row y of the full field.
+int dist_owner(struct _distNode *n, float y);
+
+/* A new agent is claimed by the rank that owns its position; later
+ * positions only move it on its owner.  Every rank may be given every
+ * agent's positions, as when agents are connected to all of them. */
+void dist_add_agent(struct _distNode *n, int id, float x, float y,
+                    float gain, float fade);
+void dist_move_agent(struct _distNode *n, int id, float x, float y,
+                     float gain, float fade);
+void dist_release_agent(struct _distNode *n, int id);
+
+/* Hands off agents that left the strip, exchanges halos and runs the
+ * tick's passes.  Returns 1 if a neighbour timed out. */
+int dist_step(struct _distNode *n);
+
+// RGBA cell of the full field's row y, which must be owned.
+float *dist_cell(struct _distNode *n, int x, int y);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // _INFLUENCE_DIST_H_
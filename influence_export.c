@@ -0,0 +1,178 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "influence_export.h"
+#include "influence_time.h"
+
+struct _exportHeader *export_header = 0;
+unsigned long export_size = 0;
+char export_name[256];
+
+static struct _exportSlot *slot_at(struct _exportHeader *h, int i)
+{
+    return (struct _exportSlot*)((char*)h + 4096
+                                 + (unsigned long)i * h->slot_size);
+}
+
+int fexp_open(const char *name, int width, int height)
+{
+    unsigned int data_size = width * height * 4 * sizeof(float);
+    unsigned int slot_size = (64 + data_size + 4095) & ~4095;
+
+    // a fresh object, so readers of one left by a crashed server are not
+    // truncated under their mapping
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        printf("Could not create shared memory %s\n", name);
+        return 1;
+    }
+    export_size = 4096 + (unsigned long)slot_size * EXPORT_SLOTS;
+    if (ftruncate(fd, export_size)) {
+        printf("Could not size shared memory %s\n", name);
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(0, export_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Could not map shared memory %s\n", name);
+        return 1;
+    }
+
+    export_header = (struct _exportHeader*)map;
+    export_header->width = width;
+    export_header->height = height;
+    export_header->format = EXPORT_RGBA32F;
+    export_header->num_slots = EXPORT_SLOTS;
+    export_header->slot_size = slot_size;
+    export_header->data_offset = 64;
+    export_header->head = 0;
+    export_header->retired = 0;
+    // readers check the magic last
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(export_header->magic, EXPORT_MAGIC, 8);
+
+    strncpy(export_name, name, sizeof(export_name) - 1);
+    printf("Exporting field to shared memory %s\n", name);
+    return 0;
+}
+
+int fexp_active()
+{
+    return export_header != 0;
+}
+
+void fexp_publish(int tick, const float *cells)
+{
+    struct _exportHeader *h = export_header;
+    if (!h)
+        return;
+
+    struct _exportSlot *s = slot_at(h, h->head % h->num_slots);
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->tick = tick;
+    s->time = itime_now();
+    memcpy((char*)s + h->data_offset, cells,
+           h->width * h->height * 4 * sizeof(float));
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&h->head, h->head + 1, __ATOMIC_RELEASE);
+}
+
+void fexp_close()
+{
+    if (!export_header)
+        return;
+    // readers still mapping it go back to the name
+    __atomic_store_n(&export_header->retired, 1, __ATOMIC_RELEASE);
+    munmap(export_header, export_size);
+    shm_unlink(export_name);
+    export_header = 0;
+}
+
+int fexp_open_reader(struct _exportReader *r, const char *name)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st) || st.st_size < 4096) {
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    r->header = (struct _exportHeader*)map;
+    r->size = st.st_size;
+    r->inode = st.st_ino;
+    strncpy(r->name, name, sizeof(r->name) - 1);
+    r->name[sizeof(r->name) - 1] = 0;
+    if (memcmp(r->header->magic, EXPORT_MAGIC, 8)) {
+        fexp_close_reader(r);
+        return 1;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void fexp_close_reader(struct _exportReader *r)
+{
+    if (r->header)
+        munmap(r->header, r->size);
+    r->header = 0;
+}
+
+int fexp_retired(struct _exportReader *r)
+{
+    return __atomic_load_n(&r->header->retired, __ATOMIC_ACQUIRE);
+}
+
+int fexp_replaced(struct _exportReader *r)
+{
+    struct stat st;
+    int fd = shm_open(r->name, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+    int replaced = !fstat(fd, &st) && st.st_ino != r->inode;
+    close(fd);
+    return replaced;
+}
+
+const float *fexp_read_begin(struct _exportReader *r,
+                             struct _exportSlot **slot, unsigned int *seq)
+{
+    struct _exportHeader *h = r->header;
+    unsigned long long head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    if (!head)
+        return 0;
+
+    struct _exportSlot *s = slot_at(h, (head - 1) % h->num_slots);
+    *seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (*seq & 1) {
+        // being rewritten; the one before is complete
+        if (head < 2)
+            return 0;
+        s = slot_at(h, (head - 2) % h->num_slots);
+        *seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    }
+    *slot = s;
+    return (const float*)((char*)s + h->data_offset);
+}
+
+int fexp_read_end(struct _exportSlot *slot, unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(seq & 1) && __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
@@ -0,0 +1,76 @@
+
+#ifndef _INFLUENCE_EXPORT_H_
+#define _INFLUENCE_EXPORT_H_
+
+/* Ring of completed field frames in POSIX shared memory.  The server is
+ * the only writer; any number of local readers map the same object and
+ * read frames in place.  Each slot carries a sequence number that is odd
+ * while the slot is being written, so a reader checks it before and
+ * after looking at a frame and retries if it changed.
+ *
+ * A resize replaces the object under the same name.  The old one is
+ * marked retired before the server lets go of it, so readers holding it
+ * know to close it and open the name again. */
+
+#define EXPORT_MAGIC "INFLFLD1"
+#define EXPORT_SLOTS 4
+#define EXPORT_DEFAULT_NAME "/influence.field"
+
+// Cell formats
+#define EXPORT_RGBA32F 1    // 4 floats per cell, row 0 at the bottom
+
+struct _exportHeader
+{
+    char                magic[8];
+    int                 width;
+    int                 height;
+    int                 format;
+    int                 num_slots;
+    unsigned int        slot_size;      // bytes from one slot to the next
+    unsigned int        data_offset;    // from the start of a slot
+    unsigned long long  head;           // frames ever published
+    unsigned int        retired;        // replaced or closed by the server
+};
+
+struct _exportSlot
+{
+    unsigned int        seq;
+    int                 tick;
+    double              time;
+};
+
+// Server side
+int fexp_open(const char *name, int width, int height);
+void fexp_publish(int tick, const float *cells);
+void fexp_close();
+int fexp_active();
+
+// Reader side
+struct _exportReader
+{
+    struct _exportHeader   *header;
+    unsigned long           size;
+    char                    name[256];
+    unsigned long           inode;          // of the object mapped
+};
+
+int fexp_open_reader(struct _exportReader *r, const char *name);
+void fexp_close_reader(struct _exportReader *r);
+
+/* Returns 1 once the server has replaced or closed the object; no more
+ * frames will be published to it. */
+int fexp_retired(struct _exportReader *r);
+
+/* Returns 1 if the name now refers to another object, as when a server
+ * that crashed without retiring its export has been restarted.  This
+ * opens the name, so check it only while no frames arrive. */
+int fexp_replaced(struct _exportReader *r);
+
+/* Returns the newest frame, pointing into shared memory, or 0 if none
+ * has been published.  The frame is only valid if fexp_read_end()
+ * returns 1 once the reader is done with it. */
+const float *fexp_read_begin(struct _exportReader *r,
+                             struct _exportSlot **slot, unsigned int *seq);
+int fexp_read_end(struct _exportSlot *slot, unsigned int seq);
+
+#endif // _INFLUENCE_EXPORT_H_
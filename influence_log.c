@@ -0,0 +1,102 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "influence_log.h"
+#include "influence_time.h"
+
+FILE *log_file = 0;
+int log_writing = 0;
+int log_tick = 0;
+double log_start = 0;
+
+int ilog_open_write(const char *path, int width, int height, int passes)
+{
+    struct _logHeader h;
+
+    log_file = fopen(path, "wb");
+    if (!log_file) {
+        printf("Could not open log %s\n", path);
+        return 1;
+    }
+    // events are small; let stdio batch them
+    setvbuf(log_file, 0, _IOFBF, 1 << 20);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LOG_MAGIC, 8);
+    h.width = width;
+    h.height = height;
+    h.passes = passes;
+    fwrite(&h, sizeof(h), 1, log_file);
+
+    log_writing = 1;
+    log_tick = 0;
+    log_start = itime_now();
+    return 0;
+}
+
+int ilog_recording()
+{
+    return log_writing;
+}
+
+void ilog_record(int type, int instance, float v0, float v1)
+{
+    struct _logEvent e;
+    if (!log_writing)
+        return;
+
+    e.time = itime_now() - log_start;
+    e.tick = log_tick;
+    e.type = type;
+    e.instance = instance;
+    e.reserved = 0;
+    e.value[0] = v0;
+    e.value[1] = v1;
+    fwrite(&e, sizeof(e), 1, log_file);
+}
+
+void ilog_tick()
+{
+    if (!log_writing)
+        return;
+    ilog_record(LOG_TICK, 0, 0, 0);
+    log_tick++;
+}
+
+void ilog_close()
+{
+    if (log_file) {
+        if (log_writing)
+            printf("Recorded %d ticks\n", log_tick);
+        fclose(log_file);
+    }
+    log_file = 0;
+    log_writing = 0;
+}
+
+int ilog_open_read(const char *path, struct _logHeader *header)
+{
+    log_file = fopen(path, "rb");
+    if (!log_file) {
+        printf("Could not open log %s\n", path);
+        return 1;
+    }
+    setvbuf(log_file, 0, _IOFBF, 1 << 20);
+
+    if (fread(header, sizeof(*header), 1, log_file) != 1
+        || memcmp(header->magic, LOG_MAGIC, 8)) {
+        printf("%s is not an influence log\n", path);
+        fclose(log_file);
+        log_file = 0;
+        return 1;
+    }
+    log_writing = 0;
+    return 0;
+}
+
+int ilog_next(struct _logEvent *e)
+{
+    return log_file && fread(e, sizeof(*e), 1, log_file) == 1;
+}
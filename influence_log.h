@@ -0,0 +1,61 @@
+
+#ifndef _INFLUENCE_LOG_H_
+#define _INFLUENCE_LOG_H_
+
+/* Binary log of every input the influence server receives.  A log is a
+ * header followed by fixed-size events; LOG_TICK marks the point where
+ * the field advanced, so replaying the events between two ticks and then
+ * stepping the field reproduces the run. */
+
+#define LOG_MAGIC "INFLLOG1"
+
+enum {
+    LOG_TICK,
+    LOG_POS,            // value = x, y
+    LOG_RELEASE,
+    LOG_GAIN,
+    LOG_SPIN,
+    LOG_FADE,
+    LOG_DIR,            // value[0] = angle
+    LOG_FLOW,
+    LOG_BORDER_GAIN,
+    LOG_MOUSE,          // value = field x, y, or -1 when released
+    LOG_PASSES,         // value[0] = passes per tick
+    LOG_RESIZE,         // value = new width, height
+};
+
+struct _logHeader
+{
+    char    magic[8];
+    int     width;
+    int     height;
+    int     passes;
+    int     reserved;
+};
+
+struct _logEvent
+{
+    double          time;       // seconds since the log was opened
+    int             tick;
+    unsigned char   type;
+    unsigned char   instance;
+    short           reserved;
+    float           value[2];
+};
+
+// Starts recording to path; events are dropped until this is called.
+int ilog_open_write(const char *path, int width, int height, int passes);
+
+void ilog_record(int type, int instance, float v0, float v1);
+void ilog_tick();
+void ilog_close();
+
+int ilog_recording();
+
+// Opens a log for replay and reads its header.
+int ilog_open_read(const char *path, struct _logHeader *header);
+
+// Reads the next event; returns 0 at the end of the log.
+int ilog_next(struct _logEvent *e);
+
+#endif // _INFLUENCE_LOG_H_
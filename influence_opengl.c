@@ -21,25 +21,32 @@
 #include <stdlib.h>
 
 #include "influence_opengl.h"
+#include "influence_cpu.h"
+#include "influence_log.h"
+#include "influence_export.h"
+#include "influence_profile.h"
 
 // TODO: It would be much more efficient to use a 1-d kernel and separate convolution into
 //       2 passes (horizontal & vertical). This means switching between shaders.
-const float kernels[] = {0.003,0.012,0.021,0.012,0.003,
-                         0.012,0.060,0.100,0.060,0.012,
-                         0.021,0.100,0.166,0.100,0.021,
-                         0.012,0.060,0.100,0.060,0.012,
-                         0.003,0.012,0.021,0.012,0.003};
+const float *kernels = vfcpu_kernel;
 
 // Hold id of the framebuffer for light POV rendering
 GLuint fboId;
 
-// colour values will be rendered to this texture when using fboId framebuffer
-GLuint fieldTexIds[2] = {0,0};
+// colour values will be rendered to these textures when using fboId
+// framebuffer; each layer has its own source and destination
+GLuint fieldTexIds[maxLayers][2];
+
+// Layer l's buffer b is on colour attachment 2l+b, and its source is
+// bound to texture unit FIELD_UNIT+l for the convolution
+#define FIELD_ATTACHMENT(l, b) (GL_COLOR_ATTACHMENT0_EXT + (l) * 2 + (b))
+#define FIELD_UNIT 4
 
 GLhandleARB fieldShaderId;
 GLuint fieldUniform;
 GLuint kernelsUniform;
 GLuint gainUniform;
+GLuint sizeUniform;
 
 GLuint src = 0, dest = 1;
 
@@ -52,12 +59,23 @@ int field_height = 500;
 int window_width = 0;
 int window_height = 0;
 int fullscreen = 0;
+int num_layers = 1;
+
+// Draw the window only every display_skip frames
+int display_skip = 1;
+int display_frame = 0;
+
+// When the current frame started, and how long it waited in the buffer
+// swap, for measuring its cost without the vsync wait
+double vfgl_frame_start = 0;
+double vfgl_swap_time = 0;
 
 struct _agent agents[maxAgents];
 float borderGain = 5;
 float convolutionGain = 0.999;
 
 int showField = 0;
+int showLayer = 0;
 
 int mouse_x = -1;
 int mouse_y = -1;
@@ -72,12 +90,35 @@ int before_fs_window_height = 0;
 
 void (*vfgl_DrawCallback)() = 0;
 
+// If set, gates each tick: the field only advances once it returns 1
+int (*vfgl_ReadyCallback)() = 0;
+
+// Pixel buffers for reading the field back without stalling
+GLuint exportPBOs[2] = {0,0};
+int exportIndex = 0;
+int exportPending = 0;
+int exportTick = 0;
+
+// GPU timer queries, read back PROF_QUERY_FRAMES frames after they were
+// issued so reading them never stalls the pipeline
+#define PROF_QUERY_FRAMES 4
+#define PROF_MAX_QUERIES 64
+struct _gpuQueries
+{
+    GLuint  ids[PROF_MAX_QUERIES];
+    int     phase[PROF_MAX_QUERIES];
+    double  start[PROF_MAX_QUERIES];
+    int     count;
+} gpuQueries[PROF_QUERY_FRAMES];
+int gpuFrame = 0;
+int gpuTimers = 0;
+
 // Loading shader function
-GLhandleARB loadShader(char* filename, unsigned int type)
+GLhandleARB loadShader(char* filename, unsigned int type, const char *header)
 {
 	FILE *pfile;
 	GLhandleARB handle;
-	const GLcharARB* files[1];
+	const GLcharARB* files[2];
 	
 	// shader Compilation variable
 	GLint result;				// Compilation code result
@@ -110,10 +151,11 @@ GLhandleARB loadShader(char* filename, unsigned int type)
 		exit(0);
 	}
 	
-	files[0] = (const GLcharARB*)buffer;
+	files[0] = (const GLcharARB*)header;
+	files[1] = (const GLcharARB*)buffer;
 	glShaderSourceARB(
 					  handle, //The handle to our shader
-					  1, //The number of files.
+					  2, //The number of files.
 					  files, //An array of const char * data, which represents the source code of theshaders
 					  NULL);
 	
@@ -154,8 +196,12 @@ void loadFieldShader()
 	GLhandleARB vertexShaderHandle;
 	GLhandleARB fragmentShaderHandle;
 	
-	vertexShaderHandle   = loadShader("VertexShader.c",GL_VERTEX_SHADER);
-	fragmentShaderHandle = loadShader("FragmentShader.c",GL_FRAGMENT_SHADER);
+	char header[64];
+	sprintf(header, "#define LAYERS %d\n", num_layers);
+
+	vertexShaderHandle   = loadShader("VertexShader.c",GL_VERTEX_SHADER,"");
+	fragmentShaderHandle = loadShader("FragmentShader.c",GL_FRAGMENT_SHADER,
+                                      header);
 	
 	fieldShaderId = glCreateProgramObjectARB();
 	
@@ -181,9 +227,23 @@ void loadFieldShader()
         exit(1);
     }
 
+	sizeUniform = glGetUniformLocationARB(fieldShaderId, "size");
+    if (sizeUniform == -1) {
+        printf("Error getting uniform `%s'.\n", "size");
+        exit(1);
+    }
+
+    GLint units[maxLayers];
+    int i;
+    for (i=0; i < num_layers; i++)
+        units[i] = FIELD_UNIT + i;
+
     glUseProgramObjectARB(fieldShaderId);
+    glUniform1ivARB(fieldUniform, num_layers, units);
     glUniform1fvARB(kernelsUniform, 25, kernels);
     glUniform1fARB(gainUniform, convolutionGain);
+    glUniform2fARB(sizeUniform, field_width, field_height);
+    glUseProgramObjectARB(0);
 }
 
 void generateFBO()
@@ -196,10 +256,10 @@ void generateFBO()
     glClampColorARB(GL_CLAMP_READ_COLOR_ARB, GL_FALSE);
     glClampColorARB(GL_CLAMP_FRAGMENT_COLOR_ARB, GL_FALSE);
 
-    int i;
-    for (i=0; i<2; i++)
+    int i, l;
+    for (i=0; i<2*num_layers; i++)
     {
-        GLuint *id = &fieldTexIds[i];
+        GLuint *id = &fieldTexIds[i/2][i%2];
         glGenTextures(1, id);
         glBindTexture(GL_TEXTURE_2D, *id);
 	
@@ -223,13 +283,13 @@ void generateFBO()
 	glGenFramebuffersEXT(1, &fboId);
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboId);
 	
-	// attach the texture to FBO color attachment point
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
-                              GL_TEXTURE_2D, fieldTexIds[0], 0);
-
-    // attach the texture to FBO color attachment point
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT,
-                              GL_TEXTURE_2D, fieldTexIds[1], 0);
+	// attach the textures to FBO color attachment points
+    for (l=0; l<num_layers; l++) {
+        for (i=0; i<2; i++)
+            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
+                                      FIELD_ATTACHMENT(l, i), GL_TEXTURE_2D,
+                                      fieldTexIds[l][i], 0);
+    }
 
 	// check FBO status
 	FBOstatus = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
@@ -238,11 +298,10 @@ void generateFBO()
         exit(1);
     }
 
-	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
-	glClear( GL_COLOR_BUFFER_BIT);
-
-	glDrawBuffer(GL_COLOR_ATTACHMENT1_EXT);
-	glClear( GL_COLOR_BUFFER_BIT);
+    for (i=0; i<2*num_layers; i++) {
+        glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT + i);
+        glClear( GL_COLOR_BUFFER_BIT);
+    }
 	
 	// switch back to window-system-provided framebuffer
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
@@ -301,39 +360,62 @@ void drawFullScreenWindowQuad()
 	glEnd();
 }
 
-void drawAgents()
+// Draws the agents that belong to a layer into its source, and adds the
+// layer's field to the observation of the agents that watch it.
+void drawAgents(int layer)
 {
     float data[5*5*4];
     float gain; //, sin_spin, cos_spin, dir[2], flow;
-    int i;
+    int i, bit = 1 << layer;
+
+    // read the field being drawn into, as the CPU engine does
+    glReadBuffer(FIELD_ATTACHMENT(layer, src));
     for (i=0; i < maxAgents; i++)
     {
-        if (agents[i].active)
+        if (agents[i].active && ((agents[i].layers | agents[i].observe) & bit))
         {
             // todo: spin should be read from agent data structure
 //            sin_spin = sin(agents[i].spin);
 //            cos_spin = cos(agents[i].spin);
 //            dir[0] = agents[i].dir[0];
 //            dir[1] = agents[i].dir[1];
-            gain = agents[i].gain;
+            gain = agents[i].gain * agents[i].layer_gain[layer];
 //            flow = agents[i].flow;
             glReadPixels(agents[i].pos[0]+x_offset,
                          agents[i].pos[1]+y_offset,
                          1, 1,
                          GL_RGBA, GL_FLOAT, data);
-            glBegin(GL_POINTS);
-            glColor4f(data[0], data[1], data[2]+gain, fmax(data[3], agents[i].fade));
-            glVertex2i(agents[i].pos[0], agents[i].pos[1]);
-            glEnd();
+            if (agents[i].layers & bit) {
+                glBegin(GL_POINTS);
+                glColor4f(data[0], data[1], data[2]+gain, fmax(data[3], agents[i].fade));
+                glVertex2i(agents[i].pos[0], agents[i].pos[1]);
+                glEnd();
+            }
 
             // we will read agent environment here for efficiency
-            agents[i].obs[0] = data[0];
-            agents[i].obs[1] = data[1];
-            agents[i].obs[2] = sqrt(pow(data[0],2) + pow(data[1], 2));
+            if (agents[i].observe & bit) {
+                agents[i].obs[0] += data[0];
+                agents[i].obs[1] += data[1];
+            }
         }
     }
 }
 
+void resetObservations()
+{
+    int i;
+    for (i=0; i < maxAgents; i++)
+        agents[i].obs[0] = agents[i].obs[1] = 0;
+}
+
+void finishObservations()
+{
+    int i;
+    for (i=0; i < maxAgents; i++)
+        agents[i].obs[2] = sqrt(pow(agents[i].obs[0],2)
+                                + pow(agents[i].obs[1], 2));
+}
+
 void drawBorder()
 {
     if (!borderGain)
@@ -383,65 +465,181 @@ void drawMouse()
     }
 }
 
-void renderScene(void) 
+// Starts an asynchronous read of this frame's field and publishes the
+// previous frame, whose transfer has had a whole frame to complete.
+void exportField()
 {
-	update();
+    GLint readBuffer;
+    int size = field_width * field_height * 4 * sizeof(float);
+    int i;
 
-    glDisable(GL_LIGHTING);
-    glDisable(GL_DEPTH_TEST);
-	
-	glViewport(0,0, field_width, field_height);
+    if (!exportPBOs[0]) {
+        glGenBuffersARB(2, exportPBOs);
+        for (i=0; i<2; i++) {
+            glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, exportPBOs[i]);
+            glBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB, size, 0,
+                            GL_STREAM_READ_ARB);
+        }
+    }
 
-    // Draw quad to the screen in the corner
+    glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+    glReadBuffer(FIELD_ATTACHMENT(0, dest));
+    glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, exportPBOs[exportIndex]);
+    glReadPixels(0, 0, field_width, field_height, GL_RGBA, GL_FLOAT, 0);
+    glReadBuffer(readBuffer);
+
+    if (exportPending) {
+        glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, exportPBOs[1-exportIndex]);
+        float *cells = (float*)glMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB,
+                                              GL_READ_ONLY_ARB);
+        if (cells) {
+            fexp_publish(exportTick, cells);
+            glUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+        }
+    }
+    glBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+    exportTick = field_tick;
+    exportPending = 1;
+    exportIndex = 1 - exportIndex;
+}
+
+void vfgl_ReadLayer(int layer, float *cells)
+{
+    GLint readBuffer;
     glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboId);
+    glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+    glReadBuffer(FIELD_ATTACHMENT(layer, dest));
+    glReadPixels(0, 0, field_width, field_height, GL_RGBA, GL_FLOAT, cells);
+    glReadBuffer(readBuffer);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+}
 
-    setupMatrices(0);
+// Loads both textures, so the next pass starts from cells whichever way
+// source and destination are swapped.
+void vfgl_WriteLayer(int layer, const float *cells)
+{
+    int i;
+    for (i=0; i<2; i++) {
+        glBindTexture(GL_TEXTURE_2D, fieldTexIds[layer][i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, field_width, field_height,
+                        GL_RGBA, GL_FLOAT, cells);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-    int pass = number_of_passes;
+void vfgl_ReadField(float *cells)
+{
+    vfgl_ReadLayer(0, cells);
+}
 
-    while (pass-- > 0)
-    {
-        // Swap source and destination
-        src = 1-src;
-        dest = 1-dest;
+void vfgl_WriteField(const float *cells)
+{
+    vfgl_WriteLayer(0, cells);
+}
 
-        // Draw to the source to update agent positions
-        glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT + src);
-        drawBorder();
-        drawAgents();
+void gpuBegin(int phase)
+{
+    if (!prof_enabled)
+        return;
+    prof_begin(phase);
+    struct _gpuQueries *q = &gpuQueries[gpuFrame];
+    if (!gpuTimers || q->count >= PROF_MAX_QUERIES)
+        return;
+    q->phase[q->count] = phase;
+    q->start[q->count] = prof_now();
+    glBeginQuery(GL_TIME_ELAPSED, q->ids[q->count]);
+}
 
-        // Draw mouse "agent"
-        drawMouse();
+void gpuEnd(int phase)
+{
+    if (!prof_enabled)
+        return;
+    prof_end(phase);
+    struct _gpuQueries *q = &gpuQueries[gpuFrame];
+    if (!gpuTimers || q->count >= PROF_MAX_QUERIES)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    q->count++;
+}
 
-        // Draw the shader to destination texture
-        glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT + dest);
+// Reads the oldest frame's queries and reuses its slot for this frame.
+void gpuCollect()
+{
+    int i;
+    if (!prof_enabled || !gpuTimers)
+        return;
+    gpuFrame = (gpuFrame + 1) % PROF_QUERY_FRAMES;
+    struct _gpuQueries *q = &gpuQueries[gpuFrame];
+    for (i=0; i < q->count; i++) {
+        GLuint64 ns;
+        glGetQueryObjectui64v(q->ids[i], GL_QUERY_RESULT, &ns);
+        prof_gpu(q->phase[i], q->start[i], ns / 1000000000.0);
+    }
+    if (q->count)
+        prof_gpu_frame();
+    q->count = 0;
+}
 
-        //glClear(GL_COLOR_BUFFER_BIT);
+/* Reallocates the field at a new size, resampling its contents and
+ * moving agents to the same relative position. */
+void vfgl_ResizeField(int width, int height)
+{
+    int i, l;
+    float sx = (float)width / field_width;
+    float sy = (float)height / field_height;
+    float *old_cells = malloc(sizeof(float) * field_width * field_height * 4);
+    float *cells[maxLayers];
+
+    for (l=0; l < num_layers; l++) {
+        cells[l] = malloc(sizeof(float) * width * height * 4);
+        vfgl_ReadLayer(l, old_cells);
+        vfcpu_resample(old_cells, field_width, field_height,
+                       cells[l], width, height);
+    }
 
-        //Using the field shader
-        glUseProgramObjectARB(fieldShaderId);
-        glUniform1iARB(fieldUniform, 7);
-        glActiveTextureARB(GL_TEXTURE7);
-        glBindTexture(GL_TEXTURE_2D, fieldTexIds[src]);
+    glDeleteFramebuffersEXT(1, &fboId);
+    for (l=0; l < num_layers; l++)
+        glDeleteTextures(2, fieldTexIds[l]);
+    if (exportPBOs[0]) {
+        glDeleteBuffersARB(2, exportPBOs);
+        exportPBOs[0] = exportPBOs[1] = 0;
+        exportPending = 0;
+    }
 
-        drawFullScreenFieldQuad();
+    field_width = width;
+    field_height = height;
+    generateFBO();
+    for (l=0; l < num_layers; l++)
+        vfgl_WriteLayer(l, cells[l]);
 
-        glUseProgramObjectARB(0);
-        glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgramObjectARB(fieldShaderId);
+    glUniform2fARB(sizeUniform, field_width, field_height);
+    glUseProgramObjectARB(0);
+
+    for (i=0; i < maxAgents; i++) {
+        agents[i].pos[0] *= sx;
+        agents[i].pos[1] *= sy;
     }
+    mouse_x = mouse_y = prev_mouse_x = prev_mouse_y = -1;
 
+    free(old_cells);
+    for (l=0; l < num_layers; l++)
+        free(cells[l]);
+}
+
+void drawWindow()
+{
+    gpuBegin(PROF_DISPLAY);
     setupMatrices(1);
 	glViewport(0,0, window_width, window_height);
 
-    // Draw quad to the screen
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-
     glClear( GL_COLOR_BUFFER_BIT);
 
     if (showField)
     {
         glActiveTextureARB(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, fieldTexIds[dest]);
+        glBindTexture(GL_TEXTURE_2D, fieldTexIds[showLayer][dest]);
 
         glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
         glEnable( GL_TEXTURE_2D );
@@ -452,8 +650,8 @@ void renderScene(void)
     }
 
     if (showField != 1) {
-        float multx = window_width * 0.002;
-        float multy = window_height * 0.002;
+        float multx = (float)window_width / field_width;
+        float multy = (float)window_height / field_height;
         glPointSize(5);
         int i;
         glColor3f(1,1,1);
@@ -468,11 +666,103 @@ void renderScene(void)
         glEnd();
         glPointSize(0.5);
     }
+    gpuEnd(PROF_DISPLAY);
 
+    double swap_start = prof_now();
+    prof_begin(PROF_SWAP);
 	glutSwapBuffers();
+    prof_end(PROF_SWAP);
+    vfgl_swap_time = prof_now() - swap_start;
+}
+
+void renderScene(void) 
+{
+    vfgl_frame_start = prof_now();
+    vfgl_swap_time = 0;
+    prof_begin(PROF_FRAME);
+    gpuCollect();
+
+	update();
+
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+	
+	glViewport(0,0, field_width, field_height);
+
+    // Draw quad to the screen in the corner
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fboId);
+
+    setupMatrices(0);
+
+    int pass = number_of_passes, layer;
+    GLenum drawBuffers[maxLayers];
+
+    while (pass-- > 0)
+    {
+        // Swap source and destination
+        src = 1-src;
+        dest = 1-dest;
+
+        // Draw to each layer's source to update agent positions
+        gpuBegin(PROF_DRAW);
+        resetObservations();
+        for (layer=0; layer < num_layers; layer++) {
+            glDrawBuffer(FIELD_ATTACHMENT(layer, src));
+            drawBorder();
+            drawAgents(layer);
+        }
+        finishObservations();
+
+        // Draw mouse "agent"
+        glDrawBuffer(FIELD_ATTACHMENT(0, src));
+        drawMouse();
+        gpuEnd(PROF_DRAW);
+
+        gpuBegin(PROF_CONVOLVE);
+        // Draw the shader to every layer's destination texture at once
+        for (layer=0; layer < num_layers; layer++)
+            drawBuffers[layer] = FIELD_ATTACHMENT(layer, dest);
+        glDrawBuffers(num_layers, drawBuffers);
+
+        //glClear(GL_COLOR_BUFFER_BIT);
+
+        //Using the field shader
+        glUseProgramObjectARB(fieldShaderId);
+        for (layer=0; layer < num_layers; layer++) {
+            glActiveTextureARB(GL_TEXTURE0 + FIELD_UNIT + layer);
+            glBindTexture(GL_TEXTURE_2D, fieldTexIds[layer][src]);
+        }
+
+        drawFullScreenFieldQuad();
+
+        glUseProgramObjectARB(0);
+        for (layer=0; layer < num_layers; layer++) {
+            glActiveTextureARB(GL_TEXTURE0 + FIELD_UNIT + layer);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        gpuEnd(PROF_CONVOLVE);
+    }
+
+    if (fexp_active()) {
+        gpuBegin(PROF_EXPORT);
+        exportField();
+        gpuEnd(PROF_EXPORT);
+    }
+
+    // switch back to window-system-provided framebuffer
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
+    // The field keeps advancing while the window is skipped
+    if (++display_frame >= display_skip) {
+        display_frame = 0;
+        drawWindow();
+    }
 
     if (vfgl_DrawCallback)
         vfgl_DrawCallback();
+
+    prof_end(PROF_FRAME);
+    prof_frame();
 }
 
 void processNormalKeys(unsigned char key, int x, int y) {
@@ -492,6 +782,18 @@ void processNormalKeys(unsigned char key, int x, int y) {
             fullscreen = 1;
         }
     }
+    else if (key == 'c') {
+        checkpoint_requested = 1;
+    }
+    else if (key == 'p') {
+        profile_requested = 1;
+    }
+    else if (key == 'l') {
+        latency_requested = 1;
+    }
+    else if (key >= '1' && key < '1' + num_layers) {
+        showLayer = key - '1';
+    }
     else if (key == ' ') {
         showField++;
         if (showField > 2) {
@@ -524,6 +826,7 @@ void mouseMove(int x, int y)
         delta_mouse_x = 0;
         delta_mouse_y = 0;
     }
+    ilog_record(LOG_MOUSE, 0, mouse_x, mouse_y);
 }
 
 void mouseButton(int button, int state, int x, int y)
@@ -534,27 +837,45 @@ void mouseButton(int button, int state, int x, int y)
         mouseMove(x, y);
         prev_mouse_x = mouse_x;
         prev_mouse_y = mouse_y;
+        ilog_record(LOG_MOUSE, 1, mouse_x, mouse_y);
     }
 }
 
 void onTimer(int value)
 {
+    if (vfgl_ReadyCallback) {
+        // Check again as soon as GLUT has handled its events
+        if (vfgl_ReadyCallback())
+            renderScene();
+        glutTimerFunc(0, onTimer, 0);
+        return;
+    }
     renderScene();
     glutTimerFunc((int)(1000.0/update_rate), onTimer, 0);
 }
 
-void vfgl_Init(int argc, char** argv)
+void vfgl_ResetAgents()
 {
-    int i;
+    int i, l;
     for (i=0; i < maxAgents; i++) {
         agents[i].active = 0;
+        agents[i].restored = 0;
         agents[i].gain = 1;
         agents[i].spin = 0;
         agents[i].fade = 0;
         agents[i].dir[0] = 1;
         agents[i].dir[1] = 0;
         agents[i].flow = 0;
+        agents[i].layers = 1;
+        agents[i].observe = 1;
+        for (l=0; l < maxLayers; l++)
+            agents[i].layer_gain[l] = 1;
     }
+}
+
+void vfgl_Init(int argc, char** argv)
+{
+    vfgl_ResetAgents();
 
     if (window_width==0)
         window_width = field_width;
@@ -578,8 +899,27 @@ void vfgl_Init(int argc, char** argv)
     }
 #endif
 
+    GLint maxAttachments, maxDrawBuffers;
+    glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS_EXT, &maxAttachments);
+    glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffers);
+    if (num_layers * 2 > maxAttachments || num_layers > maxDrawBuffers) {
+        printf("%d layers need %d colour attachments and %d draw buffers, "
+               "have %d and %d\n", num_layers, num_layers * 2, num_layers,
+               maxAttachments, maxDrawBuffers);
+        exit(1);
+    }
+
 	generateFBO();
 	loadFieldShader();
+
+#ifdef GLEW_VERSION
+    gpuTimers = prof_enabled && GLEW_ARB_timer_query;
+#endif
+    if (gpuTimers) {
+        int i;
+        for (i=0; i < PROF_QUERY_FRAMES; i++)
+            glGenQueries(PROF_MAX_QUERIES, gpuQueries[i].ids);
+    }
 	
 	glClearColor(0,0,0,0);
 
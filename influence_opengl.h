@@ -5,8 +5,17 @@
 void vfgl_Init(int argc, char** argv);
 void vfgl_CmdLine(int argc, char **argv);
 void vfgl_Run();
+void vfgl_ResetAgents();
+
+// Field contents as RGBA floats, row 0 at the bottom
+void vfgl_ReadField(float *cells);
+void vfgl_WriteField(const float *cells);
+void vfgl_ReadLayer(int layer, float *cells);
+void vfgl_WriteLayer(int layer, const float *cells);
+void vfgl_ResizeField(int width, int height);
 
 #define maxAgents 50
+#define maxLayers 4
 struct _agent
 {
     int     active;
@@ -17,12 +26,24 @@ struct _agent
     float   fade;
     float   dir[2];
     float   flow;
+    int     submitted;  // position received since the last tick
+    double  pos_time;   // timetag of the position vector in pos[]
+    int     restored;   // loaded from a checkpoint, instance not yet seen
+    int     layers;     // bit mask of the layers the agent draws into
+    int     observe;    // bit mask of the layers summed into obs
+    float   layer_gain[maxLayers];
 } agent;
 
 extern struct _agent agents[];
 extern float borderGain;
+extern float convolutionGain;
 extern void mapperLogout();
+extern int field_tick;
+extern int checkpoint_requested;
+extern int profile_requested;
+extern int latency_requested;
 extern void (*vfgl_DrawCallback)();
+extern int (*vfgl_ReadyCallback)();
 
 // Options
 extern int update_rate;
@@ -32,5 +53,9 @@ extern int y_offset;
 extern int field_width;
 extern int field_height;
 extern int fullscreen;
+extern int num_layers;
+extern int display_skip;
+extern double vfgl_frame_start;
+extern double vfgl_swap_time;
 
 #endif // _VFGL_H_
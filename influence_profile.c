@@ -0,0 +1,187 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "influence_profile.h"
+#include "influence_time.h"
+
+#define PROF_BINS 20
+
+const char *prof_phase_names[] = {
+    "frame", "draw", "convolve", "export", "display", "swap", "poll", "send"
+};
+
+int prof_enabled = 0;
+
+struct _profPhase
+{
+    double  start;
+    double  total[2];           // this frame, CPU and GPU
+    int     ran[2];
+    float   window[2][PROF_WINDOW];
+    int     count[2];
+} prof_phases[PROF_PHASES];
+
+struct _profEvent
+{
+    double  start;
+    float   duration;
+    short   phase;
+    short   gpu;
+} prof_trace[PROF_TRACE_EVENTS];
+int prof_trace_count = 0;
+double prof_epoch = 0;
+
+double prof_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void trace(int phase, int gpu, double start, double duration)
+{
+    struct _profEvent *e = &prof_trace[prof_trace_count++ % PROF_TRACE_EVENTS];
+    if (!prof_epoch)
+        prof_epoch = start;
+    e->start = start;
+    e->duration = duration;
+    e->phase = phase;
+    e->gpu = gpu;
+}
+
+static void push(int gpu)
+{
+    int i;
+    for (i=0; i < PROF_PHASES; i++) {
+        struct _profPhase *p = &prof_phases[i];
+        if (!p->ran[gpu])
+            continue;
+        p->window[gpu][p->count[gpu]++ % PROF_WINDOW] = p->total[gpu];
+        p->total[gpu] = 0;
+        p->ran[gpu] = 0;
+    }
+}
+
+void prof_begin(int phase)
+{
+    if (prof_enabled)
+        prof_phases[phase].start = prof_now();
+}
+
+void prof_end(int phase)
+{
+    if (!prof_enabled)
+        return;
+    struct _profPhase *p = &prof_phases[phase];
+    double duration = prof_now() - p->start;
+    p->total[0] += duration;
+    p->ran[0] = 1;
+    trace(phase, 0, p->start, duration);
+}
+
+void prof_frame()
+{
+    if (prof_enabled)
+        push(0);
+}
+
+void prof_gpu(int phase, double start, double seconds)
+{
+    struct _profPhase *p = &prof_phases[phase];
+    p->total[1] += seconds;
+    p->ran[1] = 1;
+    trace(phase, 1, start, seconds);
+}
+
+void prof_gpu_frame()
+{
+    push(1);
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+    float d = *(const float*)a - *(const float*)b;
+    return d < 0 ? -1 : d > 0;
+}
+
+int prof_stats(int phase, int gpu, float *stats)
+{
+    struct _profPhase *p = &prof_phases[phase];
+    float sorted[PROF_WINDOW];
+    int i, n = p->count[gpu] < PROF_WINDOW ? p->count[gpu] : PROF_WINDOW;
+    if (!n)
+        return 0;
+
+    double sum = 0;
+    memcpy(sorted, p->window[gpu], sizeof(float) * n);
+    qsort(sorted, n, sizeof(float), compare_floats);
+    for (i=0; i < n; i++)
+        sum += sorted[i];
+    stats[0] = sum / n * 1000;
+    stats[1] = sorted[n / 2] * 1000;
+    stats[2] = sorted[n * 99 / 100] * 1000;
+    return 1;
+}
+
+void prof_print()
+{
+    int i, j, gpu, bin;
+    float stats[3];
+    for (i=0; i < PROF_PHASES; i++) {
+        for (gpu=0; gpu < 2; gpu++) {
+            struct _profPhase *p = &prof_phases[i];
+            if (!prof_stats(i, gpu, stats))
+                continue;
+            printf("%s %s: mean %.3f ms, p50 %.3f ms, p99 %.3f ms\n",
+                   prof_phase_names[i], gpu ? "GPU" : "CPU",
+                   stats[0], stats[1], stats[2]);
+
+            // bin i counts [2^i, 2^(i+1)) us
+            unsigned int bins[PROF_BINS];
+            int n = p->count[gpu] < PROF_WINDOW ? p->count[gpu] : PROF_WINDOW;
+            memset(bins, 0, sizeof(bins));
+            for (j=0; j < n; j++)
+                bins[itime_bin(p->window[gpu][j], PROF_BINS)]++;
+            for (bin=0; bin < PROF_BINS; bin++) {
+                if (bins[bin])
+                    printf("  %8u - %8u us: %u\n", bin ? 1 << bin : 0,
+                           1 << (bin + 1), bins[bin]);
+            }
+        }
+    }
+}
+
+int prof_write_trace(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Could not write trace to %s\n", path);
+        return 1;
+    }
+
+    int i, first = 0, n = prof_trace_count;
+    if (n > PROF_TRACE_EVENTS) {
+        first = n - PROF_TRACE_EVENTS;
+        n = PROF_TRACE_EVENTS;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+            "\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,"
+            "\"args\":{\"name\":\"GPU\"}}");
+    for (i=0; i < n; i++) {
+        struct _profEvent *e = &prof_trace[(first + i) % PROF_TRACE_EVENTS];
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                "\"ts\":%.1f,\"dur\":%.1f}", prof_phase_names[e->phase],
+                e->gpu + 1, (e->start - prof_epoch) * 1000000,
+                e->duration * 1000000.0);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("Wrote %d trace events to %s\n", n, path);
+    return 0;
+}
@@ -0,0 +1,51 @@
+
+#ifndef _INFLUENCE_PROFILE_H_
+#define _INFLUENCE_PROFILE_H_
+
+/* Per-phase frame profiler.  Each phase of renderScene() and on_draw()
+ * is bracketed with a CPU timer, and the GL engine adds the GPU time of
+ * its phases from timer queries.  Per-frame totals are kept over a
+ * rolling window for statistics, and every bracket goes into a trace
+ * ring that can be written as Chrome trace JSON (chrome://tracing). */
+
+enum {
+    PROF_FRAME,     // the whole of renderScene(), including on_draw()
+    PROF_DRAW,      // border, agents and mouse, including the readbacks
+    PROF_CONVOLVE,  // field shader passes
+    PROF_EXPORT,    // field readback for -E
+    PROF_DISPLAY,   // drawing the window
+    PROF_SWAP,      // glutSwapBuffers()
+    PROF_POLL,      // mdev_poll() in on_draw()
+    PROF_SEND,      // sending observations
+    PROF_PHASES
+};
+
+#define PROF_WINDOW 512
+#define PROF_TRACE_EVENTS 65536
+
+extern const char *prof_phase_names[];
+extern int prof_enabled;
+
+double prof_now();
+
+void prof_begin(int phase);
+void prof_end(int phase);
+
+// Ends a frame, pushing the CPU time of each phase that ran.
+void prof_frame();
+
+// GPU time of one bracket, started at CPU time start; prof_gpu_frame()
+// pushes the totals once a frame's queries have all been read.
+void prof_gpu(int phase, double start, double seconds);
+void prof_gpu_frame();
+
+/* Mean, median and 99th percentile in ms over the window.  Returns 0 if
+ * the phase has no samples. */
+int prof_stats(int phase, int gpu, float *stats);
+
+// Prints a histogram of each phase over the window.
+void prof_print();
+
+int prof_write_trace(const char *path);
+
+#endif // _INFLUENCE_PROFILE_H_
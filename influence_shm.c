@@ -0,0 +1,190 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "influence_shm.h"
+#include "influence_time.h"
+
+static void futex_wait(unsigned int *addr, unsigned int val, int timeout_ms)
+{
+#ifdef __linux__
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, 0, 0);
+#else
+    // no futexes; nap briefly and let the caller check again
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val)
+        usleep(100);
+#endif
+}
+
+static void futex_wake(unsigned int *addr)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#endif
+}
+
+static struct _shmTable *map_table(const char *name, int create)
+{
+    /* A table left by a crashed server is unlinked rather than truncated,
+     * so agents still mapping it keep valid memory instead of faulting. */
+    if (create)
+        shm_unlink(name);
+    int fd = shm_open(name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR,
+                      0666);
+    if (fd < 0)
+        return 0;
+    if (create && ftruncate(fd, sizeof(struct _shmTable))) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(0, sizeof(struct _shmTable), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? 0 : (struct _shmTable*)map;
+}
+
+struct _shmTable *shmt_create(const char *name)
+{
+    struct _shmTable *t = map_table(name, 1);
+    if (!t) {
+        printf("Could not create shared memory %s\n", name);
+        return 0;
+    }
+    memset(t, 0, sizeof(struct _shmTable));
+    t->num_slots = SHM_SLOTS;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(t->magic, SHM_MAGIC, 8);
+    printf("Serving local agents through shared memory %s\n", name);
+    return t;
+}
+
+void shmt_destroy(struct _shmTable *t, const char *name)
+{
+    if (!t)
+        return;
+    // wake anyone still waiting so they notice the server is gone
+    memset(t->magic, 0, 8);
+    __atomic_add_fetch(&t->tick, 1, __ATOMIC_RELEASE);
+    futex_wake(&t->tick);
+    munmap(t, sizeof(struct _shmTable));
+    shm_unlink(name);
+}
+
+void shmt_write_observation(struct _shmSlot *s, int tick, const float *obs)
+{
+    __atomic_store_n(&s->obs_seq, s->obs_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->obs_tick = tick;
+    s->obs[0] = obs[0];
+    s->obs[1] = obs[1];
+    s->obs[2] = obs[2];
+    s->obs_time = itime_now();
+    __atomic_store_n(&s->obs_seq, s->obs_seq + 1, __ATOMIC_RELEASE);
+}
+
+void shmt_wake(struct _shmTable *t)
+{
+    __atomic_add_fetch(&t->tick, 1, __ATOMIC_RELEASE);
+    futex_wake(&t->tick);
+}
+
+int shmt_read_position(struct _shmSlot *s, unsigned int *seen, float *pos)
+{
+    unsigned int seq = __atomic_load_n(&s->pos_seq, __ATOMIC_ACQUIRE);
+    if (seq == *seen || (seq & 1))
+        return 0;
+    pos[0] = s->pos[0];
+    pos[1] = s->pos[1];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->pos_seq, __ATOMIC_RELAXED) != seq)
+        return 0;
+    *seen = seq;
+    return 1;
+}
+
+struct _shmTable *shmt_attach(const char *name)
+{
+    struct _shmTable *t = map_table(name, 0);
+    if (t && memcmp(t->magic, SHM_MAGIC, 8)) {
+        munmap(t, sizeof(struct _shmTable));
+        return 0;
+    }
+    return t;
+}
+
+void shmt_detach(struct _shmTable *t)
+{
+    if (t)
+        munmap(t, sizeof(struct _shmTable));
+}
+
+int shmt_claim(struct _shmTable *t)
+{
+    int i, pid = getpid();
+    for (i = 0; i < t->num_slots; i++) {
+        int free_slot = 0;
+        if (__atomic_compare_exchange_n(&t->slots[i].claimed, &free_slot,
+                                        pid, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+            return i;
+    }
+    return -1;
+}
+
+void shmt_release(struct _shmTable *t, int slot)
+{
+    __atomic_store_n(&t->slots[slot].claimed, 0, __ATOMIC_RELEASE);
+}
+
+void shmt_write_position(struct _shmSlot *s, const float *pos)
+{
+    __atomic_store_n(&s->pos_seq, s->pos_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->pos[0] = pos[0];
+    s->pos[1] = pos[1];
+    s->pos_time = itime_now();
+    __atomic_store_n(&s->pos_seq, s->pos_seq + 1, __ATOMIC_RELEASE);
+}
+
+int shmt_wait_observation(struct _shmTable *t, int slot, int last_tick,
+                          int timeout_ms, float *obs)
+{
+    struct _shmSlot *s = &t->slots[slot];
+    double deadline = itime_now() + timeout_ms / 1000.0;
+
+    while (1) {
+        // read the tick word first so a wake-up between the check and
+        // the wait is not lost
+        unsigned int tick = __atomic_load_n(&t->tick, __ATOMIC_ACQUIRE);
+        unsigned int seq = __atomic_load_n(&s->obs_seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1) && s->obs_tick > last_tick) {
+            int obs_tick = s->obs_tick;
+            obs[0] = s->obs[0];
+            obs[1] = s->obs[1];
+            obs[2] = s->obs[2];
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->obs_seq, __ATOMIC_RELAXED) == seq)
+                return obs_tick;
+            continue;
+        }
+
+        int remaining = (int)((deadline - itime_now()) * 1000);
+        if (remaining <= 0)
+            return -1;
+        futex_wait(&t->tick, tick, remaining);
+    }
+}
@@ -0,0 +1,77 @@
+
+#ifndef _INFLUENCE_SHM_H_
+#define _INFLUENCE_SHM_H_
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Observation/position table in POSIX shared memory for agents running
+ * on the same host as the server.  Each agent claims a slot, writes its
+ * position there and sleeps on the table's tick counter; the server
+ * fills every slot's observation once per tick and wakes all waiting
+ * agents with a single futex call.  libmapper is still used for
+ * discovery and for remote agents. */
+
+#define SHM_MAGIC "INFLSHM1"
+#define SHM_SLOTS 16
+#define SHM_DEFAULT_NAME "/influence.agents"
+
+struct _shmSlot
+{
+    // written by the agent; pos_seq is odd while pos is being written
+    int             claimed;    // pid of the owner, or 0
+    unsigned int    pos_seq;
+    float           pos[2];
+    double          pos_time;
+    char            pad1[40];
+
+    // written by the server, on its own cache line
+    unsigned int    obs_seq;
+    int             obs_tick;
+    float           obs[3];
+    double          obs_time;
+    char            pad2[32];
+};
+
+struct _shmTable
+{
+    char            magic[8];
+    int             num_slots;
+    unsigned int    tick;       // futex word, bumped after each tick
+    char            pad[48];
+    struct _shmSlot slots[SHM_SLOTS];
+};
+
+// Server side
+struct _shmTable *shmt_create(const char *name);
+void shmt_destroy(struct _shmTable *t, const char *name);
+
+// Publishes one observation; call shmt_wake() once all are written.
+void shmt_write_observation(struct _shmSlot *s, int tick, const float *obs);
+void shmt_wake(struct _shmTable *t);
+
+// Copies a new position if the agent wrote one since *seen.
+int shmt_read_position(struct _shmSlot *s, unsigned int *seen, float *pos);
+
+// Agent side
+struct _shmTable *shmt_attach(const char *name);
+void shmt_detach(struct _shmTable *t);
+
+// Claims a free slot, returning its index or -1.
+int shmt_claim(struct _shmTable *t);
+void shmt_release(struct _shmTable *t, int slot);
+
+void shmt_write_position(struct _shmSlot *s, const float *pos);
+
+/* Sleeps until the slot's observation is from a tick later than
+ * last_tick or timeout_ms passes.  Returns the observation's tick, or -1
+ * on timeout. */
+int shmt_wait_observation(struct _shmTable *t, int slot, int last_tick,
+                          int timeout_ms, float *obs);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // _INFLUENCE_SHM_H_
@@ -0,0 +1,63 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "influence_tenant.h"
+
+struct _tenant *tenant_new(const char *name, int width, int height,
+                           int passes)
+{
+    struct _tenant *t = (struct _tenant*)calloc(1, sizeof(struct _tenant));
+    int i;
+    strncpy(t->name, name, TENANT_NAME - 1);
+    t->field = vfcpu_new(width, height);
+    t->passes = passes;
+    for (i=0; i < TENANT_AGENTS; i++)
+        t->agents[i].gain = 1;
+    return t;
+}
+
+void tenant_free(struct _tenant *t)
+{
+    if (!t)
+        return;
+    vfcpu_free(t->field);
+    free(t);
+}
+
+int tenant_parse(const char *spec, char *name, int *size, int *passes)
+{
+    const char *colon = strchr(spec, ':');
+    int length = colon ? colon - spec : strlen(spec);
+    if (!length || length >= TENANT_NAME)
+        return 0;
+    memcpy(name, spec, length);
+    name[length] = 0;
+    if (!colon)
+        return 1;
+    *size = atoi(colon + 1);
+    colon = strchr(colon + 1, ':');
+    if (colon)
+        *passes = atoi(colon + 1);
+    return 1;
+}
+
+void tenant_step_all(struct _tenant **tenants, int count)
+{
+    int i, j, pass;
+    for (i=0; i < count; i++) {
+        struct _tenant *t = tenants[i];
+        for (pass=0; pass < t->passes; pass++) {
+            vfcpu_begin_pass(t->field);
+            for (j=0; j < TENANT_AGENTS; j++) {
+                struct _tenantAgent *a = &t->agents[j];
+                if (a->active)
+                    vfcpu_draw_agent(t->field, a->pos[0], a->pos[1],
+                                     a->gain, a->fade, a->obs);
+            }
+            vfcpu_convolve(t->field);
+        }
+        t->tick++;
+    }
+}
@@ -0,0 +1,57 @@
+
+#ifndef _INFLUENCE_TENANT_H_
+#define _INFLUENCE_TENANT_H_
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include "influence_cpu.h"
+
+/* Several independent fields hosted by one process.  Each tenant is a
+ * named field on the CPU engine with its own agents and parameters; the
+ * host steps all of them once per tick, so one timer and one loop serve
+ * every scene.  Nothing is shared between the fields' computations: K
+ * tenants cost K times the CPU of one, so this suits small rehearsal
+ * fields rather than full-size scenes.  libmapper is left to the host,
+ * which gives each tenant its own device. */
+
+#define TENANT_AGENTS 50
+#define TENANT_NAME 64
+
+struct _tenantAgent
+{
+    int     active;
+    float   pos[2];
+    float   gain;
+    float   fade;
+    float   obs[3];
+};
+
+struct _tenant
+{
+    char                name[TENANT_NAME];
+    struct _vfcpu_field *field;
+    struct _tenantAgent agents[TENANT_AGENTS];
+    int                 passes;
+    int                 tick;
+    void               *user;          // the host's per-tenant state
+};
+
+struct _tenant *tenant_new(const char *name, int width, int height,
+                           int passes);
+void tenant_free(struct _tenant *t);
+
+/* Parses "name[:size[:passes]]", as given to fieldhost -F, filling in
+ * whatever is given.  Returns 0 if the name is empty or too long. */
+int tenant_parse(const char *spec, char *name, int *size, int *passes);
+
+/* Runs one tick of every tenant, each one's passes in turn so its field
+ * stays in cache between them. */
+void tenant_step_all(struct _tenant **tenants, int count);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // _INFLUENCE_TENANT_H_
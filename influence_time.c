@@ -0,0 +1,27 @@
+
+#include <sys/time.h>
+
+#include "influence_time.h"
+
+double itime_now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int itime_bin(double seconds, int num_bins)
+{
+    int bin;
+    // clamp before converting so a stalled run lands in the last bin
+    double us = seconds * 1000000;
+    unsigned long long n = us < 1 ? 0 : us > 1e18 ? 1e18 : us;
+    for (bin=0; n > 1 && bin < num_bins - 1; bin++)
+        n >>= 1;
+    return bin;
+}
+
+double itime_bin_ms(int bin)
+{
+    return (1ULL << (bin + 1)) / 1000.0;
+}
@@ -0,0 +1,26 @@
+#ifndef _INFLUENCE_TIME_H_
+#define _INFLUENCE_TIME_H_
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* Wall-clock time and log2 latency histograms shared by the server, the
+ * agents and the benchmarks.  Times are comparable between processes on
+ * the same host, so one side can stamp a frame or an observation and the
+ * other can measure how long it took to arrive. */
+
+double itime_now();
+
+/* Histogram bin of a latency: bin i counts [2^i, 2^(i+1)) us, with
+ * anything longer in the last of num_bins. */
+int itime_bin(double seconds, int num_bins);
+
+// Upper edge in ms of a bin.
+double itime_bin_ms(int bin);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif // _INFLUENCE_TIME_H_
@@ -0,0 +1,794 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <mapper/mapper.h>
+
+#include "influence_tenant.h"
+#include "influence_time.h"
+
+/* Synthetic load for the influence server.  Drives simulated agents
+ * along a motion pattern, either against a running server over libmapper
+ * or against an embedded CPU field (-e), and writes one CSV row per
+ * configuration of the sweep so runs can be compared over time.
+ *
+ * Frame time is the interval between ticks seen by the agents when
+ * connected, and the time spent computing a tick when embedded.
+ * Latency is from an agent publishing a position to it receiving the
+ * next observation.
+ *
+ * With -K, each embedded configuration is also run as K scenes hosted
+ * in one process, as fieldhost does, and as K processes with one scene
+ * each, reported as modes hosted-K and forked-K. */
+
+#define MAX_AGENTS  TENANT_AGENTS
+#define MAX_SWEEP   16
+#define MAX_SAMPLES (1 << 20)
+
+enum { MOTION_STATIC, MOTION_WALK, MOTION_CIRCLE, MOTION_LISSAJOUS };
+const char *motion_names[] = {"static", "walk", "circle", "lissajous", 0};
+
+// Options
+int agent_counts[MAX_SWEEP] = {10};
+int num_agent_counts = 1;
+int sizes[MAX_SWEEP] = {500};
+int num_sizes = 1;
+int passes[MAX_SWEEP] = {1};
+int num_passes = 1;
+int tenant_counts[MAX_SWEEP];
+int num_tenant_counts = 0;
+float rate = 50;
+int motion = MOTION_WALK;
+float agent_gain = 1;
+float agent_fade = 0;
+double duration = 10;
+double warmup = 1;
+int embedded = 0;
+float server_rate = 100;
+const char *influence_name = "/influence.1";
+int server_pid = 0;
+FILE *out = 0;
+
+struct _simAgent
+{
+    float   pos[2];     // normalised to [0,1]
+    float   vel[2];
+    double  sent;       // time of the oldest unanswered position, or 0
+} sim[MAX_AGENTS];
+
+struct _samples
+{
+    double *value;
+    int     count;
+} frame_times, latencies;
+
+struct _result
+{
+    double  elapsed;
+    int     ticks;
+    double  frame[3];   // p50, p90 and p99 in ms
+    double  latency[2]; // p50 and p99 in ms
+    int     observations;
+    double  cpu;
+    double  server_cpu; // or -1 if unknown
+};
+
+// Connected mode
+mapper_admin admin = 0;
+mapper_device dev = 0;
+mapper_monitor mon = 0;
+mapper_db db = 0;
+mapper_signal sig_pos, sig_fade, sig_obs, sig_tick;
+mapper_signal sig_field_size, sig_field_passes;
+int linked = 0;
+int observations = 0;
+int measuring = 0;
+int first_tick = -1;
+int last_tick = -1;
+double last_tick_time = 0;
+
+int done = 0;
+
+double cpu_seconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0
+           + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+// CPU seconds used so far by another process, or -1 if unknown.
+double process_cpu_seconds(int pid)
+{
+#ifdef __linux__
+    char path[64];
+    unsigned long utime, stime;
+    sprintf(path, "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    // skip pid, comm and the 11 fields before utime
+    int n = fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                   "%lu %lu", &utime, &stime);
+    fclose(f);
+    if (n == 2)
+        return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+#endif
+    return -1;
+}
+
+void add_sample(struct _samples *s, double value)
+{
+    if (s->count < MAX_SAMPLES)
+        s->value[s->count++] = value;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double d = *(const double*)a - *(const double*)b;
+    return d < 0 ? -1 : d > 0;
+}
+
+// Percentile in ms; the samples must be sorted.
+double percentile(struct _samples *s, double p)
+{
+    if (!s->count)
+        return 0;
+    int i = (int)(p * s->count);
+    if (i >= s->count)
+        i = s->count - 1;
+    return s->value[i] * 1000;
+}
+
+void reset_agents(int n)
+{
+    int i;
+    srand(100);
+    for (i=0; i < n; i++) {
+        sim[i].pos[0] = rand() % 1000 * 0.001;
+        sim[i].pos[1] = rand() % 1000 * 0.001;
+        sim[i].vel[0] = sim[i].vel[1] = 0;
+        sim[i].sent = 0;
+    }
+}
+
+void move_agent(int i, int n, double t, double dt)
+{
+    struct _simAgent *a = &sim[i];
+    double phase = 2 * M_PI * i / n, w = 2 * M_PI * 0.2;
+    int j;
+
+    switch (motion) {
+    case MOTION_STATIC:
+        break;
+    case MOTION_WALK:
+        for (j=0; j < 2; j++) {
+            a->vel[j] = a->vel[j] * 0.98 + (rand() % 1000 * 0.002 - 1) * dt;
+            a->pos[j] += a->vel[j] * dt;
+            if (a->pos[j] < 0 || a->pos[j] >= 1) {
+                a->pos[j] = a->pos[j] < 0 ? 0 : 0.999;
+                a->vel[j] *= -1;
+            }
+        }
+        break;
+    case MOTION_CIRCLE:
+        a->pos[0] = 0.5 + 0.35 * cos(w * t + phase);
+        a->pos[1] = 0.5 + 0.35 * sin(w * t + phase);
+        break;
+    case MOTION_LISSAJOUS:
+        a->pos[0] = 0.5 + 0.4 * sin(3 * w * t + phase);
+        a->pos[1] = 0.5 + 0.4 * sin(2 * w * t);
+        break;
+    }
+}
+
+void summarise(struct _result *r, double elapsed, int ticks, double cpu,
+               double server_cpu)
+{
+    qsort(frame_times.value, frame_times.count, sizeof(double),
+          compare_doubles);
+    qsort(latencies.value, latencies.count, sizeof(double),
+          compare_doubles);
+    r->elapsed = elapsed;
+    r->ticks = ticks;
+    r->frame[0] = percentile(&frame_times, 0.5);
+    r->frame[1] = percentile(&frame_times, 0.9);
+    r->frame[2] = percentile(&frame_times, 0.99);
+    r->latency[0] = percentile(&latencies, 0.5);
+    r->latency[1] = percentile(&latencies, 0.99);
+    r->observations = latencies.count;
+    r->cpu = cpu;
+    r->server_cpu = server_cpu;
+}
+
+void report(const char *mode, int n, int size, int p, struct _result *r)
+{
+    fprintf(out, "%s,%d,%d,%d,%s,%g,%g,%d,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+            "%d,%.1f,%.1f\n", mode, n, size, p, motion_names[motion], rate,
+            r->elapsed, r->ticks, r->ticks / r->elapsed, r->frame[0],
+            r->frame[1], r->frame[2], r->latency[0], r->latency[1],
+            r->observations, r->cpu / r->elapsed * 100,
+            r->server_cpu < 0 ? -1 : r->server_cpu / r->elapsed * 100);
+    fflush(out);
+}
+
+/* Embedded: the server loop of influence.c on the CPU engine, ticking at
+ * server_rate (or flat out if 0), with the agents publishing at rate.
+ * Every tick steps k scenes driven by the same agents.  Returns 0 if
+ * interrupted before measuring. */
+int embedded_loop(int k, int n, int size, int p, struct _result *r)
+{
+    struct _tenant *tenants[MAX_SWEEP];
+    int i, j, ticks = 0;
+    double cpu = 0, t, t0 = 0;
+
+    for (j=0; j < k; j++) {
+        tenants[j] = tenant_new("loadgen", size, size, p);
+        tenants[j]->field->border_gain = 5;
+        for (i=0; i < n; i++) {
+            tenants[j]->agents[i].active = 1;
+            tenants[j]->agents[i].gain = agent_gain;
+            tenants[j]->agents[i].fade = agent_fade;
+        }
+    }
+    reset_agents(n);
+    frame_times.count = latencies.count = 0;
+
+    double start = itime_now(), measure = start + warmup;
+    double end = measure + duration;
+    double next_move = start, next_tick = start;
+    measuring = 0;
+
+    while (!done && (t = itime_now()) < end) {
+        if (!measuring && t >= measure) {
+            measuring = 1;
+            cpu = cpu_seconds();
+            t0 = t;
+            ticks = 0;
+        }
+        while (t >= next_move) {
+            for (i=0; i < n; i++) {
+                move_agent(i, n, next_move - start, 1.0 / rate);
+                if (!sim[i].sent)
+                    sim[i].sent = next_move;
+            }
+            next_move += 1.0 / rate;
+        }
+
+        for (j=0; j < k; j++) {
+            for (i=0; i < n; i++) {
+                tenants[j]->agents[i].pos[0] = sim[i].pos[0] * size;
+                tenants[j]->agents[i].pos[1] = sim[i].pos[1] * size;
+            }
+        }
+        tenant_step_all(tenants, k);
+
+        double tick_end = itime_now();
+        if (measuring) {
+            add_sample(&frame_times, tick_end - t);
+            for (i=0; i < n; i++) {
+                if (sim[i].sent)
+                    add_sample(&latencies, tick_end - sim[i].sent);
+            }
+            ticks++;
+        }
+        for (i=0; i < n; i++)
+            sim[i].sent = 0;
+
+        if (server_rate > 0) {
+            next_tick += 1.0 / server_rate;
+            double wait = next_tick - itime_now();
+            if (wait > 0)
+                usleep(wait * 1000000);
+            else if (wait < -0.25)
+                next_tick = itime_now();
+        }
+    }
+
+    if (measuring)
+        summarise(r, itime_now() - t0, ticks, cpu_seconds() - cpu, -1);
+    for (j=0; j < k; j++)
+        tenant_free(tenants[j]);
+    return measuring;
+}
+
+void run_embedded(int n, int size, int p)
+{
+    struct _result r;
+    if (embedded_loop(1, n, size, p, &r))
+        report("embedded", n, size, p, &r);
+}
+
+// k scenes stepped one after another in this process
+void run_hosted(int k, int n, int size, int p)
+{
+    struct _result r;
+    char mode[32];
+    if (!embedded_loop(k, n, size, p, &r))
+        return;
+    // every scene answered each sampled agent
+    r.observations *= k;
+    sprintf(mode, "hosted-%d", k);
+    report(mode, n, size, p, &r);
+}
+
+/* k processes with one scene each, started together.  Ticks and CPU are
+ * summed, so tick_rate is per scene as for hosted-k, and the slowest
+ * process's percentiles are reported. */
+void run_forked(int k, int n, int size, int p)
+{
+    struct _result r, sum;
+    char mode[32];
+    int i, fds[2], reported = 0;
+
+    if (pipe(fds)) {
+        perror("pipe");
+        return;
+    }
+    fflush(out);
+    for (i=0; i < k; i++) {
+        if (fork() == 0) {
+            close(fds[0]);
+            if (embedded_loop(1, n, size, p, &r)
+                && write(fds[1], &r, sizeof(r)) != sizeof(r))
+                perror("write");
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+
+    memset(&sum, 0, sizeof(sum));
+    while (read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+        sum.ticks += r.ticks;
+        sum.observations += r.observations;
+        sum.cpu += r.cpu;
+        if (r.elapsed > sum.elapsed)
+            sum.elapsed = r.elapsed;
+        for (i=0; i < 3; i++)
+            if (r.frame[i] > sum.frame[i])
+                sum.frame[i] = r.frame[i];
+        for (i=0; i < 2; i++)
+            if (r.latency[i] > sum.latency[i])
+                sum.latency[i] = r.latency[i];
+        reported++;
+    }
+    close(fds[0]);
+    while (wait(0) > 0) {}
+
+    if (reported < k)
+        return;
+    sum.ticks /= k;
+    sum.server_cpu = -1;
+    sprintf(mode, "forked-%d", k);
+    report(mode, n, size, p, &sum);
+}
+
+void on_observation(mapper_signal msig,
+                    mapper_db_signal props,
+                    int instance_id,
+                    void *value,
+                    int count,
+                    mapper_timetag_t *timetag)
+{
+    if (!value || instance_id < 0 || instance_id >= MAX_AGENTS)
+        return;
+    observations++;
+    if (measuring && sim[instance_id].sent)
+        add_sample(&latencies, itime_now() - sim[instance_id].sent);
+    sim[instance_id].sent = 0;
+}
+
+void on_tick(mapper_signal msig,
+             mapper_db_signal props,
+             int instance_id,
+             void *value,
+             int count,
+             mapper_timetag_t *timetag)
+{
+    if (!value)
+        return;
+    int tick = *(int*)value;
+    if (tick <= last_tick)
+        return;
+
+    double now = itime_now();
+    if (measuring) {
+        if (first_tick < 0)
+            first_tick = tick;
+        else
+            add_sample(&frame_times,
+                       (now - last_tick_time) / (tick - last_tick));
+    }
+    last_tick = tick;
+    last_tick_time = now;
+}
+
+void make_connections()
+{
+    char src[1024], dest[1024];
+
+    sprintf(src, "%s/position", mdev_name(dev));
+    sprintf(dest, "%s/node/position", influence_name);
+    mapper_monitor_connect(mon, src, dest, 0, 0);
+
+    sprintf(src, "%s/fade", mdev_name(dev));
+    sprintf(dest, "%s/node/fade", influence_name);
+    mapper_monitor_connect(mon, src, dest, 0, 0);
+
+    sprintf(src, "%s/node/observation", influence_name);
+    sprintf(dest, "%s/observation", mdev_name(dev));
+    mapper_monitor_connect(mon, src, dest, 0, 0);
+
+    sprintf(src, "%s/node/observation/tick", influence_name);
+    sprintf(dest, "%s/tick", mdev_name(dev));
+    mapper_monitor_connect(mon, src, dest, 0, 0);
+
+    sprintf(src, "%s/field/size", mdev_name(dev));
+    sprintf(dest, "%s/field/size", influence_name);
+    mapper_monitor_connect(mon, src, dest, 0, 0);
+
+    sprintf(src, "%s/field/passes", mdev_name(dev));
+    sprintf(dest, "%s/field/passes", influence_name);
+    mapper_monitor_connect(mon, src, dest, 0, 0);
+}
+
+void dev_db_callback(mapper_db_device record,
+                     mapper_db_action_t action,
+                     void *user)
+{
+    if (action != MDB_NEW || strcmp(record->name, influence_name))
+        return;
+
+    mapper_db_link_t props;
+    char *name = (char*)mdev_name(dev);
+    props.num_scopes = 1;
+    props.scope_names = &name;
+    mapper_monitor_link(mon, mdev_name(dev), record->name, 0, 0);
+    mapper_monitor_link(mon, record->name, mdev_name(dev),
+                        &props, LINK_NUM_SCOPES | LINK_SCOPE_NAMES);
+}
+
+void link_db_callback(mapper_db_link record,
+                      mapper_db_action_t action,
+                      void *user)
+{
+    if (action != MDB_NEW)
+        return;
+    if (!strcmp(record->dest_name, influence_name)
+        && !strcmp(record->src_name, mdev_name(dev)))
+        linked |= 0x01;
+    else if (!strcmp(record->src_name, influence_name)
+             && !strcmp(record->dest_name, mdev_name(dev)))
+        linked |= 0x02;
+    else
+        return;
+    if (linked == 0x03)
+        make_connections();
+}
+
+int connect_server()
+{
+    float mn = 0, mx = 1;
+
+    admin = mapper_admin_new(0, 0, 0);
+    dev = mdev_new("loadgen", 0, admin);
+    while (!mdev_ready(dev))
+        mdev_poll(dev, 100);
+
+    mon = mapper_monitor_new(admin, 0);
+    db = mapper_monitor_get_db(mon);
+    mapper_db_add_device_callback(db, dev_db_callback, 0);
+    mapper_db_add_link_callback(db, link_db_callback, 0);
+
+    sig_pos = mdev_add_output(dev, "position", 2, 'f', 0, &mn, &mx);
+    msig_reserve_instances(sig_pos, MAX_AGENTS-1, 0, 0);
+    mx = 0.9;
+    sig_fade = mdev_add_output(dev, "fade", 1, 'f', 0, &mn, &mx);
+    msig_reserve_instances(sig_fade, MAX_AGENTS-1, 0, 0);
+
+    mn = -1;
+    mx = 1;
+    sig_obs = mdev_add_input(dev, "observation", 2, 'f', 0, &mn, &mx,
+                             on_observation, 0);
+    msig_reserve_instances(sig_obs, MAX_AGENTS-1, 0, 0);
+    sig_tick = mdev_add_input(dev, "tick", 1, 'i', 0, 0, 0, on_tick, 0);
+    msig_reserve_instances(sig_tick, MAX_AGENTS-1, 0, 0);
+
+    sig_field_size = mdev_add_output(dev, "field/size", 2, 'i', 0, 0, 0);
+    sig_field_passes = mdev_add_output(dev, "field/passes", 1, 'i', 0, 0, 0);
+
+    // publish one agent until the server answers
+    reset_agents(1);
+    msig_update_instance(sig_pos, 0, sim[0].pos, 1, MAPPER_NOW);
+    double deadline = itime_now() + 10;
+    while (!done && !observations && itime_now() < deadline) {
+        mapper_monitor_poll(mon, 0);
+        mdev_poll(dev, 50);
+        msig_update_instance(sig_pos, 0, sim[0].pos, 1, MAPPER_NOW);
+    }
+    if (!observations) {
+        fprintf(stderr, "loadgen: no observations from %s, "
+                "is influence running?\n", influence_name);
+        return 1;
+    }
+    return 0;
+}
+
+void disconnect_server()
+{
+    int i;
+    for (i=0; i < MAX_AGENTS; i++) {
+        msig_release_instance(sig_pos, i, MAPPER_NOW);
+        msig_release_instance(sig_fade, i, MAPPER_NOW);
+    }
+    mdev_poll(dev, 100);
+    if (mon) {
+        mapper_monitor_unlink(mon, influence_name, mdev_name(dev));
+        mapper_db_remove_device_callback(db, dev_db_callback, 0);
+        mapper_db_remove_link_callback(db, link_db_callback, 0);
+        mapper_monitor_free(mon);
+    }
+    mdev_free(dev);
+    mapper_admin_free(admin);
+}
+
+/* Connected: n agents publish positions at rate against the running
+ * server.  The server is resized through /field/size and set to p passes
+ * through /field/passes during the warm-up, which also lets it settle. */
+void run_connected(int n, int size, int p)
+{
+    int i;
+    mapper_timetag_t tt;
+    double cpu = 0, server_cpu = -1, t, t0 = 0;
+    int field_size[2] = {size, size};
+
+    reset_agents(n);
+    frame_times.count = latencies.count = 0;
+    first_tick = -1;
+    measuring = 0;
+
+    for (i=0; i < MAX_AGENTS; i++) {
+        if (i < n)
+            msig_update_instance(sig_fade, i, &agent_fade, 1, MAPPER_NOW);
+        else {
+            msig_release_instance(sig_pos, i, MAPPER_NOW);
+            msig_release_instance(sig_fade, i, MAPPER_NOW);
+        }
+    }
+
+    double start = itime_now(), measure = start + warmup;
+    double end = measure + duration, next_move = start;
+
+    while (!done && (t = itime_now()) < end) {
+        if (!measuring && t >= measure) {
+            measuring = 1;
+            cpu = cpu_seconds();
+            if (server_pid)
+                server_cpu = process_cpu_seconds(server_pid);
+            t0 = t;
+        }
+        if (t >= next_move) {
+            mdev_now(dev, &tt);
+            mdev_start_queue(dev, tt);
+            if (!measuring) {
+                // repeated through the warm-up in case one is lost
+                msig_update(sig_field_size, field_size, 1, tt);
+                msig_update(sig_field_passes, &p, 1, tt);
+            }
+            for (i=0; i < n; i++) {
+                move_agent(i, n, next_move - start, 1.0 / rate);
+                msig_update_instance(sig_pos, i, sim[i].pos, 1, tt);
+                if (!sim[i].sent)
+                    sim[i].sent = t;
+            }
+            mdev_send_queue(dev, tt);
+            next_move += 1.0 / rate;
+            if (next_move < t)
+                next_move = t + 1.0 / rate;
+        }
+        mapper_monitor_poll(mon, 0);
+        mdev_poll(dev, (int)((next_move - itime_now()) * 1000));
+    }
+
+    if (!measuring)
+        return;
+    double elapsed = itime_now() - t0;
+    if (server_cpu >= 0)
+        server_cpu = process_cpu_seconds(server_pid) - server_cpu;
+    struct _result r;
+    summarise(&r, elapsed, first_tick < 0 ? 0 : last_tick - first_tick,
+              cpu_seconds() - cpu, server_cpu);
+    report("connected", n, size, p, &r);
+}
+
+int parse_list(const char *arg, int *list)
+{
+    int n = 0;
+    while (arg && n < MAX_SWEEP) {
+        list[n++] = atoi(arg);
+        arg = strchr(arg, ',');
+        if (arg)
+            arg++;
+    }
+    return n;
+}
+
+void ctrlc(int sig)
+{
+    done = 1;
+}
+
+void CmdLine(int argc, char **argv)
+{
+    int c, i;
+    while ((c = getopt(argc, argv, "hn:s:p:r:m:g:f:d:w:eu:K:i:P:o:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: loadgen [-h] [-n <agents>] [-s <sizes>] "
+                   "[-p <passes>] [-r <rate>] [-m <motion>]\n"
+                   "               [-g <gain>] [-f <fade>] [-d <seconds>] "
+                   "[-w <seconds>] [-e [-u <rate>] [-K <scenes>]]\n"
+                   "               [-i <device>] [-P <pid>] [-o <file>]\n");
+            printf("  -h  Help\n");
+            printf("  -n  Agent counts to sweep, e.g. 1,10,50, "
+                   "default=10\n");
+            printf("  -s  Field sizes to sweep, default=500\n");
+            printf("  -p  Passes per frame to sweep, default=1\n");
+            printf("      (connected, both are set on the server)\n");
+            printf("  -r  Agent update rate in Hz, default=%g\n", rate);
+            printf("  -m  Motion: static, walk, circle or lissajous, "
+                   "default=walk\n");
+            printf("  -g  Agent gain, embedded only, default=%g\n",
+                   agent_gain);
+            printf("  -f  Agent fade, default=%g\n", agent_fade);
+            printf("  -d  Seconds measured per configuration, "
+                   "default=%g\n", duration);
+            printf("  -w  Warm-up seconds before measuring, default=%g\n",
+                   warmup);
+            printf("  -e  Embedded CPU server instead of a running one\n");
+            printf("  -u  Embedded server ticks per second, 0 for as fast "
+                   "as possible,\n      default=%g\n", server_rate);
+            printf("  -K  Scene counts to sweep, each run in one process "
+                   "and in that\n      many processes, e.g. 1,2,4\n");
+            printf("  -i  Server device, default=%s\n", influence_name);
+            printf("  -P  Server pid, to report its CPU use (Linux)\n");
+            printf("  -o  Append CSV rows to <file> instead of stdout\n");
+            exit(0);
+        case 'n':
+            num_agent_counts = parse_list(optarg, agent_counts);
+            break;
+        case 's':
+            num_sizes = parse_list(optarg, sizes);
+            break;
+        case 'p':
+            num_passes = parse_list(optarg, passes);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'm':
+            for (i=0; motion_names[i]; i++)
+                if (!strcmp(optarg, motion_names[i]))
+                    break;
+            if (!motion_names[i]) {
+                printf("loadgen: Unknown motion `%s'.\n", optarg);
+                exit(1);
+            }
+            motion = i;
+            break;
+        case 'g':
+            agent_gain = atof(optarg);
+            break;
+        case 'f':
+            agent_fade = atof(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'w':
+            warmup = atof(optarg);
+            break;
+        case 'e':
+            embedded = 1;
+            break;
+        case 'u':
+            server_rate = atof(optarg);
+            break;
+        case 'K':
+            num_tenant_counts = parse_list(optarg, tenant_counts);
+            break;
+        case 'i':
+            influence_name = optarg;
+            break;
+        case 'P':
+            server_pid = atoi(optarg);
+            break;
+        case 'o':
+            out = fopen(optarg, "a");
+            if (!out) {
+                printf("loadgen: Could not open `%s'.\n", optarg);
+                exit(1);
+            }
+            break;
+        case '?': // Unknown
+            printf("loadgen: Bad options, use -h for help.\n");
+            exit(1);
+            break;
+        default:
+            abort();
+        }
+    }
+    if (rate <= 0)
+        rate = 50;
+    for (i=0; i < num_agent_counts; i++) {
+        if (agent_counts[i] < 1)
+            agent_counts[i] = 1;
+        if (agent_counts[i] > MAX_AGENTS)
+            agent_counts[i] = MAX_AGENTS;
+    }
+    for (i=0; i < num_tenant_counts; i++) {
+        if (tenant_counts[i] < 1)
+            tenant_counts[i] = 1;
+        if (tenant_counts[i] > MAX_SWEEP)
+            tenant_counts[i] = MAX_SWEEP;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int a, s, p, k;
+    CmdLine(argc, argv);
+    signal(SIGINT, ctrlc);
+
+    if (!out)
+        out = stdout;
+    if (out == stdout || !ftell(out))
+        fprintf(out, "mode,agents,size,passes,motion,agent_rate,seconds,"
+                "ticks,tick_rate,frame_p50_ms,frame_p90_ms,frame_p99_ms,"
+                "latency_p50_ms,latency_p99_ms,observations,cpu_percent,"
+                "server_cpu_percent\n");
+
+    frame_times.value = (double*)malloc(sizeof(double) * MAX_SAMPLES);
+    latencies.value = (double*)malloc(sizeof(double) * MAX_SAMPLES);
+
+    if (embedded && num_tenant_counts) {
+        for (k=0; k < num_tenant_counts; k++)
+            for (s=0; s < num_sizes; s++)
+                for (p=0; p < num_passes; p++)
+                    for (a=0; a < num_agent_counts && !done; a++) {
+                        run_hosted(tenant_counts[k], agent_counts[a],
+                                   sizes[s], passes[p]);
+                        run_forked(tenant_counts[k], agent_counts[a],
+                                   sizes[s], passes[p]);
+                    }
+    }
+    else if (embedded) {
+        for (s=0; s < num_sizes; s++)
+            for (p=0; p < num_passes; p++)
+                for (a=0; a < num_agent_counts && !done; a++)
+                    run_embedded(agent_counts[a], sizes[s], passes[p]);
+    }
+    else {
+        if (connect_server())
+            return 1;
+        for (s=0; s < num_sizes; s++)
+            for (p=0; p < num_passes; p++)
+                for (a=0; a < num_agent_counts && !done; a++)
+                    run_connected(agent_counts[a], sizes[s], passes[p]);
+        disconnect_server();
+    }
+
+    free(frame_times.value);
+    free(latencies.value);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -3,8 +3,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <getopt.h>
+#include <math.h>
 #include <mapper/mapper.h>
 
+#include "agent_loop.h"
+
 struct _agentInfo
 {
     char *influence_device_name;
@@ -32,12 +36,17 @@ float gain = 0.0001;
 float damping = 0.6;
 float limit = 0.1;
 
+float rate = 1.0 / REFERENCE_STEP;
+int substeps = 1;
+
 #define WIDTH  500
 #define HEIGHT 500
 
 int numInstances = 1;
 int done = 0;
 
+struct _agentLoop loop;
+
 void make_influence_connections()
 {
     char signame1[1024], signame2[1024];
@@ -107,6 +116,8 @@ void force_handler(mapper_signal msig,
     accel[0] = paccel[0] + force[0] / mass * gain;
     accel[1] = paccel[1] + force[1] / mass * gain;
     msig_update_instance(sig, instance_id, &accel, 1, MAPPER_NOW);
+
+    aloop_observed(&loop);
 }
 
 void dev_db_callback(mapper_db_device record,
@@ -237,6 +248,9 @@ void agentLogout()
     }
     mdev_send_queue(info->dev, tt);
 
+    aloop_report(&loop);
+    aloop_free(&loop);
+
     if (info->influence_device_name) {
         mapper_monitor_unlink(info->mon,
                               info->influence_device_name,
@@ -262,11 +276,70 @@ void ctrlc(int sig)
     done = 1;
 }
 
+void integrate(float *accel, float *vel, float *pos, int steps, double step)
+{
+    int j, k;
+    float scale = step / REFERENCE_STEP;
+    float decay = pow(0.9, scale);
+
+    for (j = 0; j < 2; j++) {
+        // accumulated force is applied once as an impulse
+        accel[j] *= 0.9;
+        for (k = 0; k < steps; k++) {
+            vel[j] = vel[j] * decay + accel[j];
+            pos[j] += vel[j] * scale;
+            accel[j] = 0;
+
+            if (pos[j] < -1) {
+                pos[j] = -1;
+                vel[j] *= -0.95;
+            }
+            if (pos[j] >= 1) {
+                pos[j] = 1;
+                vel[j] *= -0.95;
+            }
+        }
+    }
+}
+
+void CmdLine(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "hr:s:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: passiveAgent [-h] [-r <rate>] [-s <substeps>] "
+                   "[instances]\n");
+            printf("  -h  Help\n");
+            printf("  -r  Output rate in Hz, default=%g\n", rate);
+            printf("  -s  Integration steps per output, default=%d\n"
+                   "      (observations are answered after one step)\n",
+                   substeps);
+            exit(0);
+        case 'r': // Rate
+            rate = atof(optarg);
+            break;
+        case 's': // Substeps
+            substeps = atoi(optarg);
+            break;
+        case '?': // Unknown
+            printf("passiveAgent: Bad options, use -h for help.\n");
+            exit(1);
+            break;
+        default:
+            abort();
+        }
+    }
+    if (optind < argc)
+        numInstances = atoi(argv[optind]);
+}
+
 int main(int argc, char *argv[])
 {
-    int i, j;
-    if (argc > 1)
-        numInstances = atoi(argv[1]);
+    int i, steps;
+    CmdLine(argc, argv);
 
     signal(SIGINT, ctrlc);
 
@@ -284,9 +357,12 @@ int main(int argc, char *argv[])
         mdev_poll(info->dev, 10);
     }
 
+    aloop_init(&loop, info->dev, info->mon, rate, substeps);
+
     while (!done) {
-        mapper_monitor_poll(info->mon, 0);
-        mdev_poll(info->dev, 20);
+        steps = aloop_wait(&loop);
+        if (!steps)
+            continue;
 
         mdev_now(info->dev, &tt);
         mdev_start_queue(info->dev, tt);
@@ -308,22 +384,10 @@ int main(int argc, char *argv[])
                 continue;
             }
 
-            for (j = 0; j < 2; j++) {
-                accel[j] = paccel[j] * 0.9;
-                vel[j] = pvel[j] * 0.9 + accel[j];
-                pos[j] = ppos[j] + vel[j];
-
-                if (pos[j] < -1) {
-                    pos[j] = -1;
-                    vel[j] *= -0.95;
-                }
-                if (pos[j] >= 1) {
-                    pos[j] = 1;
-                    vel[j] *= -0.95;
-                }
-
-                accel[j] = 0;
-            }
+            memcpy(accel, paccel, sizeof(accel));
+            memcpy(vel, pvel, sizeof(vel));
+            memcpy(pos, ppos, sizeof(pos));
+            integrate(accel, vel, pos, steps, loop.step);
 
             msig_update_instance(sig_accel_in, i, &accel, 1, tt);
             msig_update_instance(sig_accel_out, i, &accel, 1, tt);
@@ -333,6 +397,7 @@ int main(int argc, char *argv[])
             msig_update_instance(sig_pos_out, i, &pos, 1, tt);
         }
         mdev_send_queue(info->dev, tt);
+        aloop_published(&loop);
     }
 
 done:
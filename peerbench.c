@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <mapper/mapper.h>
+
+/* Startup benchmark for the proxyAgent peer registry.  The proxy's
+ * registry, planner and DB callbacks are linked against a simulated
+ * bus instead of libmapper: every Qualia agent and the influence server
+ * appear at once, and each link or connection request the proxy issues
+ * is answered with the DB record a monitor would deliver, after a
+ * configurable latency and with a configurable loss rate.
+ *
+ * Each agent count runs in its own process and writes one CSV row with
+ * the time from the devices appearing until every agent is linked and
+ * connected, the CPU time spent, and the requests issued. */
+
+#define MAX_SWEEP 16
+#define TIMEOUT   60.0
+
+// Options
+int agent_counts[MAX_SWEEP] = {10, 100, 1000};
+int num_agent_counts = 3;
+double latency = 0.001;
+double loss = 0;
+double with_reward = 1;
+
+// Provided by proxyAgent.c
+struct _agentInfo *agentInit();
+void plan_flush();
+void dev_db_callback(mapper_db_device, mapper_db_action_t, void*);
+void link_db_callback(mapper_db_link, mapper_db_action_t, void*);
+void connection_db_callback(mapper_db_connection, mapper_db_action_t, void*);
+double wall_clock();
+extern int num_qualia_ready;
+
+/* The simulated bus.  Events are delivered in the order they were
+ * raised once their time has come. */
+
+enum { EV_DEVICE, EV_SIGNAL, EV_LINK, EV_CONNECTION };
+
+struct _simEvent
+{
+    double due;
+    int type;
+    char *src;
+    char *dest;         // signal name, or 0 for devices
+    struct _simEvent *next;
+};
+
+struct _simEvent *events = 0, **events_tail = &events;
+char sim_storage[4];
+char sim_name[] = "/proxyAgent.1";
+char sim_host[] = "127.0.0.1";
+int sim_port = 9000;
+int requests = 0;
+int dropped = 0;
+
+mapper_db_device_handler *device_handler;
+mapper_db_signal_handler *signal_handler;
+mapper_db_link_handler *link_handler;
+mapper_db_connection_handler *connection_handler;
+void *device_user, *signal_user, *link_user, *connection_user;
+
+double cpu_seconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0
+         + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+void raise_event(int type, const char *src, const char *dest, double delay)
+{
+    struct _simEvent *ev = (struct _simEvent *)calloc(1, sizeof(*ev));
+    ev->due = wall_clock() + delay;
+    ev->type = type;
+    ev->src = strdup(src);
+    ev->dest = dest ? strdup(dest) : 0;
+    *events_tail = ev;
+    events_tail = &ev->next;
+}
+
+void answer_request(int type, const char *src, const char *dest)
+{
+    requests++;
+    if (loss > 0 && rand() < loss * RAND_MAX) {
+        dropped++;
+        return;
+    }
+    raise_event(type, src, dest, latency);
+}
+
+int deliver_events()
+{
+    double now = wall_clock();
+    int delivered = 0;
+
+    while (events && events->due <= now) {
+        struct _simEvent *ev = events;
+        if (!(events = ev->next))
+            events_tail = &events;
+
+        if (ev->type == EV_DEVICE) {
+            mapper_db_device_t record;
+            memset(&record, 0, sizeof(record));
+            record.name = ev->src;
+            device_handler(&record, MDB_NEW, device_user);
+        }
+        else if (ev->type == EV_SIGNAL) {
+            mapper_db_signal_t record;
+            memset(&record, 0, sizeof(record));
+            record.device_name = ev->src;
+            record.name = ev->dest;
+            signal_handler(&record, MDB_NEW, signal_user);
+        }
+        else if (ev->type == EV_LINK) {
+            mapper_db_link_t record;
+            memset(&record, 0, sizeof(record));
+            record.src_name = ev->src;
+            record.dest_name = ev->dest;
+            link_handler(&record, MDB_NEW, link_user);
+        }
+        else {
+            mapper_db_connection_t record;
+            memset(&record, 0, sizeof(record));
+            record.src_name = ev->src;
+            record.dest_name = ev->dest;
+            connection_handler(&record, MDB_NEW, connection_user);
+        }
+        free(ev->src);
+        if (ev->dest)
+            free(ev->dest);
+        free(ev);
+        delivered++;
+    }
+    return delivered;
+}
+
+/* The parts of libmapper the proxy uses, answered by the bus above. */
+
+mapper_admin mapper_admin_new(const char *iface, const char *ip, int port)
+{
+    return (mapper_admin)sim_storage;
+}
+
+void mapper_admin_free(mapper_admin admin) {}
+
+mapper_device mdev_new(const char *name, int port, mapper_admin admin)
+{
+    return (mapper_device)sim_storage;
+}
+
+void mdev_free(mapper_device dev) {}
+int mdev_ready(mapper_device dev) { return 1; }
+int mdev_poll(mapper_device dev, int block_ms) { return 0; }
+const char *mdev_name(mapper_device dev) { return sim_name; }
+unsigned int mdev_ordinal(mapper_device dev) { return 1; }
+int mdev_num_fds(mapper_device dev) { return 0; }
+int mdev_get_fds(mapper_device dev, int *fds, int num) { return 0; }
+void mdev_service_fd(mapper_device dev, int fd) {}
+void mdev_start_queue(mapper_device dev, mapper_timetag_t tt) {}
+void mdev_send_queue(mapper_device dev, mapper_timetag_t tt) {}
+
+void mdev_now(mapper_device dev, mapper_timetag_t *tt)
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    tt->sec = tv.tv_sec;
+    tt->frac = (uint32_t)(tv.tv_usec * 4294.967296);
+}
+
+mapper_signal mdev_add_input(mapper_device dev, const char *name, int length,
+                             char type, const char *unit, void *minimum,
+                             void *maximum, mapper_signal_handler *handler,
+                             void *user_data)
+{
+    return (mapper_signal)sim_storage;
+}
+
+mapper_signal mdev_add_output(mapper_device dev, const char *name, int length,
+                              char type, const char *unit, void *minimum,
+                              void *maximum)
+{
+    return (mapper_signal)sim_storage;
+}
+
+void mdev_remove_input(mapper_device dev, mapper_signal sig) {}
+void msig_update(mapper_signal sig, void *value, int count,
+                 mapper_timetag_t tt) {}
+void msig_update_instance(mapper_signal sig, int id, void *value, int count,
+                          mapper_timetag_t tt) {}
+void msig_release_instance(mapper_signal sig, int id, mapper_timetag_t tt) {}
+void msig_reserve_instances(mapper_signal sig, int num, int *ids,
+                            void **user_data) {}
+
+void *msig_instance_value(mapper_signal sig, int id, mapper_timetag_t *tt)
+{
+    return 0;
+}
+
+mapper_monitor mapper_monitor_new(mapper_admin admin, int flags)
+{
+    return (mapper_monitor)sim_storage;
+}
+
+void mapper_monitor_free(mapper_monitor mon) {}
+int mapper_monitor_poll(mapper_monitor mon, int block_ms) { return 0; }
+mapper_db mapper_monitor_get_db(mapper_monitor mon) { return (mapper_db)sim_storage; }
+
+void mapper_monitor_link(mapper_monitor mon, const char *src, const char *dest,
+                         mapper_db_link props, unsigned int flags)
+{
+    answer_request(EV_LINK, src, dest);
+}
+
+void mapper_monitor_unlink(mapper_monitor mon, const char *src,
+                           const char *dest) {}
+
+void mapper_monitor_connect(mapper_monitor mon, const char *src,
+                            const char *dest, mapper_db_connection props,
+                            unsigned int flags)
+{
+    answer_request(EV_CONNECTION, src, dest);
+}
+
+void mapper_db_add_device_callback(mapper_db db, mapper_db_device_handler *h,
+                                   void *user)
+{
+    device_handler = h;
+    device_user = user;
+}
+
+int mapper_monitor_request_signals_by_device_name(mapper_monitor mon,
+                                                  const char *name)
+{
+    // Qualia agents have an /observation input and may have /reward
+    raise_event(EV_SIGNAL, name, "/observation", latency);
+    if (rand() < with_reward * RAND_MAX)
+        raise_event(EV_SIGNAL, name, "/reward", latency);
+    return 0;
+}
+
+void mapper_db_add_signal_callback(mapper_db db, mapper_db_signal_handler *h,
+                                   void *user)
+{
+    signal_handler = h;
+    signal_user = user;
+}
+
+void mapper_db_remove_signal_callback(mapper_db db,
+                                      mapper_db_signal_handler *h,
+                                      void *user) {}
+
+void mapper_db_add_link_callback(mapper_db db, mapper_db_link_handler *h,
+                                 void *user)
+{
+    link_handler = h;
+    link_user = user;
+}
+
+void mapper_db_add_connection_callback(mapper_db db,
+                                       mapper_db_connection_handler *h,
+                                       void *user)
+{
+    connection_handler = h;
+    connection_user = user;
+}
+
+void mapper_db_remove_device_callback(mapper_db db,
+                                      mapper_db_device_handler *h,
+                                      void *user) {}
+void mapper_db_remove_link_callback(mapper_db db, mapper_db_link_handler *h,
+                                    void *user) {}
+void mapper_db_remove_connection_callback(mapper_db db,
+                                          mapper_db_connection_handler *h,
+                                          void *user) {}
+
+int mapper_db_device_property_lookup(mapper_db_device dev,
+                                     const char *property, lo_type *type,
+                                     const lo_arg **value)
+{
+    if (!strcmp(property, "host")) {
+        *type = 's';
+        *value = (const lo_arg *)sim_host;
+        return 0;
+    }
+    if (!strcmp(property, "port")) {
+        *type = 'i';
+        *value = (const lo_arg *)&sim_port;
+        return 0;
+    }
+    return 1;
+}
+
+void run_startup(int n)
+{
+    char name[256];
+    int i;
+
+    // The proxy reports every DB event; keep the CSV on stdout clean
+    fflush(stdout);
+    FILE *csv = fdopen(dup(1), "w");
+    if (!freopen("/dev/null", "w", stdout))
+        return;
+
+    srand(100);
+    agentInit();
+
+    double start = wall_clock(), cpu = cpu_seconds(), elapsed = 0;
+
+    // A cold start: every agent is announced before the server
+    raise_event(EV_DEVICE, sim_name, 0, 0);
+    for (i = 1; i <= n; i++) {
+        snprintf(name, 256, "/agent.%d", i);
+        raise_event(EV_DEVICE, name, 0, 0);
+    }
+    raise_event(EV_DEVICE, "/influence.1", 0, 0);
+
+    while (num_qualia_ready < n && elapsed < TIMEOUT) {
+        if (!deliver_events())
+            usleep(500);
+        plan_flush();
+        elapsed = wall_clock() - start;
+    }
+
+    fprintf(csv, "%d,%g,%g,%d,%.3f,%.3f,%d,%d\n", n, latency * 1000, loss,
+            num_qualia_ready, elapsed, cpu_seconds() - cpu, requests,
+            dropped);
+    fclose(csv);
+}
+
+void CmdLine(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "hl:d:r:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: peerbench [-h] [-l <ms>] [-d <fraction>] "
+                   "[-r <fraction>] [agents ...]\n");
+            printf("  -h  Help\n");
+            printf("  -l  Simulated bus latency in ms, default=%g\n",
+                   latency * 1000);
+            printf("  -d  Fraction of requests dropped, default=%g\n", loss);
+            printf("  -r  Fraction of agents with a /reward input, "
+                   "default=%g\n", with_reward);
+            printf("  agents  Qualia agent counts, default=10 100 1000\n");
+            exit(0);
+        case 'l':
+            latency = atof(optarg) / 1000;
+            break;
+        case 'd':
+            loss = atof(optarg);
+            break;
+        case 'r':
+            with_reward = atof(optarg);
+            break;
+        case '?': // Unknown
+            printf("peerbench: Bad options, use -h for help.\n");
+            exit(1);
+            break;
+        default:
+            abort();
+        }
+    }
+    if (optind < argc) {
+        num_agent_counts = 0;
+        while (optind < argc && num_agent_counts < MAX_SWEEP)
+            agent_counts[num_agent_counts++] = atoi(argv[optind++]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int i, pid;
+    CmdLine(argc, argv);
+
+    printf("agents,latency_ms,loss,connected,elapsed_s,cpu_s,"
+            "requests,dropped\n");
+    for (i = 0; i < num_agent_counts; i++) {
+        // each count starts from an empty registry
+        fflush(stdout);
+        if (!(pid = fork())) {
+            run_startup(agent_counts[i]);
+            exit(0);
+        }
+        waitpid(pid, 0, 0);
+    }
+    return 0;
+}
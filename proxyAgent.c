@@ -3,8 +3,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <getopt.h>
+#include <math.h>
+#include <sys/time.h>
 #include <mapper/mapper.h>
 
+#include "agent_loop.h"
+
 struct _agentInfo
 {
     char *influence_device_name;
@@ -34,6 +39,9 @@ float gain = 0.0001;
 float damping = 0.6;
 float limit = 0.1;
 
+float rate = 1.0 / REFERENCE_STEP;
+int substeps = 1;
+
 #define WIDTH  500
 #define HEIGHT 500
 
@@ -41,6 +49,8 @@ int numInstances = 1;
 int *active;
 int done = 0;
 
+struct _agentLoop loop;
+
 int compare_device_class(const char *device_name, const char *class_name)
 {
     if (!device_name || !class_name)
@@ -54,73 +64,243 @@ int compare_device_class(const char *device_name, const char *class_name)
     return strncmp(device_name, class_name, len);
 }
 
-void send_message(mapper_db_device dev)
+/* To allow a multi-instance network with the single-instance Qualia
+ * agent programs, we need the Qualia agents to initiate message-passing.
+ * However Qualia agents will not generate an "action" (output) until
+ * _after_ they have received an "observation" (input).  We "cheat" and
+ * send an out-of-band message to the observation input of the Qualia
+ * agent to provoke a response and kick things off.
+ *
+ * Addresses are resolved once per agent and cached.  Proxy instances
+ * cannot tell which agent drives them, so each agent's action is also
+ * connected to a per-agent "contact" input; only agents that have been
+ * silent for PROVOKE_SILENCE are provoked, and hearing from an agent
+ * resets its backoff. */
+
+#define PEER_HASH_SIZE       1024
+#define PROVOKE_INTERVAL     1.0    // seconds between staleness checks
+#define PROVOKE_SILENCE      2.0    // seconds before an agent is silent
+#define PROVOKE_MAX_BACKOFF 16.0
+
+/* Every device the monitor reports is entered once in a registry keyed
+ * by name, and classified when it is first seen so DB callbacks only
+ * need hash lookups.  Qualia agents also carry their link/connect
+ * state and cached address. */
+enum {
+    PEER_OTHER,
+    PEER_SELF,
+    PEER_INFLUENCE,
+    PEER_QUALIA,
+    NUM_PEER_CLASSES
+};
+
+#define QUALIA_LINKED_OBS       0x01    // influence -> qualia link seen
+#define QUALIA_LINKED_ACTION    0x02    // qualia -> proxy link seen
+#define QUALIA_CONNECTED_OBS    0x04    // observation/reward connected
+#define QUALIA_CONNECTED_ACTION 0x08    // action connected
+#define QUALIA_READY            0x0F
+#define QUALIA_HAS_REWARD       0x10    // agent has a /reward input
+
+struct _peer
 {
-    if (!dev)
-        return;
+    char *name;
+    int class;
+    int state;
+
+    lo_address address;
+    mapper_signal contact;
+    double last_action;
+    double last_provoked;
+    double backoff;
+
+    struct _peer *prev_in_class;
+    struct _peer *next_in_class;
+    struct _peer *next_in_bucket;
+};
+
+struct _peer *peer_hash[PEER_HASH_SIZE];
+struct _peer *peers[NUM_PEER_CLASSES];
+int num_peers[NUM_PEER_CLASSES];
+int num_qualia_ready = 0;
+
+double launch_time = 0;
+double start_time = 0;
+mapper_signal sig_connect_time;
+double last_provoke_check = 0;
+
+double wall_clock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
 
-    printf("PROVOKING QUALIA AGENT: %s\n", dev->name);
-    /* To allow a multi-instance network with the single-instance Qualia
-     * agent programs, we need the Qualia agents to initiate message-passing.
-     * However Qualia agents will not generate an "action" (output) until
-     * _after_ they have received an "observation" (input). This function
-     * "cheats" and sends an out-of-band message to the observation input of
-     * the Qualia agent to provoke a response and kick things off... */
+unsigned int hash_name(const char *name)
+{
+    unsigned int h = 5381;
+    while (*name)
+        h = h * 33 + (unsigned char)*name++;
+    return h;
+}
+
+struct _peer *find_peer(const char *name)
+{
+    struct _peer *p = peer_hash[hash_name(name) % PEER_HASH_SIZE];
+    while (p && strcmp(p->name, name))
+        p = p->next_in_bucket;
+    return p;
+}
 
-    // Retrieve device's IP and port
+lo_address lookup_address(mapper_db_device dev)
+{
     lo_type type;
     const lo_arg *val;
     const char *host;
     int port;
 
-    int i=0, found=0;
-    const char *key;
-    // TODO: use mapper_db_device_property_lookup() instead
-    while(!mapper_db_device_property_index(dev, i++, &key, &type, &val)
-          && found < 2)
-    {
-        if (strcmp(key, "host")==0) {
-            host = &val->s;
-            found++;
-        }
-        else if (strcmp(key, "port")==0) {
-            port = val->i32;
-            found++;
+    if (mapper_db_device_property_lookup(dev, "host", &type, &val))
+        return 0;
+    host = &val->s;
+    if (mapper_db_device_property_lookup(dev, "port", &type, &val))
+        return 0;
+    port = val->i32;
+
+    char urlstr[128];
+    snprintf(urlstr, 128, "osc.udp://%s:%i", host, port);
+    return lo_address_new_from_url(urlstr);
+}
+
+struct _peer *add_peer(const char *name)
+{
+    struct _agentInfo *info = &agentInfo;
+    struct _peer *p = find_peer(name);
+    if (p)
+        return p;
+
+    p = (struct _peer *)calloc(1, sizeof(struct _peer));
+    p->name = strdup(name);
+    if (strcmp(name, mdev_name(info->dev))==0)
+        p->class = PEER_SELF;
+    else if (strcmp(name, info->influence_device_name)==0)
+        p->class = PEER_INFLUENCE;
+    else if (compare_device_class(name, info->qualia_device_class)==0)
+        p->class = PEER_QUALIA;
+    else
+        p->class = PEER_OTHER;
+    p->backoff = PROVOKE_INTERVAL;
+
+    unsigned int h = hash_name(p->name) % PEER_HASH_SIZE;
+    p->next_in_bucket = peer_hash[h];
+    peer_hash[h] = p;
+
+    p->next_in_class = peers[p->class];
+    if (p->next_in_class)
+        p->next_in_class->prev_in_class = p;
+    peers[p->class] = p;
+    num_peers[p->class]++;
+    return p;
+}
+
+void set_qualia_state(struct _peer *p, int set, int clear)
+{
+    int was_ready = (p->state & QUALIA_READY) == QUALIA_READY;
+    p->state = (p->state | set) & ~clear;
+    int ready = (p->state & QUALIA_READY) == QUALIA_READY;
+
+    if (was_ready && !ready)
+        num_qualia_ready--;
+    else if (ready && !was_ready) {
+        num_qualia_ready++;
+        if (num_qualia_ready == num_peers[PEER_QUALIA]) {
+            float elapsed = wall_clock() - launch_time;
+            printf("All %d Qualia agents connected %.3f s after startup, "
+                   "receiving observations %.3f s after launch\n",
+                   num_qualia_ready, aloop_now(agentInfo.dev) - start_time,
+                   elapsed);
+            msig_update(sig_connect_time, &elapsed, 1, MAPPER_NOW);
         }
     }
-    if (found < 2) {
-        printf("Couldn't retrieve device host and port\n");
+}
+
+void remove_peer(const char *name)
+{
+    struct _peer **pp = &peer_hash[hash_name(name) % PEER_HASH_SIZE], *p;
+    while (*pp && strcmp((*pp)->name, name))
+        pp = &(*pp)->next_in_bucket;
+    if (!(p = *pp))
         return;
+    *pp = p->next_in_bucket;
+
+    if (p->prev_in_class)
+        p->prev_in_class->next_in_class = p->next_in_class;
+    else
+        peers[p->class] = p->next_in_class;
+    if (p->next_in_class)
+        p->next_in_class->prev_in_class = p->prev_in_class;
+    num_peers[p->class]--;
+
+    if (p->class == PEER_QUALIA)
+        set_qualia_state(p, 0, QUALIA_READY);
+    if (p->address)
+        lo_address_free(p->address);
+    free(p->name);
+    free(p);
+}
+
+void free_peers()
+{
+    int i;
+    for (i = 0; i < NUM_PEER_CLASSES; i++) {
+        while (peers[i])
+            remove_peer(peers[i]->name);
     }
+}
 
-    printf("Retrieved IP %s and port %i for device %s\n", host, port, dev->name);
-    char urlstr[128];
-    snprintf(urlstr, 128, "osc.udp://%s:%i", host, port);
-    lo_address a = lo_address_new_from_url(urlstr);
-    lo_send(a, "/observation", "ff", 0.f, 0.f);
-    lo_send(a, "/reward", "f", 0.f);
-    lo_address_free(a);
+void send_provocation(struct _peer *p, double now)
+{
+    if (!p->address)
+        return;
+
+    // one bundle, one packet per agent
+    lo_bundle b = lo_bundle_new(LO_TT_IMMEDIATE);
+    lo_message m = lo_message_new();
+    lo_message_add_float(m, 0.f);
+    lo_message_add_float(m, 0.f);
+    lo_bundle_add_message(b, "/observation", m);
+    m = lo_message_new();
+    lo_message_add_float(m, 0.f);
+    lo_bundle_add_message(b, "/reward", m);
+    lo_send_bundle(p->address, b);
+    lo_bundle_free_messages(b);
+
+    p->last_provoked = now;
 }
 
-void provoke_qualia_agent(const char *name)
+void provoke_qualia_agent(struct _peer *p)
 {
-    /* TODO: we could check update time on local instances and only provoke
-     * connected agents that haven't been in contact recently. */
     struct _agentInfo *info = &agentInfo;
+    double now = aloop_now(info->dev);
 
-    if (!info->db)
+    if (p) {
+        printf("PROVOKING QUALIA AGENT: %s\n", p->name);
+        p->backoff = PROVOKE_INTERVAL;
+        send_provocation(p, now);
         return;
-
-    if (name) {
-        send_message(mapper_db_get_device_by_name(info->db, name));
     }
-    else {
-        mapper_db_device *pdev = mapper_db_get_all_devices(info->db);
-        while (pdev) {
-            if (compare_device_class((*pdev)->name, "/agent") == 0)
-                send_message(*pdev);
-            pdev = mapper_db_device_next(pdev);
-        }
+
+    if (now - last_provoke_check < PROVOKE_INTERVAL)
+        return;
+    last_provoke_check = now;
+
+    for (p = peers[PEER_QUALIA]; p; p = p->next_in_class) {
+        if (now - p->last_action < PROVOKE_SILENCE)
+            continue;
+        if (now - p->last_provoked < p->backoff)
+            continue;
+        send_provocation(p, now);
+        p->backoff *= 2;
+        if (p->backoff > PROVOKE_MAX_BACKOFF)
+            p->backoff = PROVOKE_MAX_BACKOFF;
     }
 }
 
@@ -191,6 +371,33 @@ void force_handler(mapper_signal msig,
     accel[0] = paccel[0] + force[0] / mass * gain;
     accel[1] = paccel[1] + force[1] / mass * gain;
     msig_update_instance(accel_sig, instance_id, &accel, 1, MAPPER_NOW);
+
+    aloop_observed(&loop);
+}
+
+void contact_handler(mapper_signal msig,
+                     mapper_db_signal props,
+                     int instance_id,
+                     void *value,
+                     int count,
+                     mapper_timetag_t *timetag)
+{
+    // we stored a pointer to the agent's peer entry in user_data
+    struct _peer *p = (struct _peer *)props->user_data;
+    if (!value)
+        return;
+    p->last_action = aloop_now(agentInfo.dev);
+    p->backoff = PROVOKE_INTERVAL;
+}
+
+void add_contact(struct _peer *p)
+{
+    char signame[1024];
+    if (p->contact)
+        return;
+    snprintf(signame, 1024, "contact%s", p->name);
+    p->contact = mdev_add_input(agentInfo.dev, signame, 2, 'f', 0, 0, 0,
+                                contact_handler, p);
 }
 
 void generic_handler(mapper_signal msig,
@@ -208,66 +415,299 @@ void generic_handler(mapper_signal msig,
     }
 }
 
+/* Links and connections are not requested from the DB callbacks
+ * directly.  They are queued, de-duplicated and issued in batches once
+ * a short collection window has passed, so a cold start with many
+ * agents does not interleave a storm of single requests with the DB
+ * traffic they cause.  Requests that are not confirmed by the monitor
+ * are re-issued with exponential backoff. */
+
+#define PLAN_HASH_SIZE     4096
+#define PLAN_WINDOW        0.05     // seconds to collect requests
+#define PLAN_BATCH         64       // requests issued per flush
+#define PLAN_RETRY         1.0      // seconds before the first retry
+#define PLAN_MAX_BACKOFF   8.0
+#define PLAN_MAX_ATTEMPTS  6
+
+enum {
+    PLAN_LINK,
+    PLAN_CONNECT
+};
+
+enum {
+    CONN_DEFAULT,
+    CONN_OBSERVATION,
+    CONN_REWARD,
+    CONN_ACTION,
+    NUM_CONN_KINDS
+};
+
+struct _planOp
+{
+    int type;
+    char *src;
+    char *dest;
+    char *scope;        // link scope, or 0 for the default
+    int kind;           // connection properties
+
+    int attempts;
+    double issued;
+    double backoff;
+
+    struct _planOp *next;
+    struct _planOp *next_in_bucket;
+};
+
+struct _planOp *plan = 0;
+struct _planOp *plan_hash[PLAN_HASH_SIZE];
+double plan_window_start = 0;
+
+// Connection properties are built once and shared by all requests
+mapper_db_connection_t conn_props[NUM_CONN_KINDS];
+unsigned int conn_flags[NUM_CONN_KINDS];
+
+void init_connection_kinds()
+{
+    memset(conn_props, 0, sizeof(conn_props));
+
+    conn_flags[CONN_DEFAULT] = 0;
+
+    conn_props[CONN_OBSERVATION].send_as_instance = 1;
+    conn_props[CONN_OBSERVATION].mode = MO_EXPRESSION;
+    conn_props[CONN_OBSERVATION].expression = "y=x*0.5+0.5";
+    conn_flags[CONN_OBSERVATION] = CONNECTION_SEND_AS_INSTANCE |
+                                   CONNECTION_MODE | CONNECTION_EXPRESSION;
+
+    conn_props[CONN_REWARD].send_as_instance = 1;
+    conn_props[CONN_REWARD].mode = MO_EXPRESSION;
+    conn_props[CONN_REWARD].expression = "y=3-abs(x)";
+    conn_flags[CONN_REWARD] = conn_flags[CONN_OBSERVATION];
+
+    // we will override the default "sendAsInstance" property
+    conn_props[CONN_ACTION].send_as_instance = 1;
+    conn_flags[CONN_ACTION] = CONNECTION_SEND_AS_INSTANCE;
+}
+
+unsigned int plan_hash_op(int type, const char *src, const char *dest)
+{
+    return (hash_name(src) * 31 + hash_name(dest) + type) % PLAN_HASH_SIZE;
+}
+
+struct _planOp **find_plan_op(int type, const char *src, const char *dest)
+{
+    struct _planOp **pop = &plan_hash[plan_hash_op(type, src, dest)];
+    while (*pop && ((*pop)->type != type || strcmp((*pop)->src, src)
+                    || strcmp((*pop)->dest, dest)))
+        pop = &(*pop)->next_in_bucket;
+    return pop;
+}
+
+void plan_op(int type, const char *src, const char *dest,
+             const char *scope, int kind)
+{
+    struct _planOp **pop = find_plan_op(type, src, dest), *op;
+    if (*pop)
+        return;
+
+    op = (struct _planOp *)calloc(1, sizeof(struct _planOp));
+    op->type = type;
+    op->src = strdup(src);
+    op->dest = strdup(dest);
+    op->scope = scope ? strdup(scope) : 0;
+    op->kind = kind;
+    op->backoff = PLAN_RETRY;
+    *pop = op;
+
+    if (!plan)
+        plan_window_start = aloop_now(agentInfo.dev);
+    op->next = plan;
+    plan = op;
+}
+
+void plan_link(const char *src, const char *dest, const char *scope)
+{
+    plan_op(PLAN_LINK, src, dest, scope, 0);
+}
+
+void plan_connect(const char *src, const char *dest, int kind)
+{
+    plan_op(PLAN_CONNECT, src, dest, 0, kind);
+}
+
+void free_plan_op(struct _planOp *op)
+{
+    struct _planOp **pop = find_plan_op(op->type, op->src, op->dest);
+    if (*pop == op)
+        *pop = op->next_in_bucket;
+
+    for (pop = &plan; *pop && *pop != op; pop = &(*pop)->next) {}
+    if (*pop)
+        *pop = op->next;
+
+    free(op->src);
+    free(op->dest);
+    if (op->scope)
+        free(op->scope);
+    free(op);
+}
+
+void plan_confirm(int type, const char *src, const char *dest)
+{
+    struct _planOp *op = *find_plan_op(type, src, dest);
+    if (op)
+        free_plan_op(op);
+}
+
+int device_name_matches(const char *name, const char *device)
+{
+    int len = strlen(device);
+    return strncmp(name, device, len)==0 && (!name[len] || name[len]=='/');
+}
+
+void plan_cancel_device(const char *device)
+{
+    struct _planOp *op = plan, *next;
+    while (op) {
+        next = op->next;
+        if (device_name_matches(op->src, device)
+            || device_name_matches(op->dest, device))
+            free_plan_op(op);
+        op = next;
+    }
+}
+
+void issue_plan_op(struct _planOp *op, double now)
+{
+    struct _agentInfo *info = &agentInfo;
+
+    if (op->type == PLAN_LINK) {
+        if (op->scope) {
+            mapper_db_link_t props;
+            props.num_scopes = 1;
+            props.scope_names = &op->scope;
+            mapper_monitor_link(info->mon, op->src, op->dest, &props,
+                                LINK_NUM_SCOPES | LINK_SCOPE_NAMES);
+        }
+        else
+            mapper_monitor_link(info->mon, op->src, op->dest, 0, 0);
+    }
+    else {
+        mapper_monitor_connect(info->mon, op->src, op->dest,
+                               conn_flags[op->kind] ? &conn_props[op->kind] : 0,
+                               conn_flags[op->kind]);
+    }
+
+    if (op->attempts++)
+        op->backoff = fmin(op->backoff * 2, PLAN_MAX_BACKOFF);
+    op->issued = now;
+}
+
+void plan_flush()
+{
+    if (!plan)
+        return;
+
+    double now = aloop_now(agentInfo.dev);
+    if (now - plan_window_start < PLAN_WINDOW)
+        return;
+
+    // Links first, so connections requested in the same batch can land
+    struct _planOp *op, *next;
+    int type, issued = 0;
+    for (type = PLAN_LINK; type <= PLAN_CONNECT; type++) {
+        for (op = plan; op && issued < PLAN_BATCH; op = next) {
+            next = op->next;
+            if (op->type != type)
+                continue;
+            if (op->attempts && now - op->issued < op->backoff)
+                continue;
+            if (op->attempts >= PLAN_MAX_ATTEMPTS) {
+                printf("Giving up on %s %s -> %s\n",
+                       type == PLAN_LINK ? "link" : "connection",
+                       op->src, op->dest);
+                free_plan_op(op);
+                continue;
+            }
+            issue_plan_op(op, now);
+            issued++;
+        }
+    }
+    plan_window_start = now;
+}
+
+void free_plan()
+{
+    while (plan)
+        free_plan_op(plan);
+}
+
+void link_influence_to_qualia(struct _peer *p)
+{
+    // this link needs to be scoped for qualia instances
+    plan_link(agentInfo.influence_device_name, p->name, p->name);
+}
+
+// Reward inputs are optional, so only connect them once they are seen
+void connect_reward(struct _peer *p)
+{
+    char signame1[1024], signame2[1024];
+    if ((p->state & (QUALIA_LINKED_OBS | QUALIA_HAS_REWARD))
+        != (QUALIA_LINKED_OBS | QUALIA_HAS_REWARD))
+        return;
+    sprintf(signame1, "%s/node/observation/1d", agentInfo.influence_device_name);
+    sprintf(signame2, "%s/reward", p->name);
+    plan_connect(signame1, signame2, CONN_REWARD);
+}
+
 void dev_db_callback(mapper_db_device record,
                      mapper_db_action_t action,
                      void *user)
 {
     struct _agentInfo *info = (struct _agentInfo*)user;
+    struct _peer *p;
 
     if (action == MDB_NEW) {
         printf("Received device %s\n", record->name);
-        if (compare_device_class(record->name,
-                                 info->qualia_device_class)==0) {
+        p = add_peer(record->name);
+        if (p->class == PEER_QUALIA) {
+            if (!p->address && !(p->address = lookup_address(record)))
+                printf("Couldn't retrieve host and port for device %s\n",
+                       record->name);
+
+            add_contact(p);
+            mapper_monitor_request_signals_by_device_name(info->mon,
+                                                          record->name);
 
             // this link will default to correct scope
-            mapper_monitor_link(info->mon, record->name,
-                                mdev_name(info->dev), 0, 0);
+            plan_link(record->name, mdev_name(info->dev), 0);
 
             // link influence->qualia
-            // this link needs to be scoped for qualia instances
-            mapper_db_link_t props;
-            props.num_scopes = 1;
-            props.scope_names = &record->name;
-            mapper_monitor_link(info->mon, info->influence_device_name,
-                                record->name, &props,
-                                LINK_NUM_SCOPES | LINK_SCOPE_NAMES);
+            link_influence_to_qualia(p);
         }
-        else if (strcmp(record->name, info->influence_device_name)==0) {
+        else if (p->class == PEER_INFLUENCE) {
             // Use scope "all" for this link to allow all instances
-            mapper_db_link_t props;
-            props.num_scopes = 1;
-            char *name = "all";
-            props.scope_names = &name;
-            mapper_monitor_link(info->mon, mdev_name(info->dev), record->name,
-                                &props, LINK_NUM_SCOPES | LINK_SCOPE_NAMES);
+            plan_link(mdev_name(info->dev), record->name, "all");
 
             // link influence to each qualia program
-            mapper_db_device *dev =
-                mapper_db_match_devices_by_name(info->db,
-                                                info->qualia_device_class);
-            while (dev) {
-                lo_type type;
-                const lo_arg *val;
-                if (!mapper_db_device_property_lookup(*dev, "name", &type, &val)) {
-                    const char *name = &val->s;
-                    props.scope_names = (char **)&name;
-                    mapper_monitor_link(info->mon, info->influence_device_name,
-                                        &val->s, &props,
-                                        LINK_NUM_SCOPES | LINK_SCOPE_NAMES);
-                }
-                dev = mapper_db_device_next(dev);
-            }
+            for (p = peers[PEER_QUALIA]; p; p = p->next_in_class)
+                link_influence_to_qualia(p);
         }
     }
     else if (action == MDB_REMOVE) {
-        if (compare_device_class(record->name, info->qualia_device_class)==0) {
+        if (!(p = find_peer(record->name)))
+            return;
+        if (p->class == PEER_QUALIA) {
             mapper_monitor_unlink(info->mon, record->name,
                                   mdev_name(info->dev));
         }
-        else if (strcmp(record->name, info->influence_device_name)==0) {
+        else if (p->class == PEER_INFLUENCE) {
             mapper_monitor_unlink(info->mon, mdev_name(info->dev),
                                   record->name);
         }
+        plan_cancel_device(record->name);
+        if (p->contact)
+            mdev_remove_input(info->dev, p->contact);
+        remove_peer(record->name);
     }
 }
 
@@ -278,73 +718,147 @@ void link_db_callback(mapper_db_link record,
     // if we see our links, send /connect messages
     char signame1[1024], signame2[1024];
     struct _agentInfo *info = (struct _agentInfo*)user;
+    struct _peer *src, *dest;
 
-    if ((strcmp(record->src_name, mdev_name(info->dev))==0) &&
-        (strcmp(record->dest_name, info->influence_device_name)==0)) {
+    if (action == MDB_NEW) {
+        plan_confirm(PLAN_LINK, record->src_name, record->dest_name);
+        src = add_peer(record->src_name);
+        dest = add_peer(record->dest_name);
+    }
+    else if (action == MDB_REMOVE) {
+        src = find_peer(record->src_name);
+        dest = find_peer(record->dest_name);
+        if (!src || !dest)
+            return;
+    }
+    else
+        return;
+
+    if (src->class == PEER_SELF && dest->class == PEER_INFLUENCE) {
         if (action == MDB_NEW) {
             printf("Received link %s -> %s\n",
                    record->src_name, record->dest_name);
             // send proxy->influence connections
             sprintf(signame1, "%s/position", mdev_name(info->dev));
             sprintf(signame2, "%s/node/position", info->influence_device_name);
-            mapper_monitor_connect(info->mon, signame1, signame2, 0, 0);
+            plan_connect(signame1, signame2, CONN_DEFAULT);
             info->proxy_influence_linked++;
         }
         else if (action == MDB_REMOVE) {
             info->proxy_influence_linked--;
         }
     }
-    else if ((strcmp(record->src_name, info->influence_device_name)==0) &&
-        (compare_device_class(record->dest_name, info->qualia_device_class))==0) {
+    else if (src->class == PEER_INFLUENCE && dest->class == PEER_QUALIA) {
         if (action == MDB_NEW) {
             printf("Received link %s -> %s\n",
                    record->src_name, record->dest_name);
             // send influence->qualia connections
             sprintf(signame1, "%s/node/observation", info->influence_device_name);
             sprintf(signame2, "%s/observation", record->dest_name);
-            mapper_db_connection_t props;
-            props.send_as_instance = 1;
-            props.mode = MO_EXPRESSION;
-            props.expression = "y=x*0.5+0.5";
-            mapper_monitor_connect(info->mon, signame1, signame2, &props,
-                                   CONNECTION_SEND_AS_INSTANCE |
-                                   CONNECTION_MODE | CONNECTION_EXPRESSION);
-            // also try to connect Qualia reward signal if it exists
-            sprintf(signame1, "%s/node/observation/1d", info->influence_device_name);
-            sprintf(signame2, "%s/reward", record->dest_name);
-            props.expression = "y=3-abs(x)";
-            mapper_monitor_connect(info->mon, signame1, signame2, &props,
-                                   CONNECTION_SEND_AS_INSTANCE |
-                                   CONNECTION_MODE | CONNECTION_EXPRESSION);
+            plan_connect(signame1, signame2, CONN_OBSERVATION);
             info->influence_qualia_linked++;
-            provoke_qualia_agent(record->dest_name);
+            set_qualia_state(dest, QUALIA_LINKED_OBS, 0);
+            connect_reward(dest);
         }
         else if (action == MDB_REMOVE) {
             info->influence_qualia_linked--;
+            set_qualia_state(dest, 0, QUALIA_LINKED_OBS | QUALIA_CONNECTED_OBS);
         }
     }
-    else if ((compare_device_class(record->src_name, info->qualia_device_class)==0) &&
-             (strcmp(record->dest_name, mdev_name(info->dev))==0)) {
+    else if (src->class == PEER_QUALIA && dest->class == PEER_SELF) {
         if (action == MDB_NEW) {
             printf("Received link %s -> %s\n",
                    record->src_name, record->dest_name);
             // send qualia->proxy connections
-            // we will override the default "sendAsInstance" property
             sprintf(signame1, "%s/action", record->src_name);
             sprintf(signame2, "%s/force", mdev_name(info->dev));
-            mapper_db_connection_t props;
-            props.send_as_instance = 1;
-            mapper_monitor_connect(info->mon, signame1, signame2, &props,
-                                   CONNECTION_SEND_AS_INSTANCE);
+            plan_connect(signame1, signame2, CONN_ACTION);
+            // and to the agent's own contact input, to track silence
+            sprintf(signame2, "%s/contact%s", mdev_name(info->dev),
+                    record->src_name);
+            plan_connect(signame1, signame2, CONN_DEFAULT);
             info->qualia_proxy_linked++;
-            provoke_qualia_agent(record->src_name);
+            set_qualia_state(src, QUALIA_LINKED_ACTION, 0);
         }
         else if (action == MDB_REMOVE) {
             info->qualia_proxy_linked--;
+            set_qualia_state(src, 0, QUALIA_LINKED_ACTION |
+                             QUALIA_CONNECTED_ACTION);
         }
     }
 }
 
+void signal_db_callback(mapper_db_signal record,
+                        mapper_db_action_t action,
+                        void *user)
+{
+    struct _peer *p;
+
+    if (record->is_output || strcmp(record->name, "/reward"))
+        return;
+    p = find_peer(record->device_name);
+    if (!p || p->class != PEER_QUALIA)
+        return;
+
+    if (action == MDB_NEW) {
+        set_qualia_state(p, QUALIA_HAS_REWARD, 0);
+        connect_reward(p);
+    }
+    else if (action == MDB_REMOVE)
+        set_qualia_state(p, 0, QUALIA_HAS_REWARD);
+}
+
+void connection_db_callback(mapper_db_connection record,
+                            mapper_db_action_t action,
+                            void *user)
+{
+    struct _agentInfo *info = (struct _agentInfo*)user;
+    char devname[256];
+    struct _peer *p;
+
+    if (action != MDB_NEW && action != MDB_REMOVE)
+        return;
+    if (action == MDB_NEW)
+        plan_confirm(PLAN_CONNECT, record->src_name, record->dest_name);
+
+    // Qualia agents are ready once observations and actions flow
+    if (device_name_matches(record->src_name, info->influence_device_name)) {
+        const char *slash = strchr(record->dest_name + 1, '/');
+        if (!slash || strcmp(slash, "/observation"))
+            return;
+        snprintf(devname, 256, "%.*s", (int)(slash - record->dest_name),
+                 record->dest_name);
+        p = find_peer(devname);
+        if (!p || p->class != PEER_QUALIA)
+            return;
+        if (action == MDB_NEW) {
+            set_qualia_state(p, QUALIA_CONNECTED_OBS, 0);
+            provoke_qualia_agent(p);
+        }
+        else
+            set_qualia_state(p, 0, QUALIA_CONNECTED_OBS);
+    }
+    else if (device_name_matches(record->dest_name, mdev_name(info->dev))) {
+        const char *slash = strchr(record->dest_name + 1, '/');
+        if (!slash || strcmp(slash, "/force"))
+            return;
+        slash = strchr(record->src_name + 1, '/');
+        if (!slash)
+            return;
+        snprintf(devname, 256, "%.*s", (int)(slash - record->src_name),
+                 record->src_name);
+        p = find_peer(devname);
+        if (!p || p->class != PEER_QUALIA)
+            return;
+        if (action == MDB_NEW) {
+            set_qualia_state(p, QUALIA_CONNECTED_ACTION, 0);
+            provoke_qualia_agent(p);
+        }
+        else
+            set_qualia_state(p, 0, QUALIA_CONNECTED_ACTION);
+    }
+}
+
 struct _agentInfo *agentInit()
 {
     struct _agentInfo *info = &agentInfo;
@@ -370,6 +884,10 @@ struct _agentInfo *agentInit()
     info->db  = mapper_monitor_get_db(info->mon);
     mapper_db_add_device_callback(info->db, dev_db_callback, info);
     mapper_db_add_link_callback(info->db, link_db_callback, info);
+    mapper_db_add_signal_callback(info->db, signal_db_callback, info);
+    mapper_db_add_connection_callback(info->db, connection_db_callback, info);
+    start_time = aloop_now(info->dev);
+    init_connection_kinds();
 
     // add signals
     float mn=-1, mx=1;
@@ -415,6 +933,10 @@ struct _agentInfo *agentInit()
     msig_reserve_instances(sig_pos_in, numInstances-1, 0, 0);
     msig_reserve_instances(sig_pos_out, numInstances-1, 0, 0);
 
+    // time from launch until every Qualia agent receives observations
+    sig_connect_time = mdev_add_output(info->dev, "connect_time", 1, 'f',
+                                       "s", 0, 0);
+
     return info;
 }
 
@@ -433,6 +955,9 @@ void agentLogout()
     }
     mdev_send_queue(info->dev, tt);
 
+    aloop_report(&loop);
+    aloop_free(&loop);
+
     // TODO: unlink devices
     if (info->influence_qualia_linked) {
         mapper_monitor_unlink(info->mon,
@@ -453,6 +978,9 @@ void agentLogout()
     if (info->db) {
         mapper_db_remove_device_callback(info->db, dev_db_callback, info);
         mapper_db_remove_link_callback(info->db, link_db_callback, info);
+        mapper_db_remove_signal_callback(info->db, signal_db_callback, info);
+        mapper_db_remove_connection_callback(info->db, connection_db_callback,
+                                             info);
     }
     if (info->mon)
         mapper_monitor_free(info->mon);
@@ -462,6 +990,8 @@ void agentLogout()
     memset(info, 0, sizeof(struct _agentInfo));
     if (active)
         free(active);
+    free_peers();
+    free_plan();
 }
 
 void ctrlc(int sig)
@@ -469,11 +999,75 @@ void ctrlc(int sig)
     done = 1;
 }
 
+void integrate(float *accel, float *vel, float *pos, int steps, double step)
+{
+    int j, k;
+    float scale = step / REFERENCE_STEP;
+    float decay = pow(0.9, scale);
+
+    for (j = 0; j < 2; j++) {
+        // accumulated force is applied once as an impulse
+        accel[j] *= 0.9;
+        for (k = 0; k < steps; k++) {
+            vel[j] = vel[j] * decay + accel[j];
+            pos[j] += vel[j] * scale;
+            accel[j] = 0;
+
+            if (pos[j] < -0.99) {
+                pos[j] = -0.99;
+                //vel[j] *= -0.95;
+            }
+            else if (pos[j] >= 0.99) {
+                pos[j] = 0.99;
+                //vel[j] *= -0.95;
+            }
+        }
+    }
+}
+
+// peerbench links the registry against a simulated bus and brings its own
+// command line and main
+#ifndef PEERBENCH
+void CmdLine(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "hr:s:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: proxyAgent [-h] [-r <rate>] [-s <substeps>] "
+                   "[instances]\n");
+            printf("  -h  Help\n");
+            printf("  -r  Output rate in Hz, default=%g\n", rate);
+            printf("  -s  Integration steps per output, default=%d\n"
+                   "      (observations are answered after one step)\n",
+                   substeps);
+            exit(0);
+        case 'r': // Rate
+            rate = atof(optarg);
+            break;
+        case 's': // Substeps
+            substeps = atoi(optarg);
+            break;
+        case '?': // Unknown
+            printf("proxyAgent: Bad options, use -h for help.\n");
+            exit(1);
+            break;
+        default:
+            abort();
+        }
+    }
+    if (optind < argc)
+        numInstances = atoi(argv[optind]);
+}
+
 int main(int argc, char *argv[])
 {
-    int i, j, id, counter=0;
-    if (argc > 1)
-        numInstances = atoi(argv[1]);
+    int i, id, steps;
+    launch_time = wall_clock();
+
+    CmdLine(argc, argv);
 
     signal(SIGINT, ctrlc);
 
@@ -491,13 +1085,14 @@ int main(int argc, char *argv[])
         mdev_poll(info->dev, 10);
     }
 
+    aloop_init(&loop, info->dev, info->mon, rate, substeps);
+
     while (!done) {
-        mapper_monitor_poll(info->mon, 0);
-        mdev_poll(info->dev, 20);
-        if (counter++ > 100) {
-            provoke_qualia_agent(0);
-            counter = 0;
-        }
+        steps = aloop_wait(&loop);
+        plan_flush();
+        provoke_qualia_agent(0);
+        if (!steps)
+            continue;
 
         mdev_now(info->dev, &tt);
         mdev_start_queue(info->dev, tt);
@@ -522,22 +1117,10 @@ int main(int argc, char *argv[])
                 continue;
             }
 
-            for (j = 0; j < 2; j++) {
-                accel[j] = paccel[j] * 0.9;
-                vel[j] = pvel[j] * 0.9 + accel[j];
-                pos[j] = ppos[j] + vel[j];
-
-                if (pos[j] < -0.99) {
-                    pos[j] = -0.99;
-                    //vel[j] *= -0.95;
-                }
-                else if (pos[j] >= 0.99) {
-                    pos[j] = 0.99;
-                    //vel[j] *= -0.95;
-                }
-
-                accel[j] = 0;
-            }
+            memcpy(accel, paccel, sizeof(accel));
+            memcpy(vel, pvel, sizeof(vel));
+            memcpy(pos, ppos, sizeof(pos));
+            integrate(accel, vel, pos, steps, loop.step);
 
             msig_update_instance(sig_accel_in, id, &accel, 1, tt);
             msig_update_instance(sig_accel_out, id, &accel, 1, tt);
@@ -547,9 +1130,11 @@ int main(int argc, char *argv[])
             msig_update_instance(sig_pos_out, id, &pos, 1, tt);
         }
         mdev_send_queue(info->dev, tt);
+        aloop_published(&loop);
     }
 
 done:
     agentLogout();
     return 0;
 }
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include <mapper/mapper.h>
 #include "AutoConnect.h"
 
@@ -11,11 +12,19 @@ struct _autoConnectState
     char *vector_device_name;
     char *xagora_device_name;
     int connected;
+    int discover;   // link to devices as the database reports them
 
     mapper_device dev;
     mapper_monitor mon;
 } autoConnectState;
 
+// The monitor outlives each device so that its database stays warm
+// across reconnects.
+mapper_monitor autoConnectMonitor = 0;
+
+double autoConnectTimeout = 100;
+double autoConnectTime = -1;
+
 mapper_signal sig_x = 0, sig_y = 0;
 
 float obs[5] = {0,0,0,0,0};
@@ -72,13 +81,20 @@ void signal_handler(mapper_signal msig,
            obs[0], obs[1], obs[2], obs[3]);
 }
 
+static double wall_clock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
 void link_db_callback(mapper_db_link record,
                       mapper_db_action_t action,
                       void *user)
 {
     struct _autoConnectState *acs = (struct _autoConnectState*)user;
 
-    if (!acs->vector_device_name || !mdev_name(acs->dev))
+    if (!acs->dev || !acs->vector_device_name || !mdev_ready(acs->dev))
         return;
 
     if (action == MDB_NEW || action == MDB_MODIFY) {
@@ -111,67 +127,198 @@ void link_db_callback(mapper_db_link record,
     }
 }
 
+// Links already in a warm database will not be reported as new.
+static void check_links(struct _autoConnectState *acs)
+{
+    mapper_db db = mapper_monitor_get_db(acs->mon);
+    const char *name = mdev_name(acs->dev);
+    if (mapper_db_get_link_by_src_dest_names(db, acs->vector_device_name,
+                                             name))
+        acs->seen_srcdest_link = 1;
+    if (mapper_db_get_link_by_src_dest_names(db, name,
+                                             acs->vector_device_name))
+        acs->seen_destsrc_link = 1;
+    if (acs->seen_srcdest_link && acs->seen_destsrc_link)
+        acs->connected = 1;
+}
+
+static void link_device(struct _autoConnectState *acs, const char *name)
+{
+    if (!acs->vector_device_name && strstr(name, "vector")) {
+        acs->vector_device_name = strdup(name);
+        mapper_monitor_link(acs->mon, name, mdev_name(acs->dev), 0, 0);
+        mapper_monitor_link(acs->mon, mdev_name(acs->dev), name, 0, 0);
+        mapper_monitor_request_links_by_name(acs->mon, name);
+        check_links(acs);
+    }
+    else if (!acs->xagora_device_name && strstr(name, "XAgora_receiver")) {
+        acs->xagora_device_name = strdup(name);
+        mapper_monitor_link(acs->mon, mdev_name(acs->dev), name, 0, 0);
+        mapper_monitor_request_links_by_name(acs->mon, name);
+    }
+}
+
+void device_db_callback(mapper_db_device record,
+                        mapper_db_action_t action,
+                        void *user)
+{
+    struct _autoConnectState *acs = (struct _autoConnectState*)user;
+
+    if (!acs->discover || !acs->dev || !mdev_ready(acs->dev))
+        return;
+
+    if (action == MDB_NEW || action == MDB_MODIFY)
+        link_device(acs, record->name);
+}
+
+static mapper_monitor get_monitor()
+{
+    if (!autoConnectMonitor) {
+        autoConnectMonitor = mapper_monitor_new(0, 0);
+        mapper_db db = mapper_monitor_get_db(autoConnectMonitor);
+        mapper_db_add_link_callback(db, link_db_callback, &autoConnectState);
+        mapper_db_add_device_callback(db, device_db_callback,
+                                      &autoConnectState);
+        mapper_monitor_request_devices(autoConnectMonitor);
+    }
+    return autoConnectMonitor;
+}
+
+// Services the device and the monitor until cond is set or the
+// deadline passes.  Returns the value of cond.
+static int wait_for(struct _autoConnectState *acs, int *cond,
+                    double deadline)
+{
+    while (!*cond && wall_clock() < deadline) {
+        mdev_poll(acs->dev, 1);
+        mapper_monitor_poll(acs->mon, 1);
+    }
+    return *cond;
+}
+
+static int wait_ready(struct _autoConnectState *acs, double deadline)
+{
+    while (!mdev_ready(acs->dev) && wall_clock() < deadline) {
+        mdev_poll(acs->dev, 1);
+        mapper_monitor_poll(acs->mon, 1);
+    }
+    return mdev_ready(acs->dev);
+}
+
+static mapper_device connect_failed(struct _autoConnectState *acs)
+{
+    printf("Could not connect %s within %g s\n",
+           mdev_ready(acs->dev) ? mdev_name(acs->dev) : "device",
+           autoConnectTimeout);
+    mdev_free(acs->dev);
+    if (acs->vector_device_name)
+        free(acs->vector_device_name);
+    if (acs->xagora_device_name)
+        free(acs->xagora_device_name);
+    memset(acs, 0, sizeof(struct _autoConnectState));
+    return 0;
+}
+
+static void connect_done(struct _autoConnectState *acs, double start)
+{
+    autoConnectTime = wall_clock() - start;
+    printf("Connected %s to %s in %f s\n", mdev_name(acs->dev),
+           acs->vector_device_name, autoConnectTime);
+    fflush(stdout);
+}
+
 mapper_device autoConnectDevice(mapper_device dev)
 {
     struct _autoConnectState *acs = &autoConnectState;
     memset(acs, 0, sizeof(struct _autoConnectState));
 
-    acs->dev = dev;
-
-    while (!mdev_ready(acs->dev)) {
-         mdev_poll(acs->dev, 100);
-     }
+    double start = wall_clock();
+    double deadline = start + autoConnectTimeout;
 
-     printf("ordinal: %d\n", mdev_ordinal(acs->dev));
-     fflush(stdout);
+    acs->dev = dev;
+    acs->mon = get_monitor();
+    acs->discover = 1;
 
-     acs->mon = mapper_monitor_new(0, 0);
-     mapper_db db = mapper_monitor_get_db(acs->mon);
+    // the monitor learns about devices while our ordinal is allocated
+    if (!wait_ready(acs, deadline))
+        return connect_failed(acs);
 
-     mapper_db_add_link_callback(db, link_db_callback, acs);
-     int i=0;
-     while (i++ < 10) {
-         mdev_poll(acs->dev, 100);
-         mapper_monitor_poll(acs->mon, 0);
-     }
+    printf("ordinal: %d\n", mdev_ordinal(acs->dev));
+    fflush(stdout);
 
-     mapper_db_device *dbdev = mapper_db_match_devices_by_name(db, "vector");
-     if (dbdev) {
-         acs->vector_device_name = strdup((*dbdev)->name);
-         mapper_monitor_link(acs->mon, (*dbdev)->name,
-                             mdev_name(acs->dev), 0, 0);
-         mapper_monitor_link(acs->mon, mdev_name(acs->dev),
-                             (*dbdev)->name, 0, 0);
+    mapper_db db = mapper_monitor_get_db(acs->mon);
+    mapper_db_device *dbdev = mapper_db_get_all_devices(db);
+    while (dbdev) {
+        link_device(acs, (*dbdev)->name);
+        dbdev = mapper_db_device_next(dbdev);
+    }
 
-         mapper_monitor_request_links_by_name(acs->mon, (*dbdev)->name);
-     }
-     mapper_db_device_done(dbdev);
+    if (!wait_for(acs, &acs->connected, deadline))
+        return connect_failed(acs);
 
-     dbdev = mapper_db_match_devices_by_name(db, "XAgora_receiver");
-     if (dbdev) {
-         acs->xagora_device_name = strdup((*dbdev)->name);
-         mapper_monitor_link(acs->mon, mdev_name(acs->dev),
-                             (*dbdev)->name, 0, 0);
+    make_connections();
+    connect_done(acs, start);
 
-         mapper_monitor_request_links_by_name(acs->mon, (*dbdev)->name);
-     }
-     mapper_db_device_done(dbdev);
+    return acs->dev;
+}
 
-     i=0;
-     while (i++ < 1000 && !acs->connected) {
-         mdev_poll(acs->dev, 100);
-         mapper_monitor_poll(acs->mon, 0);
-     }
+void make_instance_connections()
+{
+    char signame1[1024], signame2[1024];
+    struct _autoConnectState *acs = &autoConnectState;
+    mapper_db_connection_t props;
+    char expr[] = "y=x*0.5+0.5";
+    props.send_as_instance = 1;
+
+    // observations arrive in [0,1], as through proxyAgent
+    props.mode = MO_EXPRESSION;
+    props.expression = expr;
+    sprintf(signame1, "%s/node/observation", acs->vector_device_name);
+    sprintf(signame2, "%s/observation", mdev_name(acs->dev));
+    mapper_monitor_connect(acs->mon, signame1, signame2, &props,
+                           CONNECTION_SEND_AS_INSTANCE | CONNECTION_MODE
+                           | CONNECTION_EXPRESSION);
+
+    sprintf(signame1, "%s/position", mdev_name(acs->dev));
+    sprintf(signame2, "%s/node/position", acs->vector_device_name);
+    mapper_monitor_connect(acs->mon, signame1, signame2, &props,
+                           CONNECTION_SEND_AS_INSTANCE);
+}
 
-     if (!acs->connected) {
-         mdev_free(acs->dev);
-         mapper_monitor_free(acs->mon);
-         return 0;
-     }
+mapper_device autoConnectInfluence(mapper_device dev,
+                                   const char *influence_name)
+{
+    struct _autoConnectState *acs = &autoConnectState;
+    memset(acs, 0, sizeof(struct _autoConnectState));
 
-     make_connections();
+    double start = wall_clock();
+    double deadline = start + autoConnectTimeout;
 
-     return acs->dev;
+    acs->dev = dev;
+    acs->mon = get_monitor();
+
+    if (!wait_ready(acs, deadline))
+        return connect_failed(acs);
+
+    // the influence server talks to us through our own instances
+    acs->vector_device_name = strdup(influence_name);
+    char *scope = (char *)mdev_name(acs->dev);
+    mapper_db_link_t props;
+    props.num_scopes = 1;
+    props.scope_names = &scope;
+    mapper_monitor_link(acs->mon, influence_name, mdev_name(acs->dev),
+                        &props, LINK_NUM_SCOPES | LINK_SCOPE_NAMES);
+    mapper_monitor_link(acs->mon, mdev_name(acs->dev), influence_name, 0, 0);
+    mapper_monitor_request_links_by_name(acs->mon, influence_name);
+    check_links(acs);
+
+    if (!wait_for(acs, &acs->connected, deadline))
+        return connect_failed(acs);
+
+    make_instance_connections();
+    connect_done(acs, start);
+
+    return acs->dev;
 }
 
 void autoDisconnectDevice()
@@ -194,6 +341,23 @@ void autoDisconnectDevice()
   memset(acs, 0, sizeof(struct _autoConnectState));
 }
 
+void autoConnectSetTimeout(double seconds)
+{
+    autoConnectTimeout = seconds;
+}
+
+double autoConnectElapsed()
+{
+    return autoConnectTime;
+}
+
+void autoConnectFree()
+{
+    if (autoConnectMonitor)
+        mapper_monitor_free(autoConnectMonitor);
+    autoConnectMonitor = 0;
+}
+
 //int main()
 //{
 //    mapper_device dev = autoConnect();
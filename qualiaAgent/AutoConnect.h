@@ -28,8 +28,19 @@ extern "C" {
 #endif
 
 mapper_device autoConnectDevice(mapper_device dev);
+mapper_device autoConnectInfluence(mapper_device dev,
+                                   const char *influence_name);
 void autoDisconnectDevice();
 
+// Overall deadline for discovery and linking, in seconds (default 100).
+void autoConnectSetTimeout(double seconds);
+
+// Seconds the last successful connection took, or -1.
+double autoConnectElapsed();
+
+// Frees the monitor kept between connections.
+void autoConnectFree();
+
 #if defined (__cplusplus)
 }
 #endif
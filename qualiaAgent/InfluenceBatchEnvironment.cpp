@@ -0,0 +1,161 @@
+/*
+ * InfluenceBatchEnvironment.cpp
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "InfluenceBatchEnvironment.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+static double timetagSeconds(const mapper_timetag_t& tt) {
+  return tt.sec + tt.frac / 4294967296.0;
+}
+
+InfluenceBatchEnvironment::InfluenceBatchEnvironment(int nLearners_, int observationDim_, const char *namePrefix,
+                                                     bool autoConnect_, int initialPort, int stepTimeout_,
+                                                     const char *influenceName_)
+  : dev(0), devNamePrefix(namePrefix), influenceName(influenceName_), autoConnect(autoConnect_),
+    devInitialPort(initialPort), nLearners(nLearners_), observationDim(observationDim_),
+    stepTimeout(stepTimeout_), nSteps(0), nStaleSteps(0) {
+  observations = new RLObservation*[nLearners];
+  for (int i=0; i<nLearners; i++)
+    observations[i] = new RLObservation(observationDim);
+  pos = new float[nLearners][2];
+  vel = new float[nLearners][2];
+  observationTick = new mapper_timetag_t[nLearners];
+  consumedTick = new mapper_timetag_t[nLearners];
+  for (int i=0; i<nLearners; i++) {
+    observationTick[i].sec = observationTick[i].frac = 0;
+    consumedTick[i] = observationTick[i];
+  }
+}
+
+InfluenceBatchEnvironment::~InfluenceBatchEnvironment() {
+  if (autoConnect)
+    autoDisconnectDevice();
+  else if (dev)
+    mdev_free(dev);
+  for (int i=0; i<nLearners; i++)
+    delete observations[i];
+  delete[] observations;
+  delete[] pos;
+  delete[] vel;
+  delete[] observationTick;
+  delete[] consumedTick;
+}
+
+void InfluenceBatchEnvironment::init() {
+  dev = mdev_new(devNamePrefix, devInitialPort, 0);
+
+  // Same observation input as the single environment; the connection
+  // scales the server's field vector as the proxy does for it.
+  insig = mdev_add_input(dev, "/observation", observationDim, 'f', 0, 0, 0,
+                         updateInput, this);
+  msig_reserve_instances(insig, nLearners-1, 0, 0);
+
+  // Output "action" is position (x,y) in field cells, one instance per
+  // learner
+  float mn = 0, mx = FIELD_SIZE;
+  outsig = mdev_add_output(dev, "/position", 2, 'f', 0, &mn, &mx);
+  msig_reserve_instances(outsig, nLearners-1, 0, 0);
+
+  if (autoConnect)
+    dev = autoConnectInfluence(dev, influenceName);
+}
+
+void InfluenceBatchEnvironment::start() {
+  for (int i=0; i<nLearners; i++) {
+    pos[i][0] = rand()%WIDTH/2+WIDTH/4;
+    pos[i][1] = rand()%WIDTH/2+WIDTH/4;
+    vel[i][0] = vel[i][1] = 0;
+  }
+
+  sendPositions();
+  waitForObservations();
+}
+
+void InfluenceBatchEnvironment::step(Action* const* actions) {
+  for (int i=0; i<nLearners; i++)
+    InfluenceEnvironment::move(pos[i], vel[i], actions[i], *observations[i]);
+
+  sendPositions();
+  waitForObservations();
+  nSteps++;
+
+  for (int i=0; i<nLearners; i++)
+    observations[i]->reward = sqrt( vel[i][0]*vel[i][0] + vel[i][1]*vel[i][1] ); // go fast
+}
+
+void InfluenceBatchEnvironment::sendPositions() {
+  mapper_timetag_t tt;
+  mdev_now(dev, &tt);
+  mdev_start_queue(dev, tt);
+  for (int i=0; i<nLearners; i++) {
+    float field[2];
+    InfluenceEnvironment::fieldPosition(pos[i], field);
+    msig_update_instance(outsig, i, field, 1, tt);
+  }
+  mdev_send_queue(dev, tt);
+}
+
+int InfluenceBatchEnvironment::waitForObservations() {
+  mapper_timetag_t now;
+  mdev_now(dev, &now);
+  double deadline = timetagSeconds(now) + stepTimeout / 1000.0;
+
+  int i, waiting = nLearners;
+  while (waiting) {
+    waiting = 0;
+    for (i=0; i<nLearners; i++) {
+      if (timetagSeconds(observationTick[i]) <= timetagSeconds(consumedTick[i]))
+        waiting++;
+    }
+    if (!waiting)
+      break;
+
+    mdev_now(dev, &now);
+    int remaining = (int)((deadline - timetagSeconds(now)) * 1000);
+    if (remaining <= 0)
+      break;
+    mdev_poll(dev, remaining);
+  }
+
+  for (i=0; i<nLearners; i++)
+    consumedTick[i] = observationTick[i];
+  nStaleSteps += waiting;
+  return waiting;
+}
+
+void InfluenceBatchEnvironment::updateInput(mapper_signal sig, mapper_db_signal props,
+                                             int instance_id, void *value, int count,
+                                             mapper_timetag_t *timetag) {
+  InfluenceBatchEnvironment* env = (InfluenceBatchEnvironment*)props->user_data;
+  if (!value || instance_id < 0 || instance_id >= env->nLearners)
+    return;
+
+  RLObservation& obs = *env->observations[instance_id];
+  float *v = (float*)value;
+  for (int i=0; i<props->length && i<(int)obs.dim; i++)
+    obs[i] = v[i];
+
+  if (timetag)
+    env->observationTick[instance_id] = *timetag;
+  else
+    mdev_now(env->dev, &env->observationTick[instance_id]);
+}
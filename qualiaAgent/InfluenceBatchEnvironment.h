@@ -0,0 +1,79 @@
+/*
+ * InfluenceBatchEnvironment.h
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INFLUENCEBATCHENVIRONMENT_H_
+#define INFLUENCEBATCHENVIRONMENT_H_
+
+#include "core/Action.h"
+#include "rl/RLObservation.h"
+#include "InfluenceEnvironment.h"
+#include <mapper/mapper.h>
+
+// Hosts several learners on a single device.  Each learner is one
+// instance of the /observation input and of the /position output, so a
+// whole batch of positions goes out in one queued bundle per tick and
+// observations come back on the same sockets.
+class InfluenceBatchEnvironment {
+public:
+  mapper_device dev;
+  const char* devNamePrefix;
+  const char* influenceName;
+  bool autoConnect;
+  int devInitialPort;
+  mapper_signal insig, outsig;
+
+  int nLearners;
+  int observationDim;
+  RLObservation** observations;
+
+  float (*pos)[2];
+  float (*vel)[2];
+
+  mapper_timetag_t *observationTick, *consumedTick;
+
+  int stepTimeout;
+  unsigned long nSteps, nStaleSteps;
+
+  InfluenceBatchEnvironment(int nLearners, int observationDim, const char *namePrefix,
+                            bool autoConnect = false, int initialPort = 9000, int stepTimeout = 100,
+                            const char *influenceName = "/influence.1");
+  virtual ~InfluenceBatchEnvironment();
+
+  virtual void init();
+
+  // Places every learner and waits for their first observations.
+  virtual void start();
+
+  // Applies one action per learner and waits for the next field tick.
+  virtual void step(Action* const* actions);
+
+  RLObservation* observation(int learner) { return observations[learner]; }
+
+  // Number of learners whose observation is older than the last step.
+  int waitForObservations();
+
+  static void updateInput(mapper_signal sig, mapper_db_signal props,
+                          int instance_id, void *value, int count,
+                          mapper_timetag_t *timetag);
+
+protected:
+  void sendPositions();
+};
+
+#endif /* INFLUENCEBATCHENVIRONMENT_H_ */
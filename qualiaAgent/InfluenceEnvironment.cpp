@@ -22,28 +22,65 @@
 #include <unistd.h>
 #include <stdio.h>
 
-InfluenceEnvironment::InfluenceEnvironment(int observationDim_, int actionDim_, const char *namePrefix, bool autoConnect_, int initialPort)
-  : devNamePrefix(namePrefix), autoConnect(autoConnect_), devInitialPort(initialPort), currentObservation(observationDim_), observationDim(observationDim_), actionDim(actionDim_) {
+InfluenceEnvironment::InfluenceEnvironment(int observationDim_, int actionDim_, const char *namePrefix, bool autoConnect_, int initialPort, int stepTimeout_, bool vectorPosition_,
+                                           const char *influenceName_)
+  : dev(0), devNamePrefix(namePrefix), autoConnect(autoConnect_), devInitialPort(initialPort), outsigX(0), outsigY(0),
+    vectorPosition(vectorPosition_), outsig(0), influenceName(influenceName_), shmName(0), shm(0), shmSlot(-1), shmTick(0), currentObservation(observationDim_), observationDim(observationDim_), actionDim(actionDim_),
+    stepTimeout(stepTimeout_), nSteps(0), nStaleSteps(0) {
+  observationTick.sec = observationTick.frac = 0;
+  consumedTick = observationTick;
 }
 
 InfluenceEnvironment::~InfluenceEnvironment() {
-  autoDisconnectDevice();
-  if (dev)
+  if (shm) {
+    shmt_release(shm, shmSlot);
+    shmt_detach(shm);
+  }
+  // autoDisconnectDevice() frees the device it connected
+  if (autoConnect)
+    autoDisconnectDevice();
+  else if (dev)
     mdev_free(dev);
 }
 
 void InfluenceEnvironment::init() {
   dev = mdev_new(devNamePrefix, devInitialPort, 0);
 
-  mdev_add_input(dev, "/observation", observationDim, 'f', 0, 0, 0,
-                 (mapper_signal_handler*)updateInput, this);
+  if (vectorPosition)
+    mdev_add_input(dev, "/observation", observationDim, 'f', 0, 0, 0,
+                   updateInstanceInput, this);
+  else
+    mdev_add_input(dev, "/observation", observationDim, 'f', 0, 0, 0,
+                   (mapper_signal_handler*)updateInput, this);
 
   // Output "action" is position (x,y)
-  outsigX = mdev_add_output(dev, "/position/x", 1, 'i', 0, 0, 0);
-  outsigY = mdev_add_output(dev, "/position/y", 1, 'i', 0, 0, 0);
+  if (vectorPosition) {
+    float mn = 0, mx = FIELD_SIZE;
+    outsig = mdev_add_output(dev, "/position", 2, 'f', 0, &mn, &mx);
+  }
+  else {
+    outsigX = mdev_add_output(dev, "/position/x", 1, 'i', 0, 0, 0);
+    outsigY = mdev_add_output(dev, "/position/y", 1, 'i', 0, 0, 0);
+  }
 
-  if (autoConnect)
-    autoConnectDevice(dev);
+  if (shmName) {
+    shm = shmt_attach(shmName);
+    if (shm && (shmSlot = shmt_claim(shm)) >= 0) {
+      // only observations newer than the slot's last one are ours
+      shmTick = shm->slots[shmSlot].obs_tick;
+      printf("Using shared memory %s, slot %d\n", shmName, shmSlot);
+      return;
+    }
+    printf("Shared memory %s not available, using libmapper\n", shmName);
+    shmt_detach(shm);
+    shm = 0;
+  }
+
+  // 0 if the connection timed out, the device already freed
+  if (autoConnect && vectorPosition)
+    dev = autoConnectInfluence(dev, influenceName);
+  else if (autoConnect)
+    dev = autoConnectDevice(dev);
 }
 
 Observation* InfluenceEnvironment::start() {
@@ -53,19 +90,56 @@ Observation* InfluenceEnvironment::start() {
   vel[0] = vel[1] = 0;
 
   // Send position.
+  sendPosition();
+
+  // Wait for response.
+  waitForObservation();
+  return &currentObservation;
+}
+
+void InfluenceEnvironment::sendPosition() {
+  if (shm) {
+    float field[2];
+    fieldPosition(pos, field);
+    shmt_write_position(&shm->slots[shmSlot], field);
+    return;
+  }
+
+  if (vectorPosition) {
+    // One message per step, stamped with the step's time
+    mapper_timetag_t tt;
+    float field[2];
+    fieldPosition(pos, field);
+    mdev_now(dev, &tt);
+    msig_update(outsig, field, 1, tt);
+    return;
+  }
+
   int x = (int)pos[0];
   int y = (int)pos[1];
   msig_update(outsigX, &x, 0, MAPPER_TIMETAG_NOW);
   msig_update(outsigY, &y, 0, MAPPER_TIMETAG_NOW);
-
-  // Wait for response.
-  mdev_poll(dev, 1000);
-  return &currentObservation;
 }
 
 Observation* InfluenceEnvironment::step(const Action* action) {
-  printf("Stepping env\n");
+  move(pos, vel, action, currentObservation);
+
+  // Send position.
+  sendPosition();
+  
+  // Wait for retroaction.
+  waitForObservation();
+  nSteps++;
+
+  // Compute reward.
+
+  currentObservation.reward = sqrt( vel[0]*vel[0] + vel[1]*vel[1] ); // go fast
+
+  return &currentObservation;
+}
 
+void InfluenceEnvironment::move(float pos[2], float vel[2], const Action* action,
+                                const RLObservation& observation) {
   // Update velocity depending on chosen action.
   float gain = 2;
   float limit = 1;
@@ -73,8 +147,8 @@ Observation* InfluenceEnvironment::step(const Action* action) {
   float magnet = (action->actions[0] == 0 ? -1 : +1);
   //vel[0] = vel[1] = gain;
   magnet = 1;
-  vel[0] += magnet * gain * (currentObservation[0] - currentObservation[2]);
-  vel[1] += magnet * gain * (currentObservation[1] - currentObservation[3]);
+  vel[0] += magnet * gain * (observation[0] - observation[2]);
+  vel[1] += magnet * gain * (observation[1] - observation[3]);
 
   pos[0] += vel[0];
   pos[1] += vel[1];
@@ -103,29 +177,84 @@ Observation* InfluenceEnvironment::step(const Action* action) {
     pos[1] = HEIGHT-1;
     vel[1] *= -0.95;
   }
+}
 
-  // Send position.
-  int x = (int)pos[0];
-  int y = (int)pos[1];
-  msig_update(outsigX, &x, 0, MAPPER_TIMETAG_NOW);
-  msig_update(outsigY, &y, 0, MAPPER_TIMETAG_NOW);
-  
-  // Wait for retroaction.
-  while (! mdev_poll(dev, 10) );
+void InfluenceEnvironment::setFieldObservation(RLObservation& observation,
+                                               const float field[2]) {
+  for (unsigned int i=0; i<observation.dim; i++)
+    observation[i] = (i < 2 ? field[i] : 0) * 0.5f + 0.5f;
+}
 
-  // Compute reward.
+void InfluenceEnvironment::fieldPosition(const float pos[2], float field[2]) {
+  field[0] = pos[0] * FIELD_SIZE / WIDTH;
+  field[1] = pos[1] * FIELD_SIZE / HEIGHT;
+}
 
-  currentObservation.reward = sqrt( vel[0]*vel[0] + vel[1]*vel[1] ); // go fast
+static double timetagSeconds(const mapper_timetag_t& tt) {
+  return tt.sec + tt.frac / 4294967296.0;
+}
 
-  printf("--> receiving reward = %f, data = %f ...\n", currentObservation.reward, currentObservation[0]);
+bool InfluenceEnvironment::waitForObservation() {
+  if (shm) {
+    float obs[3];
+    int tick = shmt_wait_observation(shm, shmSlot, shmTick, stepTimeout, obs);
+    if (tick < 0) {
+      nStaleSteps++;
+      return false;
+    }
+    shmTick = tick;
+    setFieldObservation(currentObservation, obs);
+    return true;
+  }
 
-  return &currentObservation;
+  mapper_timetag_t now;
+  mdev_now(dev, &now);
+  double deadline = timetagSeconds(now) + stepTimeout / 1000.0;
+
+  // mdev_poll() returns as soon as a message is handled, so this sleeps
+  // until the server's next tick reaches us rather than spinning.
+  while (timetagSeconds(observationTick) <= timetagSeconds(consumedTick)) {
+    mdev_now(dev, &now);
+    int remaining = (int)((deadline - timetagSeconds(now)) * 1000);
+    if (remaining <= 0) {
+      nStaleSteps++;
+      return false;
+    }
+    mdev_poll(dev, remaining);
+  }
+  consumedTick = observationTick;
+  return true;
 }
 
 void InfluenceEnvironment::updateInput(mapper_signal sig, mapper_db_signal props,
                                         mapper_timetag_t *timetag, float *value) {
-  printf("update input called %f\n", *value);
-  RLObservation& obs = ((InfluenceEnvironment*)props->user_data)->currentObservation;
+  InfluenceEnvironment* env = (InfluenceEnvironment*)props->user_data;
+  RLObservation& obs = env->currentObservation;
   for (unsigned int i=0; i<obs.dim; i++)
     obs[i] = value[i];
+
+  // The server stamps every observation of a field tick with that tick's
+  // timetag.
+  if (timetag)
+    env->observationTick = *timetag;
+  else
+    mdev_now(env->dev, &env->observationTick);
+}
+
+void InfluenceEnvironment::updateInstanceInput(mapper_signal sig, mapper_db_signal props,
+                                               int instance_id, void *value, int count,
+                                               mapper_timetag_t *timetag) {
+  InfluenceEnvironment* env = (InfluenceEnvironment*)props->user_data;
+  if (!value)
+    return;
+
+  RLObservation& obs = env->currentObservation;
+  float *v = (float*)value;
+  for (int i=0; i<props->length && i<(int)obs.dim; i++)
+    obs[i] = v[i];
+
+  if (timetag)
+    env->observationTick = *timetag;
+  else
+    mdev_now(env->dev, &env->observationTick);
 }
@@ -24,11 +24,17 @@
 #include "rl/RLObservation.h"
 #include "util/Random.h"
 #include "AutoConnect.h"
+#include "influence_shm.h"
 #include <mapper/mapper.h>
 
 #define WIDTH  640
 #define HEIGHT 480
 
+// The server's default field is FIELD_SIZE x FIELD_SIZE cells.  Agents
+// move in WIDTH x HEIGHT and are scaled to it wherever they reach the
+// field directly, rather than through a connection that scales them.
+#define FIELD_SIZE 500
+
 class InfluenceEnvironment : public Environment {
 public:
   mapper_device dev;
@@ -36,22 +42,75 @@ public:
   bool autoConnect;
   int devInitialPort;
   mapper_signal outsigX, outsigY;
+
+  // Publish the position as one 2-float "/position" vector in field
+  // cells, connected as an instance straight to the influence server's
+  // /node/position, instead of separate integer x and y signals.
+  bool vectorPosition;
+  mapper_signal outsig;
+  const char* influenceName;
+
+  // Shared-memory transport to a server on this host, if attached.
+  const char* shmName;
+  struct _shmTable* shm;
+  int shmSlot;
+  int shmTick;
   RLObservation currentObservation;
   int observationDim, actionDim;
 
   float pos[2];
   float vel[2];
 
-  InfluenceEnvironment(int observationDim, int actionDim, const char *namePrefix, bool autoConnect = false, int initialPort = 9000);
+  // Field tick (timetag) of the latest observation and of the last one
+  // handed to the agent.
+  mapper_timetag_t observationTick, consumedTick;
+
+  // Milliseconds to wait for a fresh observation before stepping on a
+  // stale one.
+  int stepTimeout;
+  unsigned long nSteps, nStaleSteps;
+
+  InfluenceEnvironment(int observationDim, int actionDim, const char *namePrefix, bool autoConnect = false, int initialPort = 9000, int stepTimeout = 100, bool vectorPosition = false,
+                       const char *influenceName = "/influence.1");
   virtual ~InfluenceEnvironment();
 
   virtual void init();
   virtual Observation* start();
+
+  // Exchanges positions and observations with a local server through
+  // the shared-memory table <name> instead of libmapper.  Call before
+  // init(); falls back to libmapper if the table is not there.
+  void useSharedMemory(const char* name) { shmName = name; }
   virtual Observation* step(const Action* action);
 
+  // Motion model shared by all influence environments: the action and
+  // observation update the velocity, which moves the position.
+  static void move(float pos[2], float vel[2], const Action* action,
+                   const RLObservation& observation);
+
+  // Fills every dimension of the observation from the server's 2-d
+  // field vector in [-1,1], scaled to [0,1] as the proxy's observation
+  // connection does.  Dimensions past the vector hold the scaled zero.
+  static void setFieldObservation(RLObservation& observation, const float field[2]);
+
+  // Scales a position in WIDTH x HEIGHT to the server's field cells.
+  static void fieldPosition(const float pos[2], float field[2]);
+
+  // Publishes the current position to the field.
+  virtual void sendPosition();
+
+  // Waits until an observation from a newer field tick has arrived.
+  // Returns false if the timeout expired first.
+  virtual bool waitForObservation();
+
   static void updateInput(mapper_signal sig, mapper_db_signal props,
                           mapper_timetag_t *timetag, float *value);
 
+  // Observations of our instance on the server, with vectorPosition.
+  static void updateInstanceInput(mapper_signal sig, mapper_db_signal props,
+                                  int instance_id, void *value, int count,
+                                  mapper_timetag_t *timetag);
+
 
 };
 
@@ -0,0 +1,52 @@
+/*
+ * OfflineInfluenceEnvironment.cpp
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OfflineInfluenceEnvironment.h"
+
+OfflineInfluenceEnvironment::OfflineInfluenceEnvironment(int observationDim_, int actionDim_, int passes_,
+                                                         float agentGain_, float agentFade_)
+  : InfluenceEnvironment(observationDim_, actionDim_, "agent", false), field(0), passes(passes_),
+    agentGain(agentGain_), agentFade(agentFade_) {
+}
+
+OfflineInfluenceEnvironment::~OfflineInfluenceEnvironment() {
+  vfcpu_free(field);
+}
+
+void OfflineInfluenceEnvironment::init() {
+  field = vfcpu_new(FIELD_SIZE, FIELD_SIZE);
+}
+
+void OfflineInfluenceEnvironment::sendPosition() {
+  // Nothing to send, the field reads pos[] directly.
+}
+
+bool OfflineInfluenceEnvironment::waitForObservation() {
+  float obs[3], p[2];
+  fieldPosition(pos, p);
+  for (int i=0; i<passes; i++) {
+    vfcpu_begin_pass(field);
+    vfcpu_draw_agent(field, p[0], p[1], agentGain, agentFade, obs);
+    vfcpu_convolve(field);
+  }
+
+  // obs[0..1] has the layout of the server's /node/observation
+  setFieldObservation(currentObservation, obs);
+  return true;
+}
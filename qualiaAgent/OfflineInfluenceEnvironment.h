@@ -0,0 +1,49 @@
+/*
+ * OfflineInfluenceEnvironment.h
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OFFLINEINFLUENCEENVIRONMENT_H_
+#define OFFLINEINFLUENCEENVIRONMENT_H_
+
+#include "InfluenceEnvironment.h"
+#include "influence_cpu.h"
+
+// Trains against an in-process copy of the influence field instead of
+// the live server.  The field is stepped synchronously each time the
+// agent moves, with no libmapper device, so training runs as fast as
+// the CPU allows.  Motion, observations and rewards are those of
+// InfluenceEnvironment, so policies carry over to the live server:
+// positions are scaled to the server's field as the position
+// connection scales them, and observations as the proxy scales them.
+class OfflineInfluenceEnvironment : public InfluenceEnvironment {
+public:
+  struct _vfcpu_field *field;
+  int passes;
+  float agentGain;
+  float agentFade;
+
+  OfflineInfluenceEnvironment(int observationDim, int actionDim, int passes = 1,
+                              float agentGain = 1, float agentFade = 0);
+  virtual ~OfflineInfluenceEnvironment();
+
+  virtual void init();
+  virtual void sendPosition();
+  virtual bool waitForObservation();
+};
+
+#endif /* OFFLINEINFLUENCEENVIRONMENT_H_ */
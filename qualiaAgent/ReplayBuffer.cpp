@@ -0,0 +1,184 @@
+/*
+ * ReplayBuffer.cpp
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ReplayBuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+ReplayBuffer::ReplayBuffer()
+  : header(0), records(0), mapSize(0), seed(1) {
+}
+
+ReplayBuffer::~ReplayBuffer() {
+  close();
+}
+
+bool ReplayBuffer::open(const char* path, unsigned long long capacity,
+                        unsigned int observationDim, unsigned int actionDim) {
+  unsigned int headerSize = 64;
+  unsigned int recordSize = (1 + 2 * observationDim) * sizeof(float)
+                            + actionDim * sizeof(unsigned int);
+
+  if (capacity <= 2 * REPLAY_GUARD) {
+    printf("Replay capacity must be over %d transitions\n", 2 * REPLAY_GUARD);
+    return false;
+  }
+
+  int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    printf("Could not open replay file %s\n", path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st)) {
+    printf("Could not open replay file %s\n", path);
+    ::close(fd);
+    return false;
+  }
+  bool fresh = (st.st_size == 0);
+  ReplayHeader existing;
+  if (!fresh) {
+    if (pread(fd, &existing, sizeof(existing), 0) != sizeof(existing)
+        || memcmp(existing.magic, REPLAY_MAGIC, 8)
+        || existing.recordSize != recordSize
+        || existing.observationDim != observationDim
+        || existing.actionDim != actionDim) {
+      printf("Replay file %s does not match %u observations, %u actions\n",
+             path, observationDim, actionDim);
+      ::close(fd);
+      return false;
+    }
+    capacity = existing.capacity;
+  }
+
+  // A truncated file would fault on the first access past its end
+  if (!fresh && (capacity <= 2 * REPLAY_GUARD
+                 || (unsigned long long)st.st_size < headerSize
+                 || capacity > ((unsigned long long)st.st_size - headerSize)
+                               / recordSize)) {
+    printf("Replay file %s is shorter than its %llu transitions\n",
+           path, capacity);
+    ::close(fd);
+    return false;
+  }
+
+  mapSize = headerSize + capacity * recordSize;
+  if (fresh && ftruncate(fd, mapSize)) {
+    printf("Could not size replay file %s\n", path);
+    ::close(fd);
+    return false;
+  }
+
+  void* map = mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    printf("Could not map replay file %s\n", path);
+    return false;
+  }
+  // Sampling touches records at random
+  madvise(map, mapSize, MADV_RANDOM);
+
+  header = (ReplayHeader*)map;
+  records = (char*)map + headerSize;
+  if (fresh) {
+    memcpy(header->magic, REPLAY_MAGIC, 8);
+    header->headerSize = headerSize;
+    header->recordSize = recordSize;
+    header->observationDim = observationDim;
+    header->actionDim = actionDim;
+    header->capacity = capacity;
+    header->head = 0;
+  }
+  else
+    printf("Replay file %s: %llu transitions\n", path, size());
+  return true;
+}
+
+void ReplayBuffer::close() {
+  if (header)
+    munmap(header, mapSize);
+  header = 0;
+  records = 0;
+}
+
+void ReplayBuffer::append(const float* observation, const unsigned int* action,
+                          float reward, const float* nextObservation) {
+  unsigned long long head = header->head;
+  unsigned int dim = header->observationDim;
+  float* rec = slot(head);
+  rec[0] = reward;
+  memcpy(rec + 1, observation, dim * sizeof(float));
+  memcpy(rec + 1 + dim, nextObservation, dim * sizeof(float));
+  memcpy(rec + 1 + 2 * dim, action, header->actionDim * sizeof(unsigned int));
+
+  // Publish the record only once it is complete
+  __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void ReplayBuffer::append(const Observation& observation, const Action& action,
+                          float reward, const Observation& nextObservation) {
+  unsigned int dim = header->observationDim;
+  float obs[dim], next[dim];
+  unsigned int act[header->actionDim];
+  for (unsigned int i=0; i<dim; i++) {
+    obs[i] = observation[i];
+    next[i] = nextObservation[i];
+  }
+  for (unsigned int i=0; i<header->actionDim; i++)
+    act[i] = const_cast<Action&>(action)[i];
+  append(obs, act, reward, next);
+}
+
+unsigned long long ReplayBuffer::size() const {
+  unsigned long long head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  if (head < header->capacity)
+    return head;
+  return header->capacity - REPLAY_GUARD;
+}
+
+const float* ReplayBuffer::sample() {
+  const float* rec;
+  return sampleBatch(&rec, 1) ? rec : 0;
+}
+
+int ReplayBuffer::sampleBatch(const float** batch, int n, unsigned int* state) {
+  unsigned long long head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  unsigned long long count = head < header->capacity
+                             ? head : header->capacity - REPLAY_GUARD;
+  if (!count)
+    return 0;
+
+  // xorshift, cheap enough to keep out of the way of the copy-free reads
+  unsigned int s = *state;
+  for (int i=0; i<n; i++) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    unsigned long long r = ((unsigned long long)s << 32) ^ s * 2654435761u;
+    batch[i] = slot(head - 1 - r % count);
+  }
+  *state = s;
+  return n;
+}
@@ -0,0 +1,96 @@
+/*
+ * ReplayBuffer.h
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPLAYBUFFER_H_
+#define REPLAYBUFFER_H_
+
+#include "core/Action.h"
+#include "core/Observation.h"
+
+#define REPLAY_MAGIC "INFLRPL1"
+
+// Records older than head - capacity + REPLAY_GUARD are never sampled,
+// so a reader never lands on the slot the writer is about to reuse.
+#define REPLAY_GUARD 1024
+
+// Start of the file; records follow at headerSize.
+struct ReplayHeader {
+  char magic[8];
+  unsigned int headerSize;
+  unsigned int recordSize;
+  unsigned int observationDim;
+  unsigned int actionDim;
+  unsigned long long capacity;
+  unsigned long long head;      // transitions ever appended
+};
+
+// A ring of (observation, action, reward, next observation) transitions
+// in a memory-mapped file.  Each record is laid out as
+//   float reward, float obs[observationDim], float next[observationDim],
+//   unsigned int action[actionDim]
+// One thread appends; any number of threads or processes may sample,
+// each thread passing its own random state to sampleBatch().  Reopening a file with the same dimensions picks up where it left off.
+class ReplayBuffer {
+public:
+  ReplayHeader* header;
+  char* records;
+  unsigned long long mapSize;
+  // Random state of sample() and sampleBatch() without a state, so those
+  // are for a single thread.
+  unsigned int seed;
+
+  ReplayBuffer();
+  virtual ~ReplayBuffer();
+
+  bool open(const char* path, unsigned long long capacity,
+            unsigned int observationDim, unsigned int actionDim);
+  void close();
+
+  void append(const float* observation, const unsigned int* action,
+              float reward, const float* nextObservation);
+  void append(const Observation& observation, const Action& action,
+              float reward, const Observation& nextObservation);
+
+  // Number of transitions that can currently be sampled.
+  unsigned long long size() const;
+
+  // Random record, pointing into the mapping; 0 if the buffer is empty.
+  const float* sample();
+
+  // Fills batch[] with up to n random records and returns the count.
+  // state is the caller's random state, non-zero, advanced by each call.
+  int sampleBatch(const float** batch, int n, unsigned int* state);
+  int sampleBatch(const float** batch, int n) { return sampleBatch(batch, n, &seed); }
+
+  float reward(const float* record) const { return record[0]; }
+  const float* observation(const float* record) const { return record + 1; }
+  const float* nextObservation(const float* record) const {
+    return record + 1 + header->observationDim;
+  }
+  const unsigned int* action(const float* record) const {
+    return (const unsigned int*)(record + 1 + 2 * header->observationDim);
+  }
+
+protected:
+  float* slot(unsigned long long i) const {
+    return (float*)(records + (i % header->capacity) * header->recordSize);
+  }
+};
+
+#endif /* REPLAYBUFFER_H_ */
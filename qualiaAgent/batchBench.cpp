@@ -0,0 +1,162 @@
+/*
+ * batchBench.cpp
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares K learners stepped on one batched device against K processes
+// with one learner each, against a running influence server.  Actions
+// are random so only the environment and transport are measured; each
+// run writes one CSV row, including the time until every device was
+// connected.
+
+#include "InfluenceBatchEnvironment.h"
+#include "AutoConnect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_SWEEP 16
+#define DIM_OBSERVATIONS 4
+#define STEP_TIMEOUT 100
+
+struct BenchResult {
+  unsigned long steps, stale;
+  double elapsed;
+  double connect;   // seconds autoconnect took
+};
+
+double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Steps nLearners learners on one device for the given time.
+bool runLearners(int nLearners, double duration, int stepTimeout, BenchResult& result) {
+  InfluenceBatchEnvironment env(nLearners, DIM_OBSERVATIONS, "agents", true, 9000, stepTimeout);
+  env.init();
+  if (!env.dev)
+    return false;
+  result.connect = autoConnectElapsed();
+
+  Action** actions = new Action*[nLearners];
+  for (int k=0; k<nLearners; k++)
+    actions[k] = new Action(1);
+
+  env.start();
+  unsigned long stale = env.nStaleSteps;
+  double start = wallClock();
+  while (wallClock() - start < duration) {
+    for (int k=0; k<nLearners; k++)
+      actions[k]->actions[0] = rand() % 2;
+    env.step(actions);
+  }
+  result.elapsed = wallClock() - start;
+  result.steps = env.nSteps * nLearners;
+  result.stale = env.nStaleSteps - stale;
+
+  for (int k=0; k<nLearners; k++)
+    delete actions[k];
+  delete[] actions;
+  return true;
+}
+
+void report(const char* mode, int nLearners, const BenchResult& r) {
+  printf("%s,%d,%.3f,%lu,%.3f,%.1f,%.4f\n", mode, nLearners, r.connect,
+         r.steps, r.elapsed, r.elapsed > 0 ? r.steps / r.elapsed : 0,
+         r.steps ? (double)r.stale / r.steps : 0);
+  fflush(stdout);
+}
+
+void runBatched(int nLearners, double duration, int stepTimeout) {
+  BenchResult r;
+  if (runLearners(nLearners, duration, stepTimeout, r))
+    report("batched", nLearners, r);
+  autoConnectFree();
+}
+
+// Each child runs one learner on its own device and reports through a pipe.
+void runForked(int nLearners, double duration, int stepTimeout) {
+  int fds[2];
+  if (pipe(fds)) {
+    perror("pipe");
+    return;
+  }
+  fflush(stdout);
+  for (int k=0; k<nLearners; k++) {
+    if (fork() == 0) {
+      close(fds[0]);
+      srand(100 + k);
+      BenchResult r;
+      if (runLearners(1, duration, stepTimeout, r)
+          && write(fds[1], &r, sizeof(r)) != sizeof(r))
+        perror("write");
+      autoConnectFree();
+      _exit(0);
+    }
+  }
+  close(fds[1]);
+
+  // The fleet is connected when its slowest process is
+  BenchResult total = { 0, 0, 0, 0 }, r;
+  int nReported = 0;
+  while (read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+    total.steps += r.steps;
+    total.stale += r.stale;
+    if (r.elapsed > total.elapsed)
+      total.elapsed = r.elapsed;
+    if (r.connect > total.connect)
+      total.connect = r.connect;
+    nReported++;
+  }
+  close(fds[0]);
+  while (wait(0) > 0) {}
+
+  if (nReported < nLearners)
+    printf("Only %d of %d processes connected\n", nReported, nLearners);
+  report("forked", nLearners, total);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && argv[1][0] == '-') {
+    printf("Usage: %s [duration_s=10] [step_timeout_ms=%d] [n_learners ...]\n",
+           argv[0], STEP_TIMEOUT);
+    return 1;
+  }
+  double duration = (argc > 1 ? atof(argv[1]) : 10);
+  int stepTimeout = (argc > 2 ? atoi(argv[2]) : STEP_TIMEOUT);
+
+  int counts[MAX_SWEEP] = { 1, 4, 16, 50 };
+  int nCounts = 4;
+  if (argc > 3) {
+    nCounts = 0;
+    for (int i=3; i<argc && nCounts<MAX_SWEEP; i++)
+      counts[nCounts++] = atoi(argv[i]);
+  }
+
+  printf("mode,learners,connect_s,steps,elapsed_s,steps_per_s,stale_fraction\n");
+  for (int i=0; i<nCounts; i++) {
+    srand(100);
+    runBatched(counts[i], duration, stepTimeout);
+    runForked(counts[i], duration, stepTimeout);
+  }
+  return 0;
+}
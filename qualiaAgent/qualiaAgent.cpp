@@ -28,6 +28,10 @@
 #include "rl/RLQualia.h"
 
 #include "InfluenceEnvironment.h"
+#include "InfluenceBatchEnvironment.h"
+#include "OfflineInfluenceEnvironment.h"
+#include "ReplayBuffer.h"
+#include "AutoConnect.h"
 
 //#define STATIC_ALLOCATOR_SIZE 10000
 //#include "StaticAllocator.h"
@@ -47,10 +51,15 @@
 #define LAMBDA 0.3f
 #define GAMMA 0.99f
 
+#define STEP_TIMEOUT 100
+
+#define REPLAY_CAPACITY 10000000
+
 const unsigned int N_ACTIONS[] = { 2 };
 
 #include <stdio.h>
 #include <cstring>
+#include <sys/time.h>
 
 int done = 0;
 
@@ -59,14 +68,126 @@ void ctrlc(int sig)
     done = 1;
 }
 
+double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Publishes how long autoconnect took on the device, so a monitor can
+// collect the time to connected of a whole fleet of agents.
+void publishConnectTime(mapper_device dev) {
+  double elapsed = autoConnectElapsed();
+  if (!dev || elapsed < 0)
+    return;
+  printf("Time to connected: %f s\n", elapsed);
+  float t = elapsed;
+  mapper_signal sig = mdev_add_output(dev, "/connect_time", 1, 'f', "s", 0, 0);
+  msig_update(sig, &t, 1, MAPPER_NOW);
+}
+
+// Steps nLearners independent learners together on one batched device.
+int runBatch(int nLearners, int nHidden, float learningRate, float epsilon,
+             float lambda, float gamma, int dimObservations, bool autoConnect,
+             int stepTimeout) {
+  QLearningEGreedyPolicy** policies = new QLearningEGreedyPolicy*[nLearners];
+  NeuralNetwork** nets = new NeuralNetwork*[nLearners];
+  QLearningAgent** agents = new QLearningAgent*[nLearners];
+  Action** actions = new Action*[nLearners];
+  for (int k=0; k<nLearners; k++) {
+    policies[k] = new QLearningEGreedyPolicy(epsilon);
+    nets[k] = new NeuralNetwork(dimObservations + DIM_ACTIONS, nHidden, 1, learningRate);
+    agents[k] = new QLearningAgent(nets[k], dimObservations, DIM_ACTIONS, N_ACTIONS,
+                                   lambda, gamma, policies[k], false);
+  }
+  InfluenceBatchEnvironment env(nLearners, dimObservations, "agents", autoConnect, 9000, stepTimeout);
+
+  env.init();
+  if (!env.dev)
+    return 1;
+  publishConnectTime(env.dev);
+  env.start();
+  for (int k=0; k<nLearners; k++) {
+    agents[k]->init();
+    actions[k] = agents[k]->start(env.observation(k));
+  }
+
+  while (!done) {
+    unsigned long nSteps = 0;
+    unsigned long nStale = env.nStaleSteps;
+    float totalReward = 0;
+    double startTime = wallClock();
+    for (int i=0; i<2400; i++) {
+      env.step(actions);
+      for (int k=0; k<nLearners; k++) {
+        actions[k] = agents[k]->step(env.observation(k));
+        totalReward += env.observation(k)->reward;
+      }
+      nSteps += nLearners;
+    }
+#if is_computer()
+    printf("Mean reward: %f\n", (double) totalReward / nSteps);
+    printf("Steps per second: %f over %d learners (%lu stale)\n",
+           nSteps / (wallClock() - startTime), nLearners, env.nStaleSteps - nStale);
+#endif
+  }
+
+  for (int k=0; k<nLearners; k++) {
+    delete agents[k];
+    delete nets[k];
+    delete policies[k];
+  }
+  delete[] agents;
+  delete[] nets;
+  delete[] policies;
+  delete[] actions;
+  return 0;
+}
+
 //unsigned char buffer[STATIC_ALLOCATOR_SIZE];
 //StaticAllocator myAlloc(buffer, STATIC_ALLOCATOR_SIZE);
 int main(int argc, char** argv) {
   signal(SIGINT, ctrlc);
 
-  if (argc > 8 || (argc > 1 && strcmp(argv[1], "-h") == 0)) {
-    printf("Usage: %s [n_hidden=%d] [learning_rate=%f] [epsilon=%f] [lambda=%f] [gamma=%f] [dim_observations=%d] [autoconnect=0]\n",
-            argv[0], N_HIDDEN, LEARNING_RATE, EPSILON, LAMBDA, GAMMA, DIM_OBSERVATIONS);
+  // -o trains offline against an in-process field
+  // -b <file> records transitions to a replay file
+  // -t <seconds> bounds how long autoconnect may take
+  // -v sends the position as one float vector, straight to the server
+  // -s <name> talks to a local server through shared memory
+  bool offline = false;
+  const char* shmName = 0;
+  bool vectorPosition = false;
+  const char* replayFile = 0;
+  while (argc > 1) {
+    if (strcmp(argv[1], "-o") == 0)
+      offline = true;
+    else if (strcmp(argv[1], "-v") == 0)
+      vectorPosition = true;
+    else if (strcmp(argv[1], "-s") == 0 && argc > 2) {
+      shmName = argv[2];
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-b") == 0 && argc > 2) {
+      replayFile = argv[2];
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-t") == 0 && argc > 2) {
+      autoConnectSetTimeout(atof(argv[2]));
+      argv++;
+      argc--;
+    }
+    else
+      break;
+    argv++;
+    argc--;
+  }
+
+  if (argc > 10 || (argc > 1 && strcmp(argv[1], "-h") == 0)) {
+    printf("Usage: %s [-o] [-b replay_file] [-t connect_timeout_s] [-v] [-s shm_name] [n_hidden=%d] [learning_rate=%f] [epsilon=%f] [lambda=%f] [gamma=%f] [dim_observations=%d] [autoconnect=0] [step_timeout_ms=%d] [n_learners=1]\n",
+            argv[0], N_HIDDEN, LEARNING_RATE, EPSILON, LAMBDA, GAMMA, DIM_OBSERVATIONS, STEP_TIMEOUT);
     exit(-1);
   }
 
@@ -78,6 +199,8 @@ int main(int argc, char** argv) {
   float gamma         = (++arg < argc ? atof(argv[arg]) : GAMMA);
   int dimObservations = (++arg < argc ? atoi(argv[arg]) : DIM_OBSERVATIONS);
   bool autoConnect    = (++arg < argc ? atoi(argv[arg]) : true);
+  int stepTimeout     = (++arg < argc ? atoi(argv[arg]) : STEP_TIMEOUT);
+  int nLearners       = (++arg < argc ? atoi(argv[arg]) : 1);
 
   printf("N hidden: %d\n", nHidden);
   printf("Learning rate: %f\n", learningRate);
@@ -85,28 +208,70 @@ int main(int argc, char** argv) {
   printf("Lambda: %f\n", lambda);
   printf("Gamma: %f\n", gamma);
 
+  // Several learners share one device and one polling loop
+  if (nLearners > 1) {
+    int ret = runBatch(nLearners, nHidden, learningRate, epsilon, lambda, gamma,
+                       dimObservations, autoConnect, stepTimeout);
+    autoConnectFree();
+    return ret;
+  }
+
   //Alloc::init(&myAlloc);
 //  DummyAgent agent;
   QLearningEGreedyPolicy egreedy(epsilon);
   NeuralNetwork net(dimObservations + DIM_ACTIONS, nHidden, 1, learningRate);
   QLearningAgent agent(&net, dimObservations, DIM_ACTIONS, N_ACTIONS,
                        lambda, gamma, &egreedy, false); // lambda = 1.0 => no history
-  InfluenceEnvironment env(dimObservations, DIM_ACTIONS, "agent", autoConnect, 9000);
+  InfluenceEnvironment* penv;
+  if (offline)
+    penv = new OfflineInfluenceEnvironment(dimObservations, DIM_ACTIONS);
+  else
+    penv = new InfluenceEnvironment(dimObservations, DIM_ACTIONS, "agent", autoConnect, 9000, stepTimeout,
+                                    vectorPosition);
+  if (shmName)
+    penv->useSharedMemory(shmName);
+  InfluenceEnvironment& env = *penv;
   RLQualia qualia(&agent, &env);
 
+  ReplayBuffer* replay = 0;
+  if (replayFile) {
+    replay = new ReplayBuffer();
+    if (!replay->open(replayFile, REPLAY_CAPACITY, dimObservations, DIM_ACTIONS))
+      return 1;
+  }
+  RLObservation lastObservation(dimObservations);
+  Action lastAction(DIM_ACTIONS);
+
   qualia.init();
+  if (!offline && !env.dev)
+    return 1;
+  if (autoConnect && !offline && !env.shm)
+    publishConnectTime(env.dev);
   qualia.start();
 
   while (!done) {
     unsigned long nSteps = 0;
+    unsigned long nStale = env.nStaleSteps;
     float totalReward = 0;
+    double startTime = wallClock();
     for (int i=0; i<2400; i++) {
+      if (replay) {
+        for (int k=0; k<dimObservations; k++)
+          lastObservation[k] = env.currentObservation[k];
+        for (int k=0; k<DIM_ACTIONS; k++)
+          lastAction[k] = agent.currentAction[k];
+      }
       qualia.step();
       nSteps++;
       totalReward += env.currentObservation.reward;
+      if (replay)
+        replay->append(lastObservation, lastAction,
+                       env.currentObservation.reward, env.currentObservation);
     }
 #if is_computer()
     printf("Mean reward: %f\n", (double) totalReward / nSteps);
+    printf("Steps per second: %f (%lu stale)\n",
+           nSteps / (wallClock() - startTime), env.nStaleSteps - nStale);
 //    printf("Current agent action: [%d %d] = %d\n", agent.currentAction[0], agent.currentAction[1], agent.currentAction.conflated());
 //    printf("Current environment observation: [%f %f] => %f\n", env.currentObservation[0], env.currentObservation[1], env.currentObservation.reward);
 //    printf("Current agent action: %d\n", (int) agent.currentAction.conflated());
@@ -116,7 +281,9 @@ int main(int argc, char** argv) {
 //    printf("\n");
 #endif
   }
-  autoDisconnectDevice();
+  delete penv;
+  delete replay;
+  autoConnectFree();
 
 //  if (myAlloc.nLeaks)
 //    printf("WARNING: Static Allocator has leaks: %d\n", myAlloc.nLeaks);
@@ -0,0 +1,292 @@
+/*
+ * qualiaSweep.cpp
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Trains one learner per hyperparameter configuration on a pool of
+// worker processes, each against its own offline copy of the field, and
+// writes one CSV line per configuration.  Qualia and the environment
+// draw from the process-wide rand(), so each configuration runs in its
+// own process, seeded from the sweep seed and its index, and its result
+// does not depend on how the runs are scheduled.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "core/Qualia.h"
+#include "rl/QLearningAgent.h"
+#include "rl/QLearningEGreedyPolicy.h"
+#include "rl/NeuralNetwork.h"
+#include "rl/RLQualia.h"
+
+#include "OfflineInfluenceEnvironment.h"
+
+#define DIM_OBSERVATIONS 4
+#define DIM_ACTIONS 1
+
+const unsigned int N_ACTIONS[] = { 2 };
+
+// Grid values; random samples are drawn from the same ranges
+const int   GRID_HIDDEN[]   = { 3, 5, 10 };
+const float GRID_RATE[]     = { 0.01f, 0.1f, 0.3f };
+const float GRID_EPSILON[]  = { 0.05f, 0.1f, 0.2f };
+const float GRID_LAMBDA[]   = { 0.0f, 0.3f, 0.7f };
+const float GRID_GAMMA[]    = { 0.9f, 0.99f };
+
+#define LEN(a) (int)(sizeof(a) / sizeof(a[0]))
+
+struct _config
+{
+    int     n_hidden;
+    float   learning_rate;
+    float   epsilon;
+    float   lambda;
+    float   gamma;
+    double  mean_reward;
+    double  steps_per_second;
+};
+
+// What a worker process sends back, small enough to be written atomically
+struct _result
+{
+    int     index;
+    double  mean_reward;
+    double  steps_per_second;
+};
+
+struct _config *configs = 0;
+int num_configs = 0;
+int num_steps = 24000;
+int passes = 1;
+unsigned int seed = 1;
+
+FILE *results = 0;
+
+double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+float uniform(float lo, float hi)
+{
+    return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+void make_grid()
+{
+    num_configs = LEN(GRID_HIDDEN) * LEN(GRID_RATE) * LEN(GRID_EPSILON)
+                  * LEN(GRID_LAMBDA) * LEN(GRID_GAMMA);
+    configs = (struct _config*)calloc(num_configs, sizeof(struct _config));
+
+    int i = 0, h, r, e, l, g;
+    for (h = 0; h < LEN(GRID_HIDDEN); h++)
+    for (r = 0; r < LEN(GRID_RATE); r++)
+    for (e = 0; e < LEN(GRID_EPSILON); e++)
+    for (l = 0; l < LEN(GRID_LAMBDA); l++)
+    for (g = 0; g < LEN(GRID_GAMMA); g++, i++) {
+        configs[i].n_hidden = GRID_HIDDEN[h];
+        configs[i].learning_rate = GRID_RATE[r];
+        configs[i].epsilon = GRID_EPSILON[e];
+        configs[i].lambda = GRID_LAMBDA[l];
+        configs[i].gamma = GRID_GAMMA[g];
+    }
+}
+
+void make_random(int n)
+{
+    num_configs = n;
+    configs = (struct _config*)calloc(num_configs, sizeof(struct _config));
+
+    int i;
+    for (i = 0; i < n; i++) {
+        configs[i].n_hidden = GRID_HIDDEN[0]
+            + rand() % (GRID_HIDDEN[LEN(GRID_HIDDEN)-1] - GRID_HIDDEN[0] + 1);
+        // learning rate is sampled on a log scale
+        configs[i].learning_rate =
+            exp(uniform(log(GRID_RATE[0]), log(GRID_RATE[LEN(GRID_RATE)-1])));
+        configs[i].epsilon =
+            uniform(GRID_EPSILON[0], GRID_EPSILON[LEN(GRID_EPSILON)-1]);
+        configs[i].lambda =
+            uniform(GRID_LAMBDA[0], GRID_LAMBDA[LEN(GRID_LAMBDA)-1]);
+        configs[i].gamma =
+            uniform(GRID_GAMMA[0], GRID_GAMMA[LEN(GRID_GAMMA)-1]);
+    }
+}
+
+void run_config(struct _config *c)
+{
+    QLearningEGreedyPolicy egreedy(c->epsilon);
+    NeuralNetwork net(DIM_OBSERVATIONS + DIM_ACTIONS, c->n_hidden, 1,
+                      c->learning_rate);
+    QLearningAgent agent(&net, DIM_OBSERVATIONS, DIM_ACTIONS, N_ACTIONS,
+                         c->lambda, c->gamma, &egreedy, false);
+    OfflineInfluenceEnvironment env(DIM_OBSERVATIONS, DIM_ACTIONS, passes);
+    RLQualia qualia(&agent, &env);
+
+    qualia.init();
+    qualia.start();
+
+    double total_reward = 0;
+    double start = wallClock();
+    int i;
+    for (i = 0; i < num_steps; i++) {
+        qualia.step();
+        total_reward += env.currentObservation.reward;
+    }
+    c->steps_per_second = num_steps / (wallClock() - start);
+    c->mean_reward = total_reward / num_steps;
+}
+
+void worker(int i, int fd)
+{
+    struct _result r;
+    srand(seed * 7919 + i);
+    run_config(&configs[i]);
+    r.index = i;
+    r.mean_reward = configs[i].mean_reward;
+    r.steps_per_second = configs[i].steps_per_second;
+    if (write(fd, &r, sizeof(r)) != sizeof(r))
+        perror("write");
+}
+
+void record_result(const struct _result *r, int done)
+{
+    struct _config *c = &configs[r->index];
+    c->mean_reward = r->mean_reward;
+    c->steps_per_second = r->steps_per_second;
+    fprintf(results, "%d,%g,%g,%g,%g,%f,%.0f\n", c->n_hidden,
+            c->learning_rate, c->epsilon, c->lambda, c->gamma,
+            c->mean_reward, c->steps_per_second);
+    fflush(results);
+    printf("Configuration %d (%d/%d done): mean reward %f\n", r->index + 1,
+           done, num_configs, c->mean_reward);
+}
+
+int main(int argc, char** argv)
+{
+    int c, i, num_workers = sysconf(_SC_NPROCESSORS_ONLN), num_random = 0;
+    const char *filename = "sweep.csv";
+
+    while ((c = getopt(argc, argv, "hj:n:s:p:o:r:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h': // Help
+            printf("Usage: qualiaSweep [-h] [-j <workers>] [-n <samples>] "
+                   "[-s <steps>] [-p <passes>] [-o <file>] [-r <seed>]\n");
+            printf("  -h  Help\n");
+            printf("  -j  Worker processes, default=%d\n", num_workers);
+            printf("  -n  Random configurations to sample, "
+                   "default is the full grid\n");
+            printf("  -s  Training steps per configuration, default=%d\n",
+                   num_steps);
+            printf("  -p  Field passes per step, default=%d\n", passes);
+            printf("  -o  Results file, default=%s\n", filename);
+            printf("  -r  Random seed for sampling, default=%u\n", seed);
+            exit(0);
+        case 'j':
+            num_workers = atoi(optarg);
+            break;
+        case 'n':
+            num_random = atoi(optarg);
+            break;
+        case 's':
+            num_steps = atoi(optarg);
+            break;
+        case 'p':
+            passes = atoi(optarg);
+            break;
+        case 'o':
+            filename = optarg;
+            break;
+        case 'r':
+            seed = atoi(optarg);
+            break;
+        default:
+            exit(1);
+        }
+    }
+    if (num_workers < 1)
+        num_workers = 1;
+
+    srand(seed);
+    if (num_random > 0)
+        make_random(num_random);
+    else
+        make_grid();
+
+    results = fopen(filename, "w");
+    if (!results) {
+        printf("Could not open %s\n", filename);
+        return 1;
+    }
+    fprintf(results, "n_hidden,learning_rate,epsilon,lambda,gamma,"
+            "mean_reward,steps_per_second\n");
+
+    int fds[2];
+    if (pipe(fds)) {
+        perror("pipe");
+        return 1;
+    }
+    // a worker that dies sends nothing, so never block on the pipe
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    printf("Running %d configurations on %d workers\n", num_configs,
+           num_workers);
+    fflush(stdout);
+    double start = wallClock();
+
+    int running = 0, done = 0;
+    struct _result r;
+    for (i = 0; i < num_configs || running; ) {
+        if (i < num_configs && running < num_workers) {
+            if (fork() == 0) {
+                close(fds[0]);
+                worker(i, fds[1]);
+                _exit(0);
+            }
+            i++;
+            running++;
+            continue;
+        }
+        if (wait(0) <= 0)
+            break;
+        running--;
+        while (read(fds[0], &r, sizeof(r)) == sizeof(r))
+            record_result(&r, ++done);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    if (done < num_configs)
+        printf("%d configurations did not finish\n", num_configs - done);
+
+    double total_steps = (double)num_configs * num_steps;
+    printf("Done in %f s, %f steps per second overall\n",
+           wallClock() - start, total_steps / (wallClock() - start));
+
+    fclose(results);
+    free(configs);
+    return 0;
+}
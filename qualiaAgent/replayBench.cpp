@@ -0,0 +1,87 @@
+/*
+ * replayBench.cpp
+ *
+ * (c) 2012 Sofian Audry -- info(@)sofianaudry(.)com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures append and minibatch sampling rates of the replay store.
+
+#include "ReplayBuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define N_TRANSITIONS 10000000
+#define BATCH_SIZE 32
+
+double wallClock()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 4) {
+    printf("Usage: %s <file> [n_transitions=%d] [dim_observations=4]\n",
+           argv[0], N_TRANSITIONS);
+    return 1;
+  }
+  const char* path = argv[1];
+  unsigned long long n = (argc > 2 ? atoll(argv[2]) : N_TRANSITIONS);
+  unsigned int dim = (argc > 3 ? atoi(argv[3]) : 4);
+
+  unlink(path);
+  ReplayBuffer replay;
+  if (!replay.open(path, n, dim, 1))
+    return 1;
+
+  float obs[dim], next[dim];
+  unsigned int action = 0;
+  for (unsigned int i=0; i<dim; i++)
+    obs[i] = next[i] = i;
+
+  double start = wallClock();
+  for (unsigned long long i=0; i<n; i++) {
+    obs[0] = i;
+    action = i & 1;
+    replay.append(obs, &action, 0.5f, next);
+  }
+  double elapsed = wallClock() - start;
+  printf("Append: %llu transitions in %f s, %f per second\n",
+         n, elapsed, n / elapsed);
+
+  // Touch each sampled record so the reads are not optimized away
+  const float* batch[BATCH_SIZE];
+  double sum = 0;
+  unsigned long long nBatches = n / BATCH_SIZE;
+  start = wallClock();
+  for (unsigned long long i=0; i<nBatches; i++) {
+    int count = replay.sampleBatch(batch, BATCH_SIZE);
+    for (int k=0; k<count; k++)
+      sum += replay.reward(batch[k]) + replay.observation(batch[k])[0];
+  }
+  elapsed = wallClock() - start;
+  printf("Sample: %llu transitions in batches of %d in %f s, %f per second (%g)\n",
+         nBatches * BATCH_SIZE, BATCH_SIZE, elapsed,
+         nBatches * BATCH_SIZE / elapsed, sum);
+
+  replay.close();
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,272 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "influence_shm.h"
+#include "influence_time.h"
+
+/* Compares delivering observations to local agents through the
+ * shared-memory table against loopback UDP.  The parent plays the
+ * server, ticking at a fixed rate; each child is an agent that sends a
+ * position and waits for its next observation.  UDP here is raw
+ * datagrams, so it is a lower bound on the OSC path through liblo. */
+
+#define BENCH_SHM "/influence.bench"
+#define LATENCY_BINS 24
+
+struct _benchShared
+{
+    int                 stop;
+    unsigned long long  latency[LATENCY_BINS];  // log2 microsecond bins
+    unsigned long long  received;
+};
+
+struct _udpPacket
+{
+    int     agent;
+    int     tick;
+    double  time;
+    float   value[3];
+};
+
+struct _benchShared *shared;
+int num_agents = 8;
+int rate = 200;
+double duration = 5;
+int udp_port = 9876;
+
+void record_latency(double seconds)
+{
+    int bin = itime_bin(seconds, LATENCY_BINS);
+    __atomic_add_fetch(&shared->latency[bin], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shared->received, 1, __ATOMIC_RELAXED);
+}
+
+double percentile(double p)
+{
+    unsigned long long count = 0, target = shared->received * p;
+    int i;
+    for (i = 0; i < LATENCY_BINS; i++) {
+        count += shared->latency[i];
+        if (count > target)
+            return itime_bin_ms(i);
+    }
+    return itime_bin_ms(LATENCY_BINS - 1);
+}
+
+void shm_agent()
+{
+    struct _shmTable *t = shmt_attach(BENCH_SHM);
+    int slot = t ? shmt_claim(t) : -1;
+    if (slot < 0)
+        exit(1);
+    int tick = t->slots[slot].obs_tick;
+    float pos[2] = {slot, slot}, obs[3];
+    while (!shared->stop) {
+        shmt_write_position(&t->slots[slot], pos);
+        int next = shmt_wait_observation(t, slot, tick, 100, obs);
+        if (next < 0)
+            continue;
+        record_latency(itime_now() - t->slots[slot].obs_time);
+        tick = next;
+    }
+    shmt_release(t, slot);
+    shmt_detach(t);
+    exit(0);
+}
+
+void shm_server(struct _shmTable *t)
+{
+    unsigned int seen[SHM_SLOTS];
+    float pos[2], obs[3] = {0, 0, 0};
+    int i, tick = 0;
+    memset(seen, 0, sizeof(seen));
+
+    double next = itime_now(), end = next + duration;
+    while (next < end) {
+        for (i = 0; i < SHM_SLOTS; i++)
+            if (t->slots[i].claimed)
+                shmt_read_position(&t->slots[i], &seen[i], pos);
+        for (i = 0; i < SHM_SLOTS; i++)
+            if (t->slots[i].claimed)
+                shmt_write_observation(&t->slots[i], tick, obs);
+        shmt_wake(t);
+        tick++;
+
+        next += 1.0 / rate;
+        double wait = next - itime_now();
+        if (wait > 0)
+            usleep(wait * 1000000);
+    }
+    shared->stop = 1;
+    while (wait(0) > 0) {}
+    shmt_destroy(t, BENCH_SHM);
+}
+
+void udp_agent(int id)
+{
+    struct sockaddr_in server;
+    struct _udpPacket p;
+    struct timeval tv = {0, 100000};
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(udp_port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    while (!shared->stop) {
+        p.agent = id;
+        p.value[0] = p.value[1] = id;
+        sendto(s, &p, sizeof(p), 0, (struct sockaddr*)&server,
+               sizeof(server));
+        if (recv(s, &p, sizeof(p), 0) == sizeof(p))
+            record_latency(itime_now() - p.time);
+    }
+    close(s);
+    exit(0);
+}
+
+void udp_server()
+{
+    struct sockaddr_in addr, agents[SHM_SLOTS];
+    socklen_t len;
+    struct _udpPacket p;
+    int i, tick = 0, known[SHM_SLOTS];
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(udp_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(s, (struct sockaddr*)&addr, sizeof(addr));
+    fcntl(s, F_SETFL, O_NONBLOCK);
+    memset(known, 0, sizeof(known));
+
+    double next = itime_now(), end = next + duration;
+    while (next < end) {
+        len = sizeof(addr);
+        while (recvfrom(s, &p, sizeof(p), 0, (struct sockaddr*)&addr,
+                        &len) == sizeof(p)) {
+            if (p.agent >= 0 && p.agent < SHM_SLOTS) {
+                agents[p.agent] = addr;
+                known[p.agent] = 1;
+            }
+            len = sizeof(addr);
+        }
+        for (i = 0; i < SHM_SLOTS; i++) {
+            if (!known[i])
+                continue;
+            p.agent = i;
+            p.tick = tick;
+            p.time = itime_now();
+            p.value[0] = p.value[1] = p.value[2] = 0;
+            sendto(s, &p, sizeof(p), 0, (struct sockaddr*)&agents[i],
+                   sizeof(agents[i]));
+        }
+        tick++;
+
+        next += 1.0 / rate;
+        double wait = next - itime_now();
+        if (wait > 0)
+            usleep(wait * 1000000);
+    }
+    shared->stop = 1;
+    while (wait(0) > 0) {}
+    close(s);
+}
+
+double cpu_seconds(int who)
+{
+    struct rusage ru;
+    getrusage(who, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0
+           + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+}
+
+void run(const char *name, int shm)
+{
+    int i;
+    struct _shmTable *t = 0;
+    memset(shared, 0, sizeof(*shared));
+    double server_cpu = cpu_seconds(RUSAGE_SELF);
+    double agent_cpu = cpu_seconds(RUSAGE_CHILDREN);
+
+    // the table has to exist before the agents attach
+    if (shm && !(t = shmt_create(BENCH_SHM)))
+        exit(1);
+    fflush(stdout);
+    for (i = 0; i < num_agents; i++) {
+        if (fork() == 0) {
+            if (shm)
+                shm_agent();
+            else
+                udp_agent(i);
+        }
+    }
+    if (shm)
+        shm_server(t);
+    else
+        udp_server();
+
+    server_cpu = cpu_seconds(RUSAGE_SELF) - server_cpu;
+    agent_cpu = cpu_seconds(RUSAGE_CHILDREN) - agent_cpu;
+    double ticks = rate * duration;
+    printf("%s: %llu observations, latency p50 < %.3f ms, p99 < %.3f ms, "
+           "CPU per tick: server %.1f us, agents %.1f us\n", name,
+           shared->received, percentile(0.5), percentile(0.99),
+           server_cpu / ticks * 1000000, agent_cpu / ticks * 1000000);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "hn:r:d:")) != -1)
+    {
+        switch (c)
+        {
+        case 'h':
+            printf("Usage: shmbench [-h] [-n <agents>] [-r <rate>] "
+                   "[-d <seconds>]\n");
+            printf("  -n  Agents, default=%d, at most %d\n", num_agents,
+                   SHM_SLOTS);
+            printf("  -r  Server ticks per second, default=%d\n", rate);
+            printf("  -d  Seconds per transport, default=%g\n", duration);
+            exit(0);
+        case 'n':
+            num_agents = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        default:
+            exit(1);
+        }
+    }
+    if (num_agents > SHM_SLOTS)
+        num_agents = SHM_SLOTS;
+
+    shared = (struct _benchShared*)mmap(0, sizeof(struct _benchShared),
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    printf("%d agents, %d ticks/s, %g s per transport\n", num_agents, rate,
+           duration);
+    run("udp", 0);
+    run("shm", 1);
+    return 0;
+}